@@ -0,0 +1,393 @@
+#include "airflow_solver.hpp"
+
+#include "math.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+namespace {
+const uint32_t NO_EDGE = static_cast<uint32_t>(-1);
+const double SECONDS_PER_HOUR = 3600.0;
+const double LAMINAR_REYNOLDS = 2300.0;
+
+// Model keeps geometry in centimeters, duct sizes in millimeters.
+double world_to_m(double x) { return x / 100.0; }
+double mm_to_m(double x) { return x / 1000.0; }
+
+double circle_area(double d) { return M_PI * d * d / 4.0; }
+} // namespace
+
+double fitting_loss_coefficient(const Fitting &f) {
+    if (auto adapter = std::get_if<Adapter>(&f.fitting_variant)) {
+        // Borda-Carnot for a sudden change of section. Real adapters are gradual so this errs on
+        // the safe side.
+        const double d_min = std::min(adapter->begin_d, adapter->end_d);
+        const double d_max = std::max(adapter->begin_d, adapter->end_d);
+        if (d_max <= 0.0) {
+            return 0.0;
+        }
+        const double area_ratio = (d_min * d_min) / (d_max * d_max);
+        return (1.0 - area_ratio) * (1.0 - area_ratio);
+    } else if (std::get_if<Split3>(&f.fitting_variant)) {
+        // Branch of a tee.
+        return 0.5;
+    }
+    return 0.0;
+}
+
+double friction_factor(double velocity_ms, double diameter_m, const AirflowSettings &s) {
+    const double reynolds = velocity_ms * diameter_m / s.kinematic_viscosity;
+    if (reynolds > LAMINAR_REYNOLDS) {
+        // Swamee-Jain approximation of Colebrook equation.
+        const double t =
+            std::log10(s.roughness_m / (3.7 * diameter_m) + 5.74 / std::pow(reynolds, 0.9));
+        return 0.25 / (t * t);
+    } else if (reynolds > 0.0) {
+        return 64.0 / reynolds;
+    }
+    return 0.0;
+}
+
+AirflowSolver::AirflowSolver(AirflowSettings settings) : m_settings(settings) {}
+
+void AirflowSolver::set_source(Point p) {
+    m_sources.push_back(p);
+    m_solve_all = true;
+}
+
+void AirflowSolver::set_terminal_flow(Point p, double flow_m3h) {
+    m_terminal_flows.emplace_back(p, flow_m3h);
+    m_solve_all = true;
+}
+
+void AirflowSolver::invalidate(const ElementRef &e) { m_dirty.insert(e); }
+
+void AirflowSolver::invalidate_all() { m_solve_all = true; }
+
+const ElementFlow *AirflowSolver::flow(const ElementRef &e) const {
+    auto it = m_flows.find(e);
+    return it != m_flows.end() ? &it->second : nullptr;
+}
+
+std::optional<double> AirflowSolver::node_pressure(DuctNetwork::NodeId n) const {
+    auto it = m_pressures.find(n);
+    if (it == m_pressures.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+size_t AirflowSolver::solve(const Model &m, const DuctNetwork &network) {
+    if (!has_pending()) {
+        return 0;
+    }
+
+    ModelIndex index;
+    for (auto &d : m.ducts) {
+        index.ducts.emplace(d.id, &d);
+    }
+    for (auto &f : m.fittings) {
+        index.fittings.emplace(f.id, &f);
+    }
+
+    std::vector<ElementRef> seeds;
+    if (m_solve_all) {
+        m_flows.clear();
+        m_pressures.clear();
+        m_solved_nodes.clear();
+        for (auto &d : m.ducts) {
+            seeds.push_back(ElementRef{ElementKind::duct, d.id});
+        }
+        for (auto &f : m.fittings) {
+            seeds.push_back(ElementRef{ElementKind::fitting, f.id});
+        }
+    } else {
+        seeds.assign(m_dirty.begin(), m_dirty.end());
+        // Changed and removed elements may have left their nodes, before anything is solved
+        // again so that nodes still in use get their pressure back.
+        for (auto &ref : seeds) {
+            forget_nodes(ref);
+        }
+    }
+
+    std::unordered_set<size_t> solved_components;
+    for (auto &ref : seeds) {
+        auto component = network.component_id(ref);
+        if (!component) {
+            m_flows.erase(ref);
+            continue;
+        }
+        if (solved_components.insert(*component).second) {
+            solve_component(network.connected_component(ref), network, index);
+        }
+    }
+
+    m_dirty.clear();
+    m_solve_all = false;
+    return solved_components.size();
+}
+
+double AirflowSolver::resistance(const Edge &e) const {
+    if (e.diameter_m <= 0.0) {
+        return 0.0;
+    }
+    const double area = circle_area(e.diameter_m);
+    double friction = 0.0;
+    if (e.length_m > 0.0) {
+        friction = friction_factor(std::fabs(e.flow) / area, e.diameter_m, m_settings);
+    }
+    const double k = friction * e.length_m / e.diameter_m + e.loss_coefficient;
+    return k * m_settings.air_density / (2.0 * area * area);
+}
+
+// Signed, positive when flow goes from n0 to n1.
+double AirflowSolver::pressure_drop(const Edge &e) const {
+    return resistance(e) * e.flow * std::fabs(e.flow);
+}
+
+void AirflowSolver::forget_nodes(const ElementRef &e) {
+    auto it = m_solved_nodes.find(e);
+    if (it == m_solved_nodes.end()) {
+        return;
+    }
+    for (auto n : it->second) {
+        m_pressures.erase(n);
+    }
+    m_solved_nodes.erase(it);
+}
+
+void AirflowSolver::solve_component(const std::vector<ElementRef> &elements,
+                                    const DuctNetwork &network, const ModelIndex &model) {
+    for (auto &ref : elements) {
+        forget_nodes(ref);
+    }
+
+    // Local graph of the component.
+    std::vector<Edge> edges;
+    edges.reserve(elements.size());
+    std::vector<DuctNetwork::NodeId> nodes;
+    std::unordered_map<DuctNetwork::NodeId, uint32_t> local_nodes;
+    auto local_node = [&](DuctNetwork::NodeId n) {
+        auto [it, inserted] = local_nodes.emplace(n, static_cast<uint32_t>(nodes.size()));
+        if (inserted) {
+            nodes.push_back(n);
+        }
+        return it->second;
+    };
+
+    const Duct *first_duct = nullptr;
+    for (auto &ref : elements) {
+        auto ends = network.element_nodes(ref);
+        if (!ends) {
+            continue;
+        }
+        Edge e;
+        e.ref = ref;
+        e.n0 = local_node((*ends)[0]);
+        e.n1 = local_node((*ends)[1]);
+        if (ref.kind == ElementKind::duct) {
+            auto it = model.ducts.find(ref.id);
+            if (it == model.ducts.end()) {
+                continue;
+            }
+            auto &d = *it->second;
+            e.length_m = world_to_m(math::points_distance(d.begin, d.end));
+            e.diameter_m = mm_to_m(d.size_mm);
+            if (!first_duct || &d < first_duct) {
+                first_duct = &d;
+            }
+        } else {
+            auto it = model.fittings.find(ref.id);
+            if (it == model.fittings.end()) {
+                continue;
+            }
+            auto &f = *it->second;
+            if (auto adapter = std::get_if<Adapter>(&f.fitting_variant)) {
+                e.diameter_m = world_to_m(std::min(adapter->begin_d, adapter->end_d));
+            }
+            e.loss_coefficient = fitting_loss_coefficient(f);
+        }
+        if (auto prev = m_flows.find(ref); prev != m_flows.end()) {
+            e.flow = prev->second.flow_m3s;
+        }
+        edges.push_back(e);
+    }
+    const size_t node_count = nodes.size();
+    if (edges.empty()) {
+        return;
+    }
+
+    std::vector<std::vector<uint32_t>> adjacency(node_count);
+    for (uint32_t i = 0; i < edges.size(); ++i) {
+        adjacency[edges[i].n0].push_back(i);
+        if (edges[i].n1 != edges[i].n0) {
+            adjacency[edges[i].n1].push_back(i);
+        }
+    }
+
+    // Source: explicitly set one or open begin of the earliest duct of the component.
+    std::optional<uint32_t> source;
+    for (auto p : m_sources) {
+        if (auto n = network.node_at(p)) {
+            if (auto it = local_nodes.find(*n); it != local_nodes.end()) {
+                source = it->second;
+                break;
+            }
+        }
+    }
+    if (!source && first_duct) {
+        if (auto n = network.node_at(first_duct->begin)) {
+            source = local_nodes.at(*n);
+        }
+    }
+    if (!source) {
+        source = 0;
+    }
+
+    // Demands, positive means air leaves the network at the node.
+    std::unordered_map<DuctNetwork::NodeId, double> flow_overrides;
+    for (auto &[p, flow_m3h] : m_terminal_flows) {
+        if (auto n = network.node_at(p)) {
+            flow_overrides[*n] = flow_m3h;
+        }
+    }
+    std::vector<double> demand(node_count, 0.0);
+    double total = 0.0;
+    for (uint32_t n = 0; n < node_count; ++n) {
+        if (n == *source || adjacency[n].size() != 1) {
+            continue;
+        }
+        auto it = flow_overrides.find(nodes[n]);
+        double flow_m3h = it != flow_overrides.end() ? it->second : m_settings.terminal_flow_m3h;
+        demand[n] = flow_m3h / SECONDS_PER_HOUR;
+        total += demand[n];
+    }
+    demand[*source] = -total;
+
+    // Spanning tree from the source, edges outside of it close loops.
+    std::vector<uint32_t> parent_edge(node_count, NO_EDGE);
+    std::vector<uint32_t> depth(node_count, 0);
+    std::vector<bool> visited(node_count, false);
+    std::vector<bool> in_tree(edges.size(), false);
+    std::vector<uint32_t> order;
+    order.reserve(node_count);
+    std::deque<uint32_t> queue{*source};
+    visited[*source] = true;
+    while (!queue.empty()) {
+        auto n = queue.front();
+        queue.pop_front();
+        order.push_back(n);
+        for (auto e : adjacency[n]) {
+            auto other = edges[e].n0 == n ? edges[e].n1 : edges[e].n0;
+            if (!visited[other]) {
+                visited[other] = true;
+                parent_edge[other] = e;
+                depth[other] = depth[n] + 1;
+                in_tree[e] = true;
+                queue.push_back(other);
+            }
+        }
+    }
+    auto parent_of = [&](uint32_t n) {
+        auto &e = edges[parent_edge[n]];
+        return e.n0 == n ? e.n1 : e.n0;
+    };
+
+    // Tree flows follow from demands and chord flows by conservation at every node.
+    {
+        std::vector<double> outflow = demand;
+        for (uint32_t i = 0; i < edges.size(); ++i) {
+            if (!in_tree[i]) {
+                if (edges[i].n0 == edges[i].n1) {
+                    edges[i].flow = 0.0;
+                }
+                outflow[edges[i].n0] += edges[i].flow;
+                outflow[edges[i].n1] -= edges[i].flow;
+            }
+        }
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+            auto n = *it;
+            if (n == *source) {
+                continue;
+            }
+            auto &e = edges[parent_edge[n]];
+            auto parent = parent_of(n);
+            e.flow = e.n0 == parent ? outflow[n] : -outflow[n];
+            outflow[parent] += outflow[n];
+        }
+    }
+
+    // Loops: chord followed by tree path back to its beginning. Sign tells whether an edge is
+    // passed along its orientation.
+    std::vector<std::vector<std::pair<uint32_t, int>>> loops;
+    for (uint32_t c = 0; c < edges.size(); ++c) {
+        if (in_tree[c] || edges[c].n0 == edges[c].n1) {
+            continue;
+        }
+        std::vector<std::pair<uint32_t, int>> loop{{c, 1}};
+        std::vector<std::pair<uint32_t, int>> down;
+        uint32_t up_node = edges[c].n1;   // walk from the end of the chord up to common ancestor
+        uint32_t down_node = edges[c].n0; // and from the beginning, this part is reversed
+        while (up_node != down_node) {
+            if (depth[up_node] >= depth[down_node]) {
+                auto e = parent_edge[up_node];
+                loop.emplace_back(e, edges[e].n0 == up_node ? 1 : -1);
+                up_node = parent_of(up_node);
+            } else {
+                auto e = parent_edge[down_node];
+                down.emplace_back(e, edges[e].n1 == down_node ? 1 : -1);
+                down_node = parent_of(down_node);
+            }
+        }
+        loop.insert(loop.end(), down.rbegin(), down.rend());
+        loops.push_back(std::move(loop));
+    }
+
+    // Hardy-Cross: correct every loop until pressure drops around all of them balance out.
+    for (int iteration = 0; iteration < m_settings.max_iterations && !loops.empty();
+         ++iteration) {
+        double max_correction = 0.0;
+        for (auto &loop : loops) {
+            double imbalance = 0.0;
+            double derivative = 0.0;
+            for (auto [e, sign] : loop) {
+                imbalance += sign * pressure_drop(edges[e]);
+                derivative += 2.0 * resistance(edges[e]) * std::fabs(edges[e].flow);
+            }
+            if (derivative <= 0.0) {
+                continue;
+            }
+            const double correction = -imbalance / derivative;
+            for (auto [e, sign] : loop) {
+                edges[e].flow += sign * correction;
+            }
+            max_correction = std::max(max_correction, std::fabs(correction));
+        }
+        if (max_correction < m_settings.tolerance_m3s) {
+            break;
+        }
+    }
+
+    for (auto &e : edges) {
+        ElementFlow result;
+        result.flow_m3s = e.flow;
+        result.velocity_ms = e.diameter_m > 0.0 ? std::fabs(e.flow) / circle_area(e.diameter_m)
+                                                : 0.0;
+        result.pressure_drop_pa = std::fabs(pressure_drop(e));
+        m_flows[e.ref] = result;
+        m_solved_nodes[e.ref] = {nodes[e.n0], nodes[e.n1]};
+    }
+
+    // Static pressure accumulates losses along the tree.
+    std::vector<double> pressure(node_count, 0.0);
+    for (auto n : order) {
+        if (n != *source) {
+            auto &e = edges[parent_edge[n]];
+            auto parent = parent_of(n);
+            const double drop = pressure_drop(e);
+            pressure[n] = e.n0 == parent ? pressure[parent] - drop : pressure[parent] + drop;
+        }
+        m_pressures[nodes[n]] = pressure[n];
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "duct_network.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct AirflowSettings {
+    double terminal_flow_m3h = 100.0; // design airflow at every open end of the network
+    double air_density = 1.2;         // kg/m3
+    double kinematic_viscosity = 1.5e-5; // m2/s
+    double roughness_m = 0.00015;        // galvanized steel
+    int max_iterations = 50;
+    double tolerance_m3s = 1e-7; // Hardy-Cross stops when loop corrections are below this
+};
+
+struct ElementFlow {
+    double flow_m3s = 0.0; // positive when air goes from first to second node of the element
+    double velocity_ms = 0.0;
+    double pressure_drop_pa = 0.0;
+};
+
+// Loss coefficient of a fitting related to velocity in its smaller section.
+double fitting_loss_coefficient(const Fitting &f);
+
+// Darcy friction factor of a round duct.
+double friction_factor(double velocity_ms, double diameter_m, const AirflowSettings &s);
+
+// Computes airflow and static pressure loss through the duct network.
+//
+// Every connected component is fed from one source node and open ends are terminals with design
+// airflow. Flows in a tree are fixed by conservation, loops are balanced with Hardy-Cross
+// corrections. Ducts lose pressure by Darcy-Weisbach, fittings by their loss coefficient.
+//
+// Solving is incremental: only components containing invalidated elements are solved again and
+// loops start from previously found flows. Results of other components are kept as they are.
+class AirflowSolver {
+  public:
+    explicit AirflowSolver(AirflowSettings settings = {});
+
+    // Sources and terminal flows are matched to network nodes by position. Components without
+    // explicit source are fed from the open begin of their first duct.
+    void set_source(Point p);
+    void set_terminal_flow(Point p, double flow_m3h);
+
+    // Element was added, changed or removed. When an element is removed its former neighbours
+    // must be invalidated as well, otherwise the component it left is not solved again.
+    void invalidate(const ElementRef &e);
+    void invalidate_all();
+    bool has_pending() const { return m_solve_all || !m_dirty.empty(); }
+
+    // Solves components with invalidated elements, returns number of solved components.
+    size_t solve(const Model &m, const DuctNetwork &network);
+
+    const AirflowSettings &settings() const { return m_settings; }
+
+    const ElementFlow *flow(const ElementRef &e) const;
+    // Static pressure relative to the source of the component (negative downstream).
+    std::optional<double> node_pressure(DuctNetwork::NodeId n) const;
+
+  private:
+    struct Edge {
+        ElementRef ref;
+        uint32_t n0 = 0, n1 = 0;  // local node indices
+        double length_m = 0.0;    // zero for fittings
+        double diameter_m = 0.0;  // smaller diameter for fittings
+        double loss_coefficient = 0.0;
+        double flow = 0.0;
+    };
+
+    // Lookup of model elements by id, valid during one solve.
+    struct ModelIndex {
+        std::unordered_map<std::string, const Duct *> ducts;
+        std::unordered_map<std::string, const Fitting *> fittings;
+    };
+
+    void solve_component(const std::vector<ElementRef> &elements, const DuctNetwork &network,
+                         const ModelIndex &model);
+    // Drops pressures of the nodes `e` had when it was last solved, they may be gone or reused.
+    void forget_nodes(const ElementRef &e);
+    double resistance(const Edge &e) const;
+    double pressure_drop(const Edge &e) const;
+
+    AirflowSettings m_settings;
+    std::vector<Point> m_sources;
+    std::vector<std::pair<Point, double>> m_terminal_flows;
+
+    bool m_solve_all = true;
+    std::unordered_set<ElementRef, ElementRefHash> m_dirty;
+
+    std::unordered_map<ElementRef, ElementFlow, ElementRefHash> m_flows;
+    std::unordered_map<DuctNetwork::NodeId, double> m_pressures;
+    // Nodes of every element as of its last solve, the network recycles node ids.
+    std::unordered_map<ElementRef, std::array<DuctNetwork::NodeId, 2>, ElementRefHash>
+        m_solved_nodes;
+};
@@ -0,0 +1,144 @@
+#include "bill_of_materials.hpp"
+
+#include "math.hpp"
+
+#include <cmath>
+#include <cstdio>
+
+namespace {
+// Model keeps geometry in centimeters.
+int64_t duct_length_mm(const Duct &d) {
+    return std::llround(math::points_distance(d.begin, d.end) * 10.0);
+}
+
+unsigned world_to_mm(double x) { return static_cast<unsigned>(std::lround(x * 10.0)); }
+} // namespace
+
+FittingKey fitting_key(const Fitting &f) {
+    FittingKey key;
+    if (auto adapter = std::get_if<Adapter>(&f.fitting_variant)) {
+        key.type = FittingType::adapter;
+        key.d1_mm = world_to_mm(std::min(adapter->begin_d, adapter->end_d));
+        key.d2_mm = world_to_mm(std::max(adapter->begin_d, adapter->end_d));
+    } else if (std::get_if<Split3>(&f.fitting_variant)) {
+        key.type = FittingType::split3;
+    }
+    return key;
+}
+
+const char *fitting_type_name(FittingType t) {
+    switch (t) {
+    case FittingType::adapter:
+        return "adapter";
+    case FittingType::split3:
+        return "split3";
+    }
+    return "unknown";
+}
+
+void BillOfMaterials::add_duct(const Duct &d) {
+    auto &total = m_ducts[d.size_mm];
+    const auto length = duct_length_mm(d);
+    total.length_mm += length;
+    total.count += 1;
+    m_total_length_mm += length;
+}
+
+bool BillOfMaterials::remove_duct(const Duct &d) {
+    auto it = m_ducts.find(d.size_mm);
+    if (it == m_ducts.end()) {
+        return false;
+    }
+    const auto length = duct_length_mm(d);
+    it->second.length_mm -= length;
+    it->second.count -= 1;
+    m_total_length_mm -= length;
+    if (it->second.count == 0) {
+        m_ducts.erase(it);
+    }
+    return true;
+}
+
+bool BillOfMaterials::update_duct(const Duct &before, const Duct &after) {
+    const bool counted = remove_duct(before);
+    add_duct(after);
+    return counted;
+}
+
+void BillOfMaterials::add_fitting(const Fitting &f) {
+    m_fittings[fitting_key(f)] += 1;
+    m_total_fittings += 1;
+}
+
+bool BillOfMaterials::remove_fitting(const Fitting &f) {
+    auto it = m_fittings.find(fitting_key(f));
+    if (it == m_fittings.end()) {
+        return false;
+    }
+    m_total_fittings -= 1;
+    if (--it->second == 0) {
+        m_fittings.erase(it);
+    }
+    return true;
+}
+
+bool BillOfMaterials::update_fitting(const Fitting &before, const Fitting &after) {
+    const bool counted = remove_fitting(before);
+    add_fitting(after);
+    return counted;
+}
+
+void BillOfMaterials::clear() {
+    m_ducts.clear();
+    m_fittings.clear();
+    m_total_length_mm = 0;
+    m_total_fittings = 0;
+}
+
+void BillOfMaterials::rebuild(const Model &m) {
+    clear();
+    for (auto &d : m.ducts) {
+        add_duct(d);
+    }
+    for (auto &f : m.fittings) {
+        add_fitting(f);
+    }
+}
+
+void BillOfMaterials::model_changed(const ModelChanges &changes) {
+    for (auto &c : changes.ducts) {
+        if (c.kind == ChangeKind::removed) {
+            remove_duct(*c.before);
+        } else if (c.kind == ChangeKind::added) {
+            add_duct(*c.after);
+        } else if (c.touches(ChangedField::geometry | ChangedField::size)) {
+            update_duct(*c.before, *c.after);
+        }
+    }
+    for (auto &c : changes.fittings) {
+        if (c.kind == ChangeKind::removed) {
+            remove_fitting(*c.before);
+        } else if (c.kind == ChangeKind::added) {
+            add_fitting(*c.after);
+        } else if (c.touches(ChangedField::geometry | ChangedField::size)) {
+            update_fitting(*c.before, *c.after);
+        }
+    }
+}
+
+void BillOfMaterials::write_csv(std::ostream &os) const {
+    os << "item,size_mm,quantity,unit\n";
+    // Formatted here, the caller's stream keeps its own float format.
+    char metres[32];
+    for (auto &[size_mm, total] : m_ducts) {
+        std::snprintf(metres, sizeof(metres), "%.3f", total.length_mm / 1000.0);
+        os << "duct," << size_mm << ',' << metres << ",m\n";
+    }
+    for (auto &[key, count] : m_fittings) {
+        os << fitting_type_name(key.type) << ',';
+        if (key.type == FittingType::adapter) {
+            os << key.d1_mm << '/' << key.d2_mm;
+        }
+        os << ',' << count << ",pcs\n";
+    }
+}
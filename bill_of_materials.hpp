@@ -0,0 +1,71 @@
+#pragma once
+
+#include "model_changes.hpp"
+#include "types.hpp"
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <tuple>
+
+enum class FittingType { adapter, split3 };
+
+// Fittings are counted per type and connection sizes. Adapter is the same part whichever way it
+// is installed, so its smaller size always goes first.
+struct FittingKey {
+    FittingType type = FittingType::adapter;
+    unsigned d1_mm = 0;
+    unsigned d2_mm = 0;
+
+    bool operator<(const FittingKey &o) const {
+        return std::tie(type, d1_mm, d2_mm) < std::tie(o.type, o.d1_mm, o.d2_mm);
+    }
+};
+
+FittingKey fitting_key(const Fitting &f);
+const char *fitting_type_name(FittingType t);
+
+// Running totals of duct length per diameter and fitting count per kind, for quoting a job.
+//
+// Totals are updated by every add, remove or change of an element, the model is never walked
+// again. Lengths are accumulated in whole millimetres so that removing a duct takes away exactly
+// what adding it added, no matter how many edits happened in between.
+class BillOfMaterials : public IModelObserver {
+  public:
+    struct DuctTotal {
+        int64_t length_mm = 0;
+        size_t count = 0;
+    };
+
+    // Removing and updating return false when the element, or its state before, was never counted
+    // and totals cannot take it away.
+    void add_duct(const Duct &d);
+    bool remove_duct(const Duct &d);
+    // Duct was resized or moved, `before` is its previous state.
+    bool update_duct(const Duct &before, const Duct &after);
+
+    void add_fitting(const Fitting &f);
+    bool remove_fitting(const Fitting &f);
+    bool update_fitting(const Fitting &before, const Fitting &after);
+
+    void clear();
+    // For loading a model, edits should use methods above.
+    void rebuild(const Model &m);
+    // Follows ducts and fittings changed in geometry or size.
+    void model_changed(const ModelChanges &changes) override;
+
+    // Keyed by duct size in millimetres.
+    const std::map<unsigned, DuctTotal> &duct_totals() const { return m_ducts; }
+    const std::map<FittingKey, size_t> &fitting_totals() const { return m_fittings; }
+    int64_t total_duct_length_mm() const { return m_total_length_mm; }
+    size_t total_fitting_count() const { return m_total_fittings; }
+
+    // One row per duct size and per fitting kind.
+    void write_csv(std::ostream &os) const;
+
+  private:
+    std::map<unsigned, DuctTotal> m_ducts;
+    std::map<FittingKey, size_t> m_fittings;
+    int64_t m_total_length_mm = 0;
+    size_t m_total_fittings = 0;
+};
@@ -1,12 +1,19 @@
 #include "canvas_widget.hpp"
 
+#include "debug_output.hpp"
+#include "duct_run.hpp"
 #include "math.hpp"
 #include "v2.hpp"
 
 #include <QDebug>
+#include <QGuiApplication>
 #include <QKeyEvent>
 #include <QPaintEvent>
 #include <QPainter>
+#include <QScreen>
+#include <array>
+#include <cassert>
+#include <cstdio>
 
 #include <sstream>
 #include <vector>
@@ -18,13 +25,35 @@ const auto Grey = QColor(100, 100, 100);
 const auto LightGrey = QColor(200, 200, 200);
 
 const auto HowerColor = Blue;
-
-const int RULER_WIDTH_PIXELS = 10;
-
-std::string format_distance_display_text(double distance) {
-    std::stringstream ss;
-    ss << static_cast<int>(std::round(distance)) << "m";
-    return ss.str();
+const auto DuctBodyColor = QColor(190, 210, 235);
+const auto ClashColor = QColor(220, 30, 30);
+
+const unsigned DEFAULT_DUCT_SIZE_MM = 125;
+const unsigned DEFAULT_ADAPTER_LENGTH_MM = 100;
+const double MIN_AIRFLOW_LABEL_LENGTH_PIXELS = 150.0;
+const double DUCT_ENDPOINT_TOLERANCE = 0.5;
+const double LINE_ENDPOINT_TOLERANCE = 0.5;
+
+const double SNAP_RADIUS_PIXELS = 10.0;
+// Lines showing where next leg of a duct run can go.
+const double DIRECTION_LINE_LENGTH_PIXELS = 2000.0;
+const double SNAP_MARKER_PIXELS = 10.0;
+const double CLASH_MARKER_PIXELS = 14.0;
+
+const int RULER_WIDTH_PIXELS = 20;
+
+// Regions consisting of more rects than this are painted at once using their bounding rect.
+const int MAX_SEPARATELY_PAINTED_RECTS = 4;
+
+// Geometry is culled against painted rect grown by this amount to account for strokes, hover
+// markers and handles drawn around it.
+const double CULLING_MARGIN_PIXELS = 10.0;
+
+// Whole metres, e.g. "12m". Text stays in the returned array, nothing is allocated.
+std::array<char, 16> format_distance_display_text(double distance) {
+    std::array<char, 16> text{};
+    std::snprintf(text.data(), text.size(), "%dm", static_cast<int>(std::round(distance)));
+    return text;
 }
 
 QPointF to_qpointf(Point p) { return QPointF(p.x, p.y); }
@@ -41,17 +70,80 @@ bool in_rect(int x, int y, Rect r) {
 
 bool in_rect(Point p, Rect r) { return in_rect(p.x, p.y, r); }
 
+bool same_line(Line l1, Line l2) {
+    return l1.a.x == l2.a.x && l1.a.y == l2.a.y && l1.b.x == l2.b.x && l1.b.y == l2.b.y;
+}
+
+Rect line_bounds(Line l) {
+    const double x = std::min(l.a.x, l.b.x);
+    const double y = std::min(l.a.y, l.b.y);
+    return Rect{x, y, std::fabs(l.b.x - l.a.x), std::fabs(l.b.y - l.a.y)};
+}
+
+// Direction leading out of a duct which ends at `p`, a run started there continues it.
+std::optional<v2> duct_direction_at(const EndpointIndex &endpoints, Point p) {
+    if (auto end = endpoints.closest(p, DUCT_ENDPOINT_TOLERANCE, EndpointMask::duct)) {
+        return v2{end->other, end->pos};
+    }
+    return std::nullopt;
+}
+
+// Text centered on the duct body and rotated along it, never upside down.
+void draw_duct_label(QPainter *painter, const Duct &duct, double height, const QString &text,
+                     QColor color) {
+    const double length = math::points_distance(duct.begin, duct.end);
+    auto center = Point((duct.begin.x + duct.end.x) / 2.0, (duct.begin.y + duct.end.y) / 2.0);
+    auto frame = Rect::from_center_and_dimensions(center, length, height);
+    double theta_degrees =
+        std::atan2(duct.end.y - duct.begin.y, duct.end.x - duct.begin.x) * 180.0 / M_PI;
+    if (theta_degrees > 90.0) {
+        theta_degrees -= 180.0;
+    } else if (theta_degrees < -90.0) {
+        theta_degrees += 180.0;
+    }
+
+    painter->save();
+    painter->setPen(color);
+    painter->translate(to_qpointf(center));
+    painter->rotate(theta_degrees);
+    painter->translate(-to_qpointf(center));
+    painter->drawText(to_qrectf(frame), Qt::AlignCenter | Qt::AlignVCenter, text);
+    painter->restore();
+}
+
+// Duct whose body is within `tolerance` from `p`.
+std::optional<size_t> duct_under(const std::vector<Duct> &ducts, Point p, double tolerance) {
+    for (size_t i = 0; i < ducts.size(); ++i) {
+        const v2 axis{ducts[i].begin, ducts[i].end};
+        const double l2 = len2(axis);
+        if (l2 == 0.0) {
+            continue;
+        }
+        const double t = std::clamp(dot(v2{ducts[i].begin, p}, axis) / l2, 0.0, 1.0);
+        const Point closest = v2(ducts[i].begin) + axis * t;
+        if (math::points_distance(closest, p) <= duct_width(ducts[i]) / 2.0 + tolerance) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+// Whether move tool is in the middle of moving a line or rect side.
+bool move_in_progress(const Model &m) {
+    const unsigned line_moves =
+        ObjFlags::moving | ObjFlags::a_endpoint_move | ObjFlags::b_endpoint_move;
+    const unsigned rect_moves = ObjFlags::top_rect_line_move | ObjFlags::bottom_rect_line_move |
+                                ObjFlags::left_rect_line_move | ObjFlags::right_rect_line_move;
+    return std::any_of(m.lines.begin(), m.lines.end(),
+                       [&](const LineObj &l) { return l.flags & line_moves; }) ||
+           std::any_of(m.rects.begin(), m.rects.end(),
+                       [&](const RectObj &r) { return r.flags & rect_moves; });
+}
+
 bool point_howers_line(Point p, Line l) {
     return len(v2{p, math::closest_point_to_line(l.a, l.b, p)}) < 10;
 };
 
-v2 rotate_vector(v2 v, double angle_rad) {
-    QTransform m;
-    m.rotateRadians(angle_rad);
-    QPointF qf = QPointF(v.x, v.y) * m;
-    return v2{qf.x(), qf.y()};
-}
-
 const double SELECT_TOOL_HIT_BBOX = 20.0;
 
 std::array<Point, 4> line_bbox(Line l, double size) {
@@ -128,6 +220,40 @@ void draw_dashed_line(QPainter *painter, Line l, QColor c, double width = 1.0) {
     draw_dashed_line(painter, l.a, l.b, c, width);
 }
 
+// Rings are converted in `memory`, normally the frame arena.
+void draw_dashed_outline(QPainter *painter, const Outline &o, QColor c, double width,
+                         std::pmr::memory_resource *memory) {
+    QPen pen;
+    pen.setColor(c);
+    pen.setStyle(Qt::DashLine);
+    pen.setWidthF(width);
+    painter->setPen(pen);
+    painter->setBrush(Qt::NoBrush);
+    FrameVector<QPointF> polygon(memory);
+    auto draw_ring = [&](const std::vector<Point> &ring) {
+        polygon.clear();
+        for (auto p : ring) {
+            polygon.push_back(to_qpointf(p));
+        }
+        painter->drawPolygon(polygon.data(), static_cast<int>(polygon.size()));
+    };
+    draw_ring(o.outer);
+    for (auto &hole : o.holes) {
+        draw_ring(hole);
+    }
+}
+
+// View transform is always affine so projective part of the matrix is ignored.
+void map_points(const QTransform &m, const Point *in, Point *out, size_t n) {
+    const double m11 = m.m11(), m12 = m.m12(), m21 = m.m21(), m22 = m.m22();
+    const double dx = m.dx(), dy = m.dy();
+    for (size_t i = 0; i < n; ++i) {
+        const double x = in[i].x;
+        const double y = in[i].y;
+        out[i] = Point{m11 * x + m21 * y + dx, m12 * x + m22 * y + dy};
+    }
+}
+
 void draw_colored_point(QPainter *painter, Point p, QColor c, double size = 5.0) {
     QBrush point_brush{c};
     const size_t half_size = size / 2;
@@ -135,8 +261,31 @@ void draw_colored_point(QPainter *painter, Point p, QColor c, double size = 5.0)
     painter->fillRect(point_rect, point_brush);
 }
 
+// Copy of what airflow and sizing read, for jobs which must not see later edits.
+struct AirflowSnapshot {
+    AirflowSolver solver;
+    Model model;
+    DuctNetwork network;
+};
+
+std::shared_ptr<AirflowSnapshot> airflow_snapshot(const AirflowSolver &solver, const Model &m,
+                                                  const DuctNetwork &network) {
+    auto snapshot = std::make_shared<AirflowSnapshot>(AirflowSnapshot{solver, {}, network});
+    snapshot->model.ducts = m.ducts;
+    snapshot->model.fittings = m.fittings;
+    return snapshot;
+}
+
 } // namespace
 
+std::string random_id() {
+    std::string s;
+    for (int i = 0; i < 12; ++i) {
+        s += (rand() % ('Z' - 'A')) + 'A';
+    }
+    return s;
+}
+
 std::string rounder_path(std::vector<Point> path) {
     if (path.empty()) {
         return "";
@@ -221,53 +370,41 @@ std::string rounder_path(std::vector<Point> path) {
     result << " Q" << last_p.x << " " << last_p.y << " " << q1.x << " " << q1.y;
     return result.str();
 }
-std::vector<Point> calculuate_union(const std::vector<Rect> &rects) {
-    if (rects.empty())
-        return {};
-
-    auto sorted_rects = rects;
-    std::sort(sorted_rects.begin(), sorted_rects.end(),
-              [](auto &lhs, auto &rhs) { return lhs.y < rhs.y; });
-
-    const size_t N = sorted_rects.size();
-
-    // we are going to have minimum coords in left
-    // but right margin it will be variable on each level
-    int left_margin = std::numeric_limits<int>::max();
-    for (auto &sr : sorted_rects) {
-        if (sr.x < left_margin) {
-            left_margin = sr.x;
-        }
-    }
-
-    std::vector<Point> rects_union;
-    rects_union.push_back(sorted_rects.front().upper_left_corner());
-    rects_union.back().x = left_margin;
 
-    rects_union.push_back(sorted_rects.front().upper_right_corner());
+CanvasWidget::CanvasWidget(QWidget *parent)
+    : QWidget(parent), m_move_tool(*this, m_model), m_grid_renderer(RULER_WIDTH_PIXELS) {
+    // Every pixel is painted by the background grid, scrolled pixels must not be erased.
+    setAttribute(Qt::WA_OpaquePaintEvent);
+
+    // Canvas goes first, removed elements are still in the network when it invalidates airflow
+    // around them.
+    m_changes.subscribe(this);
+    m_changes.subscribe(&m_network);
+    m_changes.subscribe(&m_bom);
+    m_changes.subscribe(&m_clashes);
+    m_changes.subscribe(&m_intersections);
+    m_changes.subscribe(&m_endpoints);
+    m_changes.subscribe(&m_duct_bodies);
 
-    int current_x = rects_union.back().x;
-    int current_y = rects_union.back().y;
+    Fitting f;
+    f.id = random_id();
+    f.fitting_variant = Adapter{Point(100, 100), Point(200, 200), 30, 60};
+    m_model.fittings.push_back(f);
+    m_changes.added(f);
 
-    for (auto it = std::next(sorted_rects.begin()); it != sorted_rects.end(); ++it) {
-        auto &r = *it;
-        current_y = r.y;
+    m_input_timer.setSingleShot(true);
+    m_input_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_input_timer, &QTimer::timeout, this, &CanvasWidget::process_pending_input);
 
-        rects_union.push_back(Point(current_x, current_y));
-        current_x = r.x + r.width;
-        rects_union.push_back(Point(current_x, current_y));
-    }
+    // Every undo step changes what is drawn.
+    m_undo_stack.set_step_callback([this] { update(); });
 
-    rects_union.push_back(sorted_rects.back().bottom_right_corner());
-    rects_union.push_back(Point(left_margin, sorted_rects.back().bottom_left_corner().y));
+    // Workers only ask for delivery, completions run from the event loop.
+    m_jobs.set_wakeup([this] {
+        QMetaObject::invokeMethod(this, [this] { m_jobs.deliver(); }, Qt::QueuedConnection);
+    });
 
-    return rects_union;
-}
-
-CanvasWidget::CanvasWidget(QWidget *parent) : QWidget(parent), m_move_tool(*this, m_model) {
-    Fitting f;
-    f.fitting_variant = Adapter{Point(100, 100), Point(200, 200), 30, 60};
-    m_model.fittings.push_back(f);
+    update_view_transform();
 }
 
 CanvasWidget::~CanvasWidget() = default;
@@ -275,6 +412,7 @@ CanvasWidget::~CanvasWidget() = default;
 void CanvasWidget::select_tool(Tool tool) {
     qDebug() << "tool selected: " << tool;
     m_selected_tool = tool;
+    cancel_connected_move();
 
     // By default only select tool has tracking one
     if (m_selected_tool == Tool::select || m_selected_tool == Tool::move ||
@@ -289,40 +427,83 @@ void CanvasWidget::select_tool(Tool tool) {
 }
 
 void CanvasWidget::paintEvent(QPaintEvent *event) /*override*/ {
+    m_frame.reset();
     QPainter painter;
 
     painter.begin(this);
     painter.setRenderHint(QPainter::Antialiasing);
 
-    render_background(&painter, event);
+    // After scrolling only strips exposed by it need painting. Each rect of the region is
+    // rendered separately so that culling works with the strip instead of its bounding box.
+    const QRegion &region = event->region();
+    if (region.rectCount() <= MAX_SEPARATELY_PAINTED_RECTS) {
+        for (const QRect &rect : region) {
+            QPaintEvent rect_event(rect);
+            painter.resetTransform();
+            painter.setClipRect(rect);
+            render_scene(&painter, &rect_event);
+        }
+    } else {
+        render_scene(&painter, event);
+    }
 
-    painter.setTransform(get_transformation_matrix());
+    painter.end();
+}
 
-    render_lines(&painter, event);
-    render_handles(&painter, event);
-    render_debug_elements(&painter, event);
+void CanvasWidget::render_scene(QPainter *painter, QPaintEvent *event) {
+    painter->resetTransform();
+    render_background(painter, event);
 
-    if (m_selected_tool == Tool::guide) {
-        render_rulers(&painter, event);
-    }
+    painter->setTransform(get_transformation_matrix());
 
-    render_guides(&painter, event);
+    render_lines(painter, event);
+    render_handles(painter, event);
+    render_debug_elements(painter, event);
 
-    render_rects(&painter, event);
-    render_ducts(&painter, event);
+    render_guides(painter, event);
 
-    painter.end();
+    render_rects(painter, event);
+    render_ducts(painter, event);
+    render_clashes(painter, event);
+    render_snap(painter, event);
+
+    render_rulers(painter, event);
+}
+
+void CanvasWidget::scroll_canvas(int dx, int dy) {
+    if (dx == 0 && dy == 0) {
+        return;
+    }
+    if (std::abs(dx) >= width() || std::abs(dy) >= height()) {
+        update();
+        return;
+    }
+
+    // Qt moves already rendered pixels and schedules repaint of exposed strips only.
+    scroll(dx, dy);
+
+    // Rulers stay attached to widget edges, only their ticks follow the content.
+    update(QRect(0, 0, width(), RULER_WIDTH_PIXELS));
+    update(QRect(0, 0, RULER_WIDTH_PIXELS, height()));
+    update(QRect(0, height() - RULER_WIDTH_PIXELS, width(), RULER_WIDTH_PIXELS));
+    update(QRect(width() - RULER_WIDTH_PIXELS, 0, RULER_WIDTH_PIXELS, height()));
 }
 
 void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
-    auto mouse_screen = Point{static_cast<double>(event->x()), static_cast<double>(event->y())};
+    // Only the latest position matters, all moves within one frame are handled as one.
+    m_pending_input.mouse_move =
+        Point{static_cast<double>(event->x()), static_cast<double>(event->y())};
+    schedule_input_processing();
+}
+
+void CanvasWidget::process_mouse_move(Point mouse_screen) {
     auto mouse_world = screen_to_world(mouse_screen);
-    double x = event->x();
-    double y = event->y();
+    double x = mouse_screen.x;
+    double y = mouse_screen.y;
     auto dx = x - m_prev_x;
     auto dy = y - m_prev_y;
-    m_prev_x = event->x();
-    m_prev_y = event->y();
+    m_prev_x = x;
+    m_prev_y = y;
     double sdx = dx / m_scale;
     double sdy = dy / m_scale;
 
@@ -332,7 +513,7 @@ void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
     }
     case Tool::draw_line: {
         if (m_draw_line_state == DrawLineState::point_a_placed) {
-            m_line_point_b = mouse_world;
+            m_line_point_b = snap_cursor(mouse_world);
             update();
         }
 
@@ -342,10 +523,12 @@ void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
         if (m_hand_tool_state == HandToolState::pressed) {
             m_translate_x -= sdx;
             m_translate_y -= sdy;
+            update_view_transform();
 
-            qDebug() << "translate: " << m_translate_x << ", " << m_translate_y;
+            // Translation is kept in world units but changes by exact mouse delta on screen, so
+            // the frame can be reused by shifting its pixels.
+            scroll_canvas(static_cast<int>(dx), static_cast<int>(dy));
         }
-        update();
         break;
     }
     case Tool::select: {
@@ -363,6 +546,14 @@ void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
         break;
     }
     case Tool::move: {
+        if (auto &move = m_connected_move_state.move) {
+            // Steps go straight into the model, the undo step is pushed when the move finishes.
+            move->solve(v2{m_connected_move_state.origin, mouse_world});
+            put_connected_move(move->ducts(), move->fittings());
+            update();
+            break;
+        }
+
         bool update_needed = false;
 
         for (auto &line : m_model.lines) {
@@ -495,10 +686,22 @@ void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
     case Tool::duct: {
         auto &state = m_duct_tool_state;
         if (state.active) {
-
-            auto maybe_point = suggest_possible_leg_placement(mouse_world, state.polyline);
-            if (maybe_point.has_value()) {
-                state.next_end = maybe_point.value();
+            // With Shift held the rest of the run up to the cursor is routed automatically.
+            if (QGuiApplication::keyboardModifiers() & Qt::ShiftModifier) {
+                update_duct_route(mouse_world);
+                update();
+                break;
+            }
+            state.routing = false;
+            state.route.clear();
+
+            state.next_end = snap_to_duct_run_continuation(
+                state.polyline, mouse_world, DIRECTION_LINE_LENGTH_PIXELS / m_scale);
+            // Leg keeps its direction but may end exactly on geometry it runs into.
+            if (state.polyline.size() >= 2) {
+                state.next_end = snap_cursor_along(state.polyline.back(), state.next_end);
+            } else {
+                state.next_end = snap_cursor(state.next_end);
             }
 
             if (m_duct_tool_state.polyline.empty()) {
@@ -508,6 +711,7 @@ void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
             update();
         } else {
             qDebug() << "MMOVE: DUCT: not active";
+            snap_cursor(mouse_world);
 
             // Handling howering. For ducts it makes perfect sense to have snapping to
             // interesting points. These interesting points are: 1) ending of duct so that we
@@ -515,35 +719,39 @@ void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
             // own interesting points So we go through pipes and fittings points and if cursor
             // is close enough, "Activate" a point.
 
-            auto mouse_hovers = [mouse_world](Point pt) {
-                return math::points_distance(pt, mouse_world) < 10.0;
+            const auto hovered = m_endpoints.within(
+                mouse_world, 10.0, EndpointMask::duct | EndpointMask::fitting, m_frame.resource());
+            // Closest hovered end of the element, if any.
+            auto hovered_end = [&hovered](EndpointOwner owner,
+                                          const std::string &id) -> std::optional<int> {
+                for (auto &e : hovered) {
+                    if (e.owner == owner && e.id == id) {
+                        return e.end;
+                    }
+                }
+                return std::nullopt;
             };
 
             // Ducts
             for (auto &duct : m_model.ducts) {
-                if (mouse_hovers(duct.begin)) {
-                    duct.flags |= ObjFlags::duct_a_endpoint_howered;
-                } else if (mouse_hovers(duct.end)) {
-                    duct.flags |= ObjFlags::duct_b_endpoint_howered;
+                duct.flags &=
+                    ~(ObjFlags::duct_a_endpoint_howered | ObjFlags::duct_b_endpoint_howered);
+                if (auto end = hovered_end(EndpointOwner::duct, duct.id)) {
+                    duct.flags |= *end == 0 ? ObjFlags::duct_a_endpoint_howered
+                                            : ObjFlags::duct_b_endpoint_howered;
                 }
             }
 
             // Fittings
             for (auto &fitting : m_model.fittings) {
-                if (auto adapter = std::get_if<Adapter>(&fitting.fitting_variant)) {
-                    if (mouse_hovers(adapter->begin)) {
-                        fitting.flags |= ObjFlags::fitting_a_endpoint_howered;
-                    } else if (mouse_hovers(adapter->end)) {
-                        fitting.flags |= ObjFlags::fitting_b_endpoint_howered;
-                    }
-                } else if (auto split3 = std::get_if<Split3>(&fitting.fitting_variant)) {
-                    if (mouse_hovers(split3->begin)) {
-                        fitting.flags |= ObjFlags::fitting_a_endpoint_howered;
-                    } else if (mouse_hovers(split3->end)) {
-                        fitting.flags |= ObjFlags::fitting_a_endpoint_howered;
-                    }
+                fitting.flags &= ~(ObjFlags::fitting_a_endpoint_howered |
+                                   ObjFlags::fitting_b_endpoint_howered);
+                if (auto end = hovered_end(EndpointOwner::fitting, fitting.id)) {
+                    fitting.flags |= *end == 0 ? ObjFlags::fitting_a_endpoint_howered
+                                               : ObjFlags::fitting_b_endpoint_howered;
                 }
             }
+            update();
         }
         break;
     }
@@ -562,15 +770,14 @@ void CanvasWidget::mouseMoveEvent(QMouseEvent *event) {
         break;
     }
 }
-std::string random_id() {
-    std::string s;
-    for (int i = 0; i < 12; ++i) {
-        s += (rand() % ('Z' - 'A')) + 'A';
-    }
-    return s;
-}
 
 void CanvasWidget::mousePressEvent(QMouseEvent *event) {
+    // Moves that happened before the press must be seen by tools first.
+    process_pending_input();
+    // Model is edited by press and release handlers only, each one is a batch of changes.
+    m_snap_index_dirty = true;
+    ModelBatch batch(m_changes);
+
     double x = event->x();
     double y = event->y();
 
@@ -588,6 +795,7 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
 
         // draw tool is for drawing things
         m_model.points.emplace_back(mouse_world, random_id());
+        m_changes.added(m_model.points.back());
 
         update();
         break;
@@ -598,10 +806,11 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
             LineObj new_line;
             new_line.id = random_id();
             new_line.l.a = m_line_point_a;
-            new_line.l.b = mouse_world;
+            new_line.l.b = snap_cursor(mouse_world);
             m_model.lines.emplace_back(new_line);
-            // m_model.points.emplace_back(new_line.l.a, new_line.id + "__A");
-            // m_model.points.emplace_back(new_line.l.b, new_line.id + "__B");
+            connect_line_endpoints(m_model, m_model.lines.size() - 1, m_endpoints,
+                                   LINE_ENDPOINT_TOLERANCE, &m_changes);
+            m_changes.added(m_model.lines.back());
             m_draw_line_state = DrawLineState::waiting_point_a;
 
             setMouseTracking(false);
@@ -610,7 +819,7 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
         } else {
 
             m_draw_line_state = DrawLineState::point_a_placed;
-            m_line_point_a = mouse_world;
+            m_line_point_a = snap_cursor(mouse_world);
             setMouseTracking(true);
             qDebug() << "LINE: point A placed";
             break;
@@ -627,9 +836,17 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
     case Tool::select: {
         // we are going to test for hits into either points or lines.
         // line is independent thing to point.
-        for (auto &p : m_model.points) {
-            auto point_screen = world_to_screen(p.pt);
-            if (in_rect(mouse_screen, select_bbox(point_screen, SELECT_TOOL_HIT_BBOX))) {
+        // Hit-testing is done in screen space, all points and line endpoints are mapped there in
+        // one batch with the cached view matrix.
+        FrameVector<Point> points_screen(m_model.points.size(), m_frame.resource());
+        for (size_t i = 0; i < m_model.points.size(); ++i) {
+            points_screen[i] = m_model.points[i].pt;
+        }
+        world_to_screen(points_screen.data(), points_screen.data(), points_screen.size());
+
+        for (size_t i = 0; i < m_model.points.size(); ++i) {
+            auto &p = m_model.points[i];
+            if (in_rect(mouse_screen, select_bbox(points_screen[i], SELECT_TOOL_HIT_BBOX))) {
                 if (!is_object_selected(p)) {
                     qDebug() << "hit into point!";
                     mark_object_selected(p);
@@ -646,13 +863,21 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
             // display properties of things.
         }
 
+        FrameVector<Point> lines_screen(m_model.lines.size() * 2, m_frame.resource());
+        for (size_t i = 0; i < m_model.lines.size(); ++i) {
+            lines_screen[2 * i] = m_model.lines[i].l.a;
+            lines_screen[2 * i + 1] = m_model.lines[i].l.b;
+        }
+        world_to_screen(lines_screen.data(), lines_screen.data(), lines_screen.size());
+
         m_projection_points.clear();
-        for (auto &line : m_model.lines) {
+        for (size_t i = 0; i < m_model.lines.size(); ++i) {
+            auto &line = m_model.lines[i];
             auto R = math::closest_point_to_line(line.l.a, line.l.b, mouse_world);
             m_projection_points.emplace_back(R);
             qDebug() << "added closest point: " << R.x << ", " << R.y;
 
-            auto line_screen = world_to_screen(line.l);
+            auto line_screen = Line(lines_screen[2 * i], lines_screen[2 * i + 1]);
             auto bbox_rect_pts = line_bbox(line_screen, 20.0);
             if (math::rect_point_hit_test(bbox_rect_pts, mouse_screen)) {
                 qDebug() << "hit into line " << line.id.c_str() << "!!!!!";
@@ -675,15 +900,39 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
         // in selected state. But for for now, for the sake of simplicity, we can just
         // consider everything and see how it works.
 
+        if (m_connected_move_state.move) {
+            // End of connected move, everything which followed becomes one change.
+            finish_connected_move();
+            update();
+            break;
+        }
+        if (!move_in_progress(m_model)) {
+            if (auto i = duct_under(m_model.ducts, mouse_world, SELECT_TOOL_HIT_BBOX / 2)) {
+                // Beginning of connected move
+                qDebug() << "MOVE: duct " << m_model.ducts[*i].id.c_str();
+                m_connected_move_state.move.emplace(
+                    m_model, m_network, ElementRef{ElementKind::duct, m_model.ducts[*i].id});
+                m_connected_move_state.origin = mouse_world;
+                // Steps of the move are one batch of changes.
+                m_changes.begin();
+                update();
+                break;
+            }
+        }
+
         for (auto &line : m_model.lines) {
             if (line.flags & ObjFlags::moving) {
                 // End of line move
                 line.flags &= ~ObjFlags::moving;
-                line.l = line.shadow_l;
+                if (!same_line(line.l, line.shadow_l)) {
+                    m_undo_stack.push(MoveLineCommand{*this, line.id, line.l, line.shadow_l});
+                }
             } else if (line.flags & (ObjFlags::a_endpoint_move | ObjFlags::b_endpoint_move)) {
                 // Enf of line endpoint move
                 line.flags &= ~(ObjFlags::a_endpoint_move | ObjFlags::b_endpoint_move);
-                line.l = line.shadow_l;
+                if (!same_line(line.l, line.shadow_l)) {
+                    m_undo_stack.push(MoveLineCommand{*this, line.id, line.l, line.shadow_l});
+                }
             } else {
                 // Beginning of linne/endpoints move
                 auto &line_geometry = line.l;
@@ -723,17 +972,25 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
             auto &geometry = rect.rect;
 
             if (rect.flags & ObjFlags::top_rect_line_move) {
+                const RectObj before = rect;
                 rect.rect = rect.shadow_rect;
                 rect.flags &= ~ObjFlags::top_rect_line_move;
+                m_changes.modified(before, rect);
             } else if (rect.flags & ObjFlags::bottom_rect_line_move) {
+                const RectObj before = rect;
                 rect.rect = rect.shadow_rect;
                 rect.flags &= ~ObjFlags::bottom_rect_line_move;
+                m_changes.modified(before, rect);
             } else if (rect.flags & ObjFlags::left_rect_line_move) {
+                const RectObj before = rect;
                 rect.rect = rect.shadow_rect;
                 rect.flags &= ~ObjFlags::left_rect_line_move;
+                m_changes.modified(before, rect);
             } else if (rect.flags & ObjFlags::right_rect_line_move) {
+                const RectObj before = rect;
                 rect.rect = rect.shadow_rect;
                 rect.flags &= ~ObjFlags::right_rect_line_move;
+                m_changes.modified(before, rect);
             } else {
                 if (point_howers_line(mouse_world, geometry.top_line())) {
                     rect.flags |= ObjFlags::top_rect_line_move;
@@ -823,8 +1080,9 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
         } else {
             m_rect_tool_state.p2 = mouse_world;
             m_rect_tool_state.rect_active = false;
-            m_model.rects.emplace_back(
-                RectObj{Rect::from_two_points(m_rect_tool_state.p1, m_rect_tool_state.p2)});
+            m_model.rects.emplace_back(RectObj{
+                random_id(), Rect::from_two_points(m_rect_tool_state.p1, m_rect_tool_state.p2)});
+            m_changes.added(m_model.rects.back());
             update();
         }
 
@@ -842,24 +1100,62 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
         // placed. This apperently is somehow related to Turtle Graphics.
         //
 
+        // Right click finishes the polyline, every its leg becomes a duct in the model.
+        if (state.active && event->button() == Qt::RightButton) {
+            for (size_t i = 1; i < state.polyline.size(); ++i) {
+                Duct duct;
+                duct.id = random_id();
+                duct.size_mm = DEFAULT_DUCT_SIZE_MM;
+                duct.begin = state.polyline[i - 1];
+                duct.end = state.polyline[i];
+                m_model.ducts.emplace_back(duct);
+                m_changes.added(duct);
+            }
+
+            state.active = false;
+            state.polyline.clear();
+            state.directional_lines.clear();
+            state.routing = false;
+            state.route.clear();
+            update();
+            break;
+        }
+
+        // Shift click accepts previewed route as continuation of the polyline.
+        if (state.active && !state.route.empty() && (event->modifiers() & Qt::ShiftModifier)) {
+            state.polyline.insert(state.polyline.end(), state.route.begin() + 1, state.route.end());
+            state.next_end = state.polyline.back();
+            state.directional_lines.clear();
+            state.route.clear();
+            update();
+            break;
+        }
+
         // TODO: this can be continuation of some previous point so we should check where we
         // clicked. For now lets just assume that this is always beginning of new polyline.
         if (!state.active) {
+            // Starting on hovered endpoint continues existing duct.
+            Point start = snap_cursor(mouse_world);
+            for (auto &duct : m_model.ducts) {
+                if (duct.flags & ObjFlags::duct_a_endpoint_howered) {
+                    start = duct.begin;
+                } else if (duct.flags & ObjFlags::duct_b_endpoint_howered) {
+                    start = duct.end;
+                }
+            }
             state.active = true;
-            state.polyline = {mouse_world};
-            state.next_end = mouse_world;
+            state.polyline = {start};
+            state.next_end = start;
             setMouseTracking(true);
             update();
         } else {
             // Already active, commit current point into the path.
             state.polyline.emplace_back(m_duct_tool_state.next_end);
 
-            std::vector<Line> lines_suggestions;
-
             if (state.polyline.size() > 2) {
                 state.directional_lines.clear();
-                auto ends_suggesions =
-                    possible_points_for_next_duct_in_polyline(state.polyline, mouse_world);
+                auto ends_suggesions = duct_run_continuations(
+                    state.polyline, DIRECTION_LINE_LENGTH_PIXELS / m_scale, m_frame.resource());
 
                 for (auto &x : ends_suggesions) {
                     state.directional_lines.emplace_back(Line(state.polyline.back(), x));
@@ -868,14 +1164,25 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event) {
 
             update();
         }
+        break;
     }
 
+    case Tool::adapter: {
+        // Left button adapts hovered duct end to the next larger size from catalogue, right button
+        // to the next smaller one.
+        place_adapter(mouse_world, event->button() != Qt::RightButton);
+        break;
+    }
     default:
         break;
     }
 }
 
 void CanvasWidget::mouseReleaseEvent(QMouseEvent *event) {
+    process_pending_input();
+    m_snap_index_dirty = true;
+    ModelBatch batch(m_changes);
+
     switch (m_selected_tool) {
     case Tool::draw_point: {
         break;
@@ -893,7 +1200,8 @@ void CanvasWidget::mouseReleaseEvent(QMouseEvent *event) {
     case Tool::guide: {
         qDebug() << "GUIDE: RELEASE";
         if (std ::exchange(m_guide_tool_state.guide_active, false)) {
-            m_model.guides.emplace_back(GuideObj{m_guide_tool_state.guide_line});
+            m_model.guides.emplace_back(GuideObj{random_id(), m_guide_tool_state.guide_line});
+            m_changes.added(m_model.guides.back());
             update();
         }
     }
@@ -907,15 +1215,23 @@ void CanvasWidget::mouseReleaseEvent(QMouseEvent *event) {
 }
 
 void CanvasWidget::wheelEvent(QWheelEvent *event) {
+    // High resolution wheels and touchpads send many small deltas, they are summed up and
+    // applied once per frame.
+    m_pending_input.wheel_angle_delta += event->angleDelta().y();
+    m_pending_input.wheel_position = Point{event->position().x(), event->position().y()};
+    schedule_input_processing();
+}
+
+void CanvasWidget::process_wheel(int angle_delta, Point position) {
     // Most mouse types work in increments of 15.0 degress but Qt returns eights of degree.
     // We assume that 15 degrees will correspond to 0.1 scale so minimal increment of wheel
     // results in + 0.1 or -0.1 zoom.
 
-    const auto delta_degress = event->angleDelta().y() / 8;
+    const auto delta_degress = angle_delta / 8;
     const auto delta_zoom = (delta_degress / 15.0) / 10.0; // mapped to -1/+1 for mouse mouses
 
-    const auto x = event->position().x();
-    const auto y = event->position().y();
+    const auto x = position.x;
+    const auto y = position.y;
 
     if (m_selected_tool == Tool::draw_point) {
         // ..
@@ -926,15 +1242,58 @@ void CanvasWidget::wheelEvent(QWheelEvent *event) {
             }
 
             m_scale += delta_zoom;
+            update_view_transform();
             qDebug() << "m_zoom: " << m_scale;
             update();
         }
     }
 }
 
+int CanvasWidget::frame_interval_ms() const {
+    auto *s = screen();
+    const double refresh_rate = s ? s->refreshRate() : 60.0;
+    return std::max(1, static_cast<int>(1000.0 / std::max(refresh_rate, 1.0)));
+}
+
+void CanvasWidget::schedule_input_processing() {
+    if (m_input_timer.isActive()) {
+        return;
+    }
+    // When nothing was processed during last frame, process right away so that a single event
+    // does not get extra latency. Otherwise wait until next frame boundary.
+    const int frame = frame_interval_ms();
+    const qint64 elapsed =
+        m_since_input_processed.isValid() ? m_since_input_processed.elapsed() : frame;
+    if (elapsed >= frame) {
+        process_pending_input();
+    } else {
+        m_input_timer.start(static_cast<int>(frame - elapsed));
+    }
+}
+
+void CanvasWidget::process_pending_input() {
+    // Every input handler starts here, nothing from the frame arena outlives one of them.
+    m_frame.reset();
+    m_input_timer.stop();
+    m_since_input_processed.start();
+
+    if (auto move = std::exchange(m_pending_input.mouse_move, std::nullopt)) {
+        process_mouse_move(*move);
+    }
+    if (auto delta = std::exchange(m_pending_input.wheel_angle_delta, 0)) {
+        process_wheel(delta, m_pending_input.wheel_position);
+    }
+}
+
+void CanvasWidget::resizeEvent(QResizeEvent *event) {
+    // Zoom is done around the center of the widget so matrix depends on widget size.
+    update_view_transform();
+    QWidget::resizeEvent(event);
+}
+
 void CanvasWidget::render_background(QPainter *painter, QPaintEvent *event) {
-    QBrush brush{QColor{235, 235, 235}};
-    painter->fillRect(event->rect(), brush);
+    m_grid_renderer.render_grid(*painter, event->rect(), m_scale,
+                                to_qpointf(world_to_screen(Point(0, 0))));
 }
 
 void CanvasWidget::render_handles(QPainter *painter, QPaintEvent *) {
@@ -981,16 +1340,14 @@ void CanvasWidget::render_debug_elements(QPainter *painter, QPaintEvent *) {
 }
 
 void CanvasWidget::render_rulers(QPainter *painter, QPaintEvent *) {
-    draw_colored_line(painter, Point{RULER_WIDTH_PIXELS, 0},
-                      Point{RULER_WIDTH_PIXELS, (double)height()}, QColor(100, 100, 100));
-    draw_colored_line(painter, Point{(double)width() - RULER_WIDTH_PIXELS, 0},
-                      Point{(double)width() - RULER_WIDTH_PIXELS, (double)height()},
-                      QColor(100, 100, 100));
-    draw_colored_line(painter, Point{0, RULER_WIDTH_PIXELS},
-                      Point{(double)width(), RULER_WIDTH_PIXELS}, QColor(100, 100, 100));
-    draw_colored_line(painter, Point{0, (double)height() - RULER_WIDTH_PIXELS},
-                      Point{(double)width(), (double)height() - RULER_WIDTH_PIXELS},
-                      QColor(100, 100, 100));
+    // Rulers stay attached to widget edges so they are drawn in screen space. Guide tool starts
+    // guides from any edge, so while it is active all four rulers are shown.
+    painter->save();
+    painter->resetTransform();
+    m_grid_renderer.render_rulers(*painter, size(), m_scale,
+                                  to_qpointf(world_to_screen(Point(0, 0))),
+                                  m_selected_tool == Tool::guide);
+    painter->restore();
 }
 
 void CanvasWidget::render_guides(QPainter *painter, QPaintEvent *) {
@@ -1003,6 +1360,55 @@ void CanvasWidget::render_guides(QPainter *painter, QPaintEvent *) {
         draw_dashed_line(painter, scale_line(guide.line, 1 / m_scale), Blue, thicker_line_width());
     }
 }
+void CanvasWidget::render_clashes(QPainter *painter, QPaintEvent *event) {
+    const Rect visible = visible_world_rect(event->rect());
+    const double radius = CLASH_MARKER_PIXELS / m_scale / 2;
+    QPen pen{ClashColor};
+    pen.setWidthF(thicker_line_width());
+    painter->setPen(pen);
+    painter->setBrush(Qt::NoBrush);
+    for (auto &clash : m_clashes.clashes()) {
+        const Point p = clash.location;
+        if (p.x < visible.x || p.y < visible.y || p.x > visible.x + visible.width ||
+            p.y > visible.y + visible.height) {
+            continue;
+        }
+        const QPointF c = to_qpointf(p);
+        painter->drawEllipse(c, radius, radius);
+        painter->drawLine(QPointF(c.x() - radius / 2, c.y() - radius / 2),
+                          QPointF(c.x() + radius / 2, c.y() + radius / 2));
+        painter->drawLine(QPointF(c.x() - radius / 2, c.y() + radius / 2),
+                          QPointF(c.x() + radius / 2, c.y() - radius / 2));
+    }
+}
+
+void CanvasWidget::render_snap(QPainter *painter, QPaintEvent *) {
+    if (!m_last_snap || (m_selected_tool != Tool::draw_line && m_selected_tool != Tool::duct)) {
+        return;
+    }
+    const double size = SNAP_MARKER_PIXELS / m_scale;
+    QPen pen{Pink};
+    pen.setWidthF(thin_line_width());
+    painter->setPen(pen);
+    painter->setBrush(Qt::NoBrush);
+    const QPointF c = to_qpointf(m_last_snap->point);
+    switch (m_last_snap->kind) {
+    case SnapKind::endpoint:
+        painter->drawRect(QRectF(c.x() - size / 2, c.y() - size / 2, size, size));
+        break;
+    case SnapKind::intersection:
+        painter->drawLine(QPointF(c.x() - size / 2, c.y() - size / 2),
+                          QPointF(c.x() + size / 2, c.y() + size / 2));
+        painter->drawLine(QPointF(c.x() - size / 2, c.y() + size / 2),
+                          QPointF(c.x() + size / 2, c.y() - size / 2));
+        break;
+    case SnapKind::edge:
+    case SnapKind::guide:
+        painter->drawEllipse(c, size / 2, size / 2);
+        break;
+    }
+}
+
 void CanvasWidget::render_rects(QPainter *painter, QPaintEvent *) {
     auto draw_measurements_for_rect = [painter](Rect rect) {
         v2 top_left{rect.x, rect.y};
@@ -1025,7 +1431,7 @@ void CanvasWidget::render_rects(QPainter *painter, QPaintEvent *) {
         painter->save();
         painter->setPen(QColor(100, 100, 100));
         painter->drawText(to_qrectf(width_label_frame), Qt::AlignCenter | Qt::AlignVCenter,
-                          format_distance_display_text(width_dist).c_str());
+                          format_distance_display_text(width_dist).data());
         painter->restore();
 
         // rect height label
@@ -1033,9 +1439,9 @@ void CanvasWidget::render_rects(QPainter *painter, QPaintEvent *) {
         painter->setPen(QColor(100, 100, 100));
         painter->translate(to_qpointf(height_label_frame.center()));
         painter->rotate(-90.0);
-        painter->translate(-height_label_frame.center());
+        painter->translate(-to_qpointf(height_label_frame.center()));
         painter->drawText(to_qrectf(height_label_frame), Qt::AlignCenter | Qt::AlignVCenter,
-                          format_distance_display_text(height_dist).c_str());
+                          format_distance_display_text(height_dist).data());
         painter->restore();
         // ..
     };
@@ -1071,10 +1477,31 @@ void CanvasWidget::render_rects(QPainter *painter, QPaintEvent *) {
         }
     }
 }
-void CanvasWidget::render_ducts(QPainter *painter, QPaintEvent *) {
+void CanvasWidget::render_ducts(QPainter *painter, QPaintEvent *event) {
     // Ducts
+    m_duct_bodies.sync();
+    if (m_airflow.has_pending()) {
+        solve_airflow_in_background();
+    }
+    const Rect visible = visible_world_rect(event->rect());
+    // While drawing ducts, space the router keeps free around existing ones is shown.
+    const bool show_clearance = m_selected_tool == Tool::duct;
+    const double clearance = m_router.settings().clearance;
     for (auto &duct : m_model.ducts) {
-        render_duct(painter, duct);
+        auto *body = m_duct_bodies.body(duct.id);
+        if (body && body->bbox.intersects(visible)) {
+            if (show_clearance) {
+                auto &zone = m_offsets.clearance_zone(duct, clearance);
+                draw_dashed_outline(painter, zone, LightGrey, thin_line_width(),
+                                    m_frame.resource());
+            }
+            render_duct(painter, duct, *body);
+            if (m_sizing_preview.empty()) {
+                render_duct_airflow(painter, duct, *body);
+            } else {
+                render_duct_sizing(painter, duct);
+            }
+        }
     }
 
     // Fittings
@@ -1092,7 +1519,12 @@ void CanvasWidget::render_ducts(QPainter *painter, QPaintEvent *) {
     }
 
     auto &state = m_duct_tool_state;
-    if (state.active) {
+    if (state.active && !state.route.empty()) {
+        for (size_t i = 1; i < state.route.size(); ++i) {
+            draw_colored_line(painter, Line{state.route[i - 1], state.route[i]}, Blue,
+                              thicker_line_width());
+        }
+    } else if (state.active) {
         // In move state, render hovers and suggestions.
         draw_colored_line(painter, Line(state.polyline.back(), state.next_end), Blue,
                           thicker_line_width());
@@ -1120,10 +1552,75 @@ void CanvasWidget::render_ducts(QPainter *painter, QPaintEvent *) {
     }
 }
 
-void CanvasWidget::render_duct(QPainter *painter, Duct &) {
-    // That is interesting. In current design we don't even have representation of duct.
-    // But in fact duct has its diameter.
-    // Any corner implicitly creates a fitting.
+void CanvasWidget::render_duct(QPainter *painter, const Duct &duct, const DuctBody &body) {
+    // Any corner implicitly creates a fitting. Joints are already cut in the body outline so here
+    // we only hand cached geometry over to the painter.
+    QPointF outline[4];
+    for (size_t i = 0; i < body.outline.size(); ++i) {
+        outline[i] = to_qpointf(body.outline[i]);
+    }
+
+    QPen pen{Grey};
+    pen.setWidthF(thin_line_width());
+    painter->setPen(pen);
+    painter->setBrush(DuctBodyColor);
+    painter->drawPolygon(outline, 4);
+    if (body.round_begin) {
+        painter->drawEllipse(to_qpointf(duct.begin), body.radius, body.radius);
+    }
+    if (body.round_end) {
+        painter->drawEllipse(to_qpointf(duct.end), body.radius, body.radius);
+    }
+    painter->setBrush(Qt::NoBrush);
+
+    draw_dashed_line(painter, duct.begin, duct.end, Grey, thin_line_width());
+
+    if (duct.flags & ObjFlags::duct_a_endpoint_howered) {
+        draw_colored_point(painter, duct.begin, HowerColor, 10.0 / m_scale);
+    } else if (duct.flags & ObjFlags::duct_b_endpoint_howered) {
+        draw_colored_point(painter, duct.end, HowerColor, 10.0 / m_scale);
+    }
+}
+
+void CanvasWidget::render_duct_airflow(QPainter *painter, const Duct &duct, const DuctBody &body) {
+    auto flow = m_airflow.flow(ElementRef{ElementKind::duct, duct.id});
+    const double length = math::points_distance(duct.begin, duct.end);
+    // Label needs some room along the duct, otherwise it is only noise.
+    if (!flow || length * m_scale < MIN_AIRFLOW_LABEL_LENGTH_PIXELS) {
+        return;
+    }
+
+    const QString text = QString("%1 m3/h, %2 Pa")
+                             .arg(std::fabs(flow->flow_m3s) * 3600.0, 0, 'f', 0)
+                             .arg(flow->pressure_drop_pa, 0, 'f', 1);
+    draw_duct_label(painter, duct, body.radius * 2.0, text, QColor(100, 100, 100));
+}
+
+void CanvasWidget::render_duct_sizing(QPainter *painter, const Duct &duct) {
+    auto it = m_sizing_preview.find(duct.id);
+    if (it == m_sizing_preview.end()) {
+        return;
+    }
+    const v2 axis{duct.begin, duct.end};
+    if (len2(axis) == 0.0) {
+        return;
+    }
+    // Outline of the duct with proposed size.
+    const v2 side = normalized(normal(axis)) * (it->second / 20.0);
+    const QPointF outline[4] = {to_qpointf(v2(duct.begin) + side), to_qpointf(v2(duct.end) + side),
+                                to_qpointf(v2(duct.end) - side), to_qpointf(v2(duct.begin) - side)};
+    QPen pen{Blue};
+    pen.setWidthF(thin_line_width());
+    pen.setStyle(Qt::DashLine);
+    painter->setPen(pen);
+    painter->setBrush(Qt::NoBrush);
+    painter->drawPolygon(outline, 4);
+
+    const double length = math::points_distance(duct.begin, duct.end);
+    if (length * m_scale >= MIN_AIRFLOW_LABEL_LENGTH_PIXELS) {
+        const QString text = QString("%1 -> %2 mm").arg(duct.size_mm).arg(it->second);
+        draw_duct_label(painter, duct, it->second / 10.0, text, Blue);
+    }
 }
 
 void CanvasWidget::render_fitting(QPainter *painter, Fitting &fitting) {
@@ -1166,8 +1663,16 @@ void CanvasWidget::render_fitting__split(QPainter *painter, Split3 &split) {
     // ..
 }
 
-void CanvasWidget::render_lines(QPainter *painter, QPaintEvent *) {
+void CanvasWidget::render_lines(QPainter *painter, QPaintEvent *event) {
+    const Rect visible = visible_world_rect(event->rect());
     for (auto &line_obj : m_model.lines) {
+        // Shadow of a line being moved can be anywhere so such lines are never culled.
+        const bool moving = line_obj.flags & (ObjFlags::moving | ObjFlags::a_endpoint_move |
+                                              ObjFlags::b_endpoint_move);
+        if (!moving && !line_bounds(line_obj.l).intersects(visible)) {
+            continue;
+        }
+
         auto &[a, b] = line_obj.l;
         draw_colored_line(painter, a, b, Qt::black, thin_line_width());
 
@@ -1225,7 +1730,7 @@ void CanvasWidget::render_lines(QPainter *painter, QPaintEvent *) {
             painter->rotate(-theta_degrees);
             painter->translate(-qr.center());
             painter->drawText(qr, Qt::AlignCenter | Qt::AlignVCenter,
-                              format_distance_display_text(dist).c_str());
+                              format_distance_display_text(dist).data());
             painter->restore();
         } else if (line_obj.flags & ObjFlags::howered) {
             draw_colored_line(painter, a, b, HowerColor, thicker_line_width());
@@ -1256,11 +1761,15 @@ void CanvasWidget::render_lines(QPainter *painter, QPaintEvent *) {
 }
 
 Point CanvasWidget::world_to_screen(Point p) {
-    return to_point(to_qpointf(p) * get_transformation_matrix());
+    Point r;
+    world_to_screen(&p, &r, 1);
+    return r;
 }
 
 Point CanvasWidget::screen_to_world(Point p) {
-    return to_point(to_qpointf(p) * get_transformation_matrix().inverted());
+    Point r;
+    screen_to_world(&p, &r, 1);
+    return r;
 }
 
 Line CanvasWidget::world_to_screen(Line p) {
@@ -1270,6 +1779,25 @@ Line CanvasWidget::screen_to_world(Line p) {
     return Line(screen_to_world(p.a), screen_to_world(p.b));
 }
 
+Rect CanvasWidget::visible_world_rect(const QRect &screen_rect) const {
+    Point corners[2] = {Point(screen_rect.left(), screen_rect.top()),
+                        Point(screen_rect.right() + 1, screen_rect.bottom() + 1)};
+    screen_to_world(corners, corners, 2);
+    const double margin = scaled(CULLING_MARGIN_PIXELS);
+    const double x = std::min(corners[0].x, corners[1].x) - margin;
+    const double y = std::min(corners[0].y, corners[1].y) - margin;
+    return Rect{x, y, std::fabs(corners[1].x - corners[0].x) + 2 * margin,
+                std::fabs(corners[1].y - corners[0].y) + 2 * margin};
+}
+
+void CanvasWidget::world_to_screen(const Point *in, Point *out, size_t n) const {
+    map_points(m_view_transform, in, out, n);
+}
+
+void CanvasWidget::screen_to_world(const Point *in, Point *out, size_t n) const {
+    map_points(m_view_transform_inverted, in, out, n);
+}
+
 void CanvasWidget::mark_object_selected(const PointObj &o) { select_object_by_id_impl(o.id); }
 
 void CanvasWidget::mark_object_selected(const LineObj &o) { select_object_by_id_impl(o.id); }
@@ -1297,7 +1825,7 @@ bool CanvasWidget::is_object_selected(const LineObj &o) {
            m_selected_objects.end();
 }
 
-QTransform CanvasWidget::get_transformation_matrix() const {
+void CanvasWidget::update_view_transform() {
     QTransform m;
     double cx = width() / 2;
     double cy = height() / 2;
@@ -1305,130 +1833,362 @@ QTransform CanvasWidget::get_transformation_matrix() const {
     m.scale(m_scale, m_scale);
     m.translate(-cx, -cy);
     m.translate(-m_translate_x, -m_translate_y);
-    return m;
+    m_view_transform = m;
+    m_view_transform_inverted = m.inverted();
 }
 
-bool CanvasWidget::can_be_next_point_in_duct_polyline(const std::vector<Point> &points, Point x) {
-    if (points.size() < 2) {
-        return true;
+void CanvasWidget::update_duct_route(Point mouse_world) {
+    auto &state = m_duct_tool_state;
+    if (!state.routing) {
+        // Obstacles don't change while routing, they are indexed once.
+        m_router.set_obstacles(m_model);
+        state.routing = true;
     }
 
-    // we want to check a line of points[N-2]..points[N-1] and points points[N-1]..X
-    // the angle between them cannot be arbitray. Ther are joints for: 45, 60 and 90
-    // degrees: https://vents-shop.com.ua/povitrovodi-uk/fasonni-virobi-uk
+    RouteEnd start{state.polyline.back(), std::nullopt};
+    if (state.polyline.size() >= 2) {
+        start.direction = v2{state.polyline[state.polyline.size() - 2], state.polyline.back()};
+    } else {
+        start.direction = duct_direction_at(m_endpoints, start.pos);
+    }
 
-    auto p0 = points[points.size() - 2];
-    auto p1 = points[points.size() - 1];
-    auto p2 = x;
+    // Goal snaps to an endpoint of existing duct, the route has to join it at allowed angle.
+    RouteEnd goal{mouse_world, std::nullopt};
+    if (auto end = m_endpoints.closest(mouse_world, 10.0, EndpointMask::duct)) {
+        goal = RouteEnd{end->pos, v2{end->pos, end->other}};
+    }
+
+    auto route = m_router.route(start, goal, DEFAULT_DUCT_SIZE_MM / 10.0);
+    state.route = route ? std::move(*route) : std::vector<Point>{};
+}
 
-    ::v2 u{p0, p1};
-    ::v2 v{p1, p2};
+void CanvasWidget::ensure_snap_index() {
+    if (std::exchange(m_snap_index_dirty, false)) {
+        m_snap.rebuild(m_model, m_intersections);
+    }
+}
 
-    auto theta = math::angle_between_vectors(u, v) / M_PI * 180.0;
+Point CanvasWidget::snap_cursor(Point mouse_world) {
+    ensure_snap_index();
+    m_last_snap = m_snap.snap(mouse_world, SNAP_RADIUS_PIXELS / m_scale);
+    return m_last_snap ? m_last_snap->point : mouse_world;
+}
 
-    qDebug() << "theta: " << theta;
+Point CanvasWidget::snap_cursor_along(Point origin, Point mouse_world) {
+    ensure_snap_index();
+    const double radius = SNAP_RADIUS_PIXELS / m_scale;
+    m_last_snap = m_snap.snap_along(origin, v2{origin, mouse_world}, mouse_world, radius);
+    return m_last_snap ? m_last_snap->point : mouse_world;
+}
 
-    auto near_angle = [](double x, double y) { return std::fabs(x - y) < 3.0; };
+void CanvasWidget::set_catalogue(Catalogue catalogue) {
+    qDebug() << "catalogue: parts: " << catalogue.size();
+    m_catalogue = std::move(catalogue);
+}
 
-    const std::array angles = {0., 45., 60., 90., 360. - 45., 360. - 60., 360. - 90.};
-    for (auto alpha : angles) {
-        if (near_angle(theta, alpha)) {
-            qDebug() << "fits to " << alpha;
-            return true;
-        }
+void CanvasWidget::solve_airflow_in_background() {
+    if (m_airflow_job && !m_airflow_job->done()) {
+        return;
     }
+    auto input = airflow_snapshot(m_airflow, m_model, m_network);
+    const uint64_t revision = m_ducts_revision;
+    m_airflow_job = m_jobs.run(
+        "Airflow",
+        [input](Job &) {
+            input->solver.solve(input->model, input->network);
+            return std::move(input->solver);
+        },
+        [this, revision](AirflowSolver solved) {
+            // Edited meanwhile, invalidations since the copy would be lost. Next render starts
+            // over from the current state.
+            if (m_ducts_revision == revision) {
+                m_airflow = std::move(solved);
+            }
+            update();
+        });
+}
 
-    // if (near_angle(theta, 0) || near_angle(theta, 45) || near_angle(theta, 60) ||
-    //     near_angle(theta, 90) || near_angle(theta, 360.0 - 45.0) ||
-    //     near_angle(theta, 360.0 - 60.0) || near_angle(theta, 360.0 - 90.0)) {
-    //     qDebug() << "can be next point in duct polyline because of 45,60,90 degrees
-    //     criteria"; return true;
-    // }
+JobHandle CanvasWidget::preview_duct_sizes(SizingMethod method,
+                                           std::function<void(size_t)> done) {
+    SizingSettings settings;
+    settings.method = method;
+    if (m_catalogue) {
+        if (auto sizes = duct_sizes(*m_catalogue); !sizes.empty()) {
+            settings.sizes_mm = std::move(sizes);
+        }
+    }
 
-    return false;
+    auto input = airflow_snapshot(m_airflow, m_model, m_network);
+    const uint64_t revision = m_ducts_revision;
+    return m_jobs.run(
+        "Sizing",
+        [this, input, settings](Job &job) {
+            if (input->solver.has_pending()) {
+                input->solver.solve(input->model, input->network);
+            }
+            job.set_progress(0.5);
+            job.throw_if_cancelled();
+            return propose_duct_sizes(input->model, input->network, input->solver, settings,
+                                      &m_jobs, &job);
+        },
+        [this, method, revision, done = std::move(done)](std::vector<SizedDuct> sized) {
+            if (m_ducts_revision != revision) {
+                // Ducts changed meanwhile, the proposal is for their old state.
+                preview_duct_sizes(method, done);
+                return;
+            }
+            m_sizing_preview.clear();
+            for (auto &duct : sized) {
+                if (duct.proposed_mm != duct.current_mm) {
+                    m_sizing_preview.emplace(duct.id, duct.proposed_mm);
+                }
+            }
+            qDebug() << "sizing: ducts to resize: " << m_sizing_preview.size();
+            update();
+            done(m_sizing_preview.size());
+        });
 }
 
-std::optional<Point> CanvasWidget::suggest_possible_leg_placement(Point x,
-                                                                  std::vector<Point> &points) {
-    if (points.size() < 2) {
-        return x;
+void CanvasWidget::apply_duct_sizes() {
+    // Sizes are an edit of their own, not a step of the drag, which would also take them back.
+    finish_connected_move();
+    std::vector<Duct> before;
+    std::vector<Duct> after;
+    for (auto &duct : m_model.ducts) {
+        if (auto it = m_sizing_preview.find(duct.id); it != m_sizing_preview.end()) {
+            before.push_back(duct);
+            after.push_back(duct);
+            after.back().size_mm = it->second;
+        }
+    }
+    m_sizing_preview.clear();
+    if (!after.empty()) {
+        m_undo_stack.push(EditDuctsCommand{*this, std::move(before), std::move(after), {}, {}});
     }
+    update();
+}
 
-    // we want to check a line of points[N-2]..points[N-1] and points points[N-1]..X
-    // the angle between them cannot be arbitray. Ther are joints for: 45, 60 and 90
-    // degrees: https://vents-shop.com.ua/povitrovodi-uk/fasonni-virobi-uk
+void CanvasWidget::discard_duct_sizes() {
+    m_sizing_preview.clear();
+    update();
+}
 
-    //    auto  = possible_points_for_next_duct_in_polyline(points, x);
+void CanvasWidget::undo() {
+    finish_connected_move();
+    ModelBatch batch(m_changes);
+    m_undo_stack.undo();
+}
 
-    // now I want to project x to every suggested line and see what is the closest one for
-    // me.
+void CanvasWidget::redo() {
+    finish_connected_move();
+    ModelBatch batch(m_changes);
+    m_undo_stack.redo();
+}
 
-    Point closest_proj_p;
-    double min_dist = INFINITY;
-    for (auto e : possible_points_for_next_duct_in_polyline(points, x)) {
-        Point p = math::closest_point_to_line(points.back(), e, x);
-        // p is a projection of x on line {points.back(), e}
-        auto d = len2(v2(x, p));
-        if (d < min_dist) {
-            min_dist = d;
-            closest_proj_p = p;
+void CanvasWidget::replace_elements(const std::vector<Duct> &ducts,
+                                    const std::vector<Fitting> &fittings) {
+    ModelBatch batch(m_changes);
+    std::unordered_map<std::string, size_t> duct_index;
+    for (size_t i = 0; i < ducts.size(); ++i) {
+        duct_index.emplace(ducts[i].id, i);
+    }
+    for (auto &duct : m_model.ducts) {
+        auto it = duct_index.find(duct.id);
+        if (it == duct_index.end()) {
+            continue;
         }
+        const Duct before = duct;
+        duct = ducts[it->second];
+        m_changes.modified(before, duct);
     }
 
-    //    qDebug() << "min dist: " << min_dist;
-    //    if (min_dist < 150.0) {
-    //        qDebug() << "RETURNING CLOSEST PROJECTION!";
-    return closest_proj_p;
-    //    }
-
-    //    return std::nullopt;
+    std::unordered_map<std::string, size_t> fitting_index;
+    for (size_t i = 0; i < fittings.size(); ++i) {
+        fitting_index.emplace(fittings[i].id, i);
+    }
+    for (auto &fitting : m_model.fittings) {
+        auto it = fitting_index.find(fitting.id);
+        if (it == fitting_index.end()) {
+            continue;
+        }
+        const Fitting before = fitting;
+        fitting = fittings[it->second];
+        m_changes.modified(before, fitting);
+    }
 }
 
-class TestClass {
-  public:
-    TestClass() = default;
+void CanvasWidget::put_connected_move(const std::vector<std::pair<size_t, Duct>> &ducts,
+                                      const std::vector<std::pair<size_t, Fitting>> &fittings) {
+    for (auto &[i, duct] : ducts) {
+        const Duct before = m_model.ducts[i];
+        m_model.ducts[i] = duct;
+        m_changes.modified(before, m_model.ducts[i]);
+        // Bodies are drawn in the middle of the batch, they cannot wait for it to end.
+        m_duct_bodies.set_duct(duct);
+    }
+    for (auto &[i, fitting] : fittings) {
+        const Fitting before = m_model.fittings[i];
+        m_model.fittings[i] = fitting;
+        m_changes.modified(before, m_model.fittings[i]);
+    }
+}
 
-    ~TestClass() = default;
+void CanvasWidget::replace_line(const std::string &id, Line l) {
+    auto line = std::find_if(m_model.lines.begin(), m_model.lines.end(),
+                             [&id](const LineObj &o) { return o.id == id; });
+    if (line == m_model.lines.end()) {
+        return;
+    }
+    ModelBatch batch(m_changes);
+    const size_t i = std::distance(m_model.lines.begin(), line);
+    const LineObj before = *line;
+    line->l = l;
+    line->shadow_l = l;
+    connect_line_endpoints(m_model, i, m_endpoints, LINE_ENDPOINT_TOLERANCE, &m_changes);
+    m_changes.modified(before, m_model.lines[i]);
+}
 
-    int take_sample() { return 10; }
+void CanvasWidget::model_changed(const ModelChanges &changes) {
+    const unsigned flow_fields = ChangedField::geometry | ChangedField::size;
+    auto invalidate_airflow = [&](auto &list, ElementKind kind) {
+        for (auto &c : list) {
+            const ElementRef ref{kind, c.id()};
+            if (c.kind == ChangeKind::removed) {
+                // Components the element joined are solved again, see AirflowSolver::invalidate.
+                for (auto &n : m_network.neighbours(ref)) {
+                    m_airflow.invalidate(n);
+                }
+            }
+            if (c.touches(flow_fields)) {
+                m_airflow.invalidate(ref);
+            }
+        }
+    };
+    invalidate_airflow(changes.ducts, ElementKind::duct);
+    invalidate_airflow(changes.fittings, ElementKind::fitting);
+    if (!changes.ducts.empty() || !changes.fittings.empty()) {
+        ++m_ducts_revision;
+    }
+    for (auto &c : changes.ducts) {
+        if (c.kind == ChangeKind::removed) {
+            m_offsets.remove(c.id());
+        }
+    }
+    m_snap_index_dirty = true;
+    update();
+}
 
-    TestClass &operator=(const TestClass &rhs) { return *this; }
-};
+void CanvasWidget::cancel_connected_move() {
+    if (!m_connected_move_state.move) {
+        return;
+    }
+    auto &move = *m_connected_move_state.move;
+    auto ducts = move.ducts();
+    for (size_t k = 0; k < ducts.size(); ++k) {
+        ducts[k].second = move.original_ducts()[k];
+    }
+    auto fittings = move.fittings();
+    for (size_t k = 0; k < fittings.size(); ++k) {
+        fittings[k].second = move.original_fittings()[k];
+    }
+    put_connected_move(ducts, fittings);
+    m_changes.end();
+    m_connected_move_state.move.reset();
+}
 
-std::vector<Point>
-CanvasWidget::possible_points_for_next_duct_in_polyline(const std::vector<Point> &points, Point x) {
-    if (points.size() < 2) {
-        return {};
+void CanvasWidget::finish_connected_move() {
+    if (!m_connected_move_state.move) {
+        return;
+    }
+    // The model already is in the final state, executing the command only confirms it.
+    auto &move = *m_connected_move_state.move;
+    std::vector<Duct> ducts_after;
+    for (auto &[i, duct] : move.ducts()) {
+        ducts_after.push_back(duct);
+    }
+    std::vector<Fitting> fittings_after;
+    for (auto &[i, fitting] : move.fittings()) {
+        fittings_after.push_back(fitting);
+    }
+    if (!ducts_after.empty() || !fittings_after.empty()) {
+        m_undo_stack.push(EditDuctsCommand{*this, move.original_ducts(), std::move(ducts_after),
+                                           move.original_fittings(),
+                                           std::move(fittings_after)});
     }
+    m_changes.end();
+    m_connected_move_state.move.reset();
+}
 
-    const auto p0 = points[points.size() - 2];
-    const auto p1 = points[points.size() - 1];
+void EditDuctsCommand::execute() { m_canvas->replace_elements(m_ducts_after, m_fittings_after); }
 
-    ::v2 u{p0, p1};
+void EditDuctsCommand::undo() { m_canvas->replace_elements(m_ducts_before, m_fittings_before); }
 
-    // We are going to generate directional lines which show where we can put nexte leg of
-    // polyline:
-    //                |  /
-    //                | /
-    //  -p0-----------p1-----------
-    //                | \
-    //                |  \
+void MoveLineCommand::execute() { m_canvas->replace_line(m_id, m_after); }
 
-    // First, lets generate perpendicular lines.
-    const double DIR_LINE_LENGTH = 2000.0 / m_scale;
-    ::v2 perp1 = normalized(normal(u));
-    ::v2 perp2 = perp1 * -1.0;
+void MoveLineCommand::undo() { m_canvas->replace_line(m_id, m_before); }
 
-    Point normal1_p = p1 + perp1 * DIR_LINE_LENGTH;
-    Point normal2_p = p1 + perp2 * DIR_LINE_LENGTH;
-    Point forward_p = p1 + normalized(u) * DIR_LINE_LENGTH;
+bool MoveLineCommand::merge(const MoveLineCommand &next) {
+    if (next.m_canvas != m_canvas || next.m_id != m_id) {
+        return false;
+    }
+    m_after = next.m_after;
+    return true;
+}
 
-    auto rad = [](double d) { return d * M_PI / 180.0; };
+void CanvasWidget::place_adapter(Point mouse_world, bool larger) {
+    if (!m_catalogue) {
+        qDebug() << "adapter: no catalogue loaded";
+        return;
+    }
 
-    Point _45 = p1 + rotate_vector(normalized(u) * DIR_LINE_LENGTH, rad(45));
-    Point _m45 = p1 + rotate_vector(normalized(u) * DIR_LINE_LENGTH, rad(-45));
-    Point _60 = p1 + rotate_vector(normalized(u) * DIR_LINE_LENGTH, rad(60));
-    Point _m60 = p1 + rotate_vector(normalized(u) * DIR_LINE_LENGTH, rad(-60));
+    const auto hit = m_endpoints.closest(mouse_world, 10.0, EndpointMask::duct);
+    if (!hit) {
+        return;
+    }
+    auto duct = std::find_if(m_model.ducts.begin(), m_model.ducts.end(),
+                             [&hit](const Duct &d) { return d.id == hit->id; });
+    if (duct == m_model.ducts.end()) {
+        return;
+    }
+    const Point end = hit->pos;
+    const v2 out{hit->other, hit->pos};
+
+    // Closest size in requested direction among parts which fit the duct.
+    const CatalogueRecord *part = nullptr;
+    unsigned other_size = 0;
+    for (auto *r : m_catalogue->compatible(PartType::adapter, duct->size_mm)) {
+        const unsigned size = r->d1_mm == duct->size_mm ? r->d2_mm : r->d1_mm;
+        const bool wanted = larger ? size > duct->size_mm : size < duct->size_mm;
+        const bool closer = !part || (larger ? size < other_size : size > other_size);
+        if (wanted && closer) {
+            part = r;
+            other_size = size;
+        }
+    }
+    if (!part) {
+        qDebug() << "adapter: no part in catalogue for duct of size " << duct->size_mm;
+        return;
+    }
 
-    return {normal1_p, normal2_p, forward_p, _45, _m45, _60, _m60};
+    const unsigned length_mm = part->length_mm > 0 ? part->length_mm : DEFAULT_ADAPTER_LENGTH_MM;
+    Fitting f{};
+    f.id = random_id();
+    f.center = end;
+    f.fitting_variant = Adapter{Point(0, 0), normalized(out) * (length_mm / 10.0),
+                                duct->size_mm / 10.0, other_size / 10.0};
+    m_model.fittings.push_back(f);
+    m_changes.added(f);
+    qDebug() << "adapter: placed " << std::string(m_catalogue->sku(*part)).c_str();
+    update();
 }
+
+class TestClass {
+  public:
+    TestClass() = default;
+
+    ~TestClass() = default;
+
+    int take_sample() { return 10; }
+
+    TestClass &operator=(const TestClass &rhs) { return *this; }
+};
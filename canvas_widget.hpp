@@ -1,70 +1,64 @@
 #pragma once
 
 #include "MoveTool.hpp"
+#include "airflow_solver.hpp"
+#include "bill_of_materials.hpp"
+#include "catalogue.hpp"
+#include "clash_detector.hpp"
+#include "command.hpp"
+#include "connected_move.hpp"
+#include "duct_body.hpp"
+#include "duct_network.hpp"
+#include "duct_router.hpp"
+#include "duct_sizing.hpp"
+#include "endpoint_index.hpp"
+#include "frame_arena.hpp"
+#include "grid_renderer.hpp"
+#include "intersection_index.hpp"
+#include "job_system.hpp"
+#include "model_changes.hpp"
+#include "polygon_offset.hpp"
+#include "snap_engine.hpp"
 #include "types.hpp"
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QTransform>
 #include <QWidget>
+#include <functional>
 #include <memory>
 #include <optional>
+#include <unordered_map>
 
 enum class CanvasState { idle, drawing };
 
 enum class HandToolState { idle, pressed, zooming };
 enum class DrawLineState { waiting_point_a, point_a_placed };
 
-// How we are supposed to implement a function of group select and move:
-//  suppose we selected two lines and three points, and now we want to support some group operation.
-// Say, we want to group it.
-
-// Represents an editor editor. Whenver we need to change the model, we do it through a command.
-struct Command {
-  public:
-    struct Base {
-        virtual ~Base() = default;
-        virtual std::unique_ptr<Base> clone() = 0;
-        virtual void execute() = 0;
-        virtual void undo() = 0;
-    };
-    template <class T> struct Derived : public Base {
-        Derived(T o) : m_o(std::move(o)) {}
-        virtual std::unique_ptr<Base> clone() override { return std::make_unique<Derived<T>>(m_o); }
-        virtual void execute() { m_o.execute(); }
-        virtual void undo() { m_o.undo(); }
-        T m_o;
-    };
-
-  public:
-    template <class T> Command(T t) : m_impl(std::make_unique<Derived<T>>(std::move(t))) {}
-    Command(const Command &) : m_impl(m_impl->clone()) {}
-    void execute() { return m_impl->execute(); }
-    void undo() { return m_impl->undo(); }
-
-  private:
-    std::unique_ptr<Base> m_impl;
-};
-
-class MoveLineCommand {
-  public:
-    void execute() {}
-    void undo() {}
-};
-
-inline void test() {
-
-    MoveLineCommand move_cmd;
-
-    std::vector<Command> cmds;
-    cmds.push_back(std::move(move_cmd));
-}
-
-class CanvasWidget : public QWidget, public IToolHost {
+class CanvasWidget : public QWidget, public IToolHost, public IModelObserver {
     Q_OBJECT
 
   public:
     CanvasWidget(QWidget *parent = nullptr);
     ~CanvasWidget();
 
+    const Model &model() const { return m_model; }
+    const BillOfMaterials &bill_of_materials() const { return m_bom; }
+    void set_catalogue(Catalogue catalogue);
+
+    // Long operations started by the canvas or on its model, completions run on the GUI thread.
+    JobSystem &jobs() { return m_jobs; }
+
+    // Sizes are proposed in background, `done` gets number of ducts which would change once they
+    // are. Proposed sizes are only shown until applied or discarded.
+    JobHandle preview_duct_sizes(SizingMethod method, std::function<void(size_t)> done);
+    // All proposed sizes become one undoable change.
+    void apply_duct_sizes();
+    void discard_duct_sizes();
+
   public slots:
     void select_tool(Tool tool);
+    void undo();
+    void redo();
 
   protected:
     void paintEvent(QPaintEvent *event) override;
@@ -72,6 +66,7 @@ class CanvasWidget : public QWidget, public IToolHost {
     void mousePressEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
     void wheelEvent(QWheelEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
 
     //    bool eventFilter(QObject* object, QEvent *event) override;
 
@@ -81,7 +76,25 @@ class CanvasWidget : public QWidget, public IToolHost {
     virtual void ToolHost__update() override { update(); }
     virtual void ToolHost__enable_mouse_tracking(bool v) override { setMouseTracking(v); }
 
+  public: // IModelObserver
+    // Airflow and render caches, the indices observe the model themselves.
+    void model_changed(const ModelChanges &changes) override;
+
   private:
+    // Pointer and wheel events are only recorded by event handlers, tools see them from here at
+    // most once per display frame.
+    void schedule_input_processing();
+    void process_pending_input();
+    void process_mouse_move(Point mouse_screen);
+    void process_wheel(int angle_delta, Point position);
+    int frame_interval_ms() const;
+
+    // Renders everything within event rect, painter clipping is set up by the caller.
+    void render_scene(QPainter *painter, QPaintEvent *);
+
+    // Pans already rendered frame by given amount of pixels.
+    void scroll_canvas(int dx, int dy);
+
     void render_background(QPainter *painter, QPaintEvent *);
     void render_handles(QPainter *painter, QPaintEvent *);
     void render_lines(QPainter *painter, QPaintEvent *);
@@ -90,7 +103,11 @@ class CanvasWidget : public QWidget, public IToolHost {
     void render_guides(QPainter *painter, QPaintEvent *);
     void render_rects(QPainter *painter, QPaintEvent *);
     void render_ducts(QPainter *painter, QPaintEvent *);
-    void render_duct(QPainter *painter, Duct &);
+    void render_clashes(QPainter *painter, QPaintEvent *);
+    void render_snap(QPainter *painter, QPaintEvent *);
+    void render_duct(QPainter *painter, const Duct &, const DuctBody &);
+    void render_duct_airflow(QPainter *painter, const Duct &, const DuctBody &);
+    void render_duct_sizing(QPainter *painter, const Duct &);
     void render_fitting(QPainter *painter, Fitting &);
     void render_fitting__adapter(QPainter *painter, Adapter &);
     void render_fitting__split(QPainter *painter, Split3 &);
@@ -104,6 +121,13 @@ class CanvasWidget : public QWidget, public IToolHost {
     Line world_to_screen(Line p);
     Line screen_to_world(Line p);
 
+    // Batch variants, map n points from `in` into `out` with the cached matrix.
+    void world_to_screen(const Point *in, Point *out, size_t n) const;
+    void screen_to_world(const Point *in, Point *out, size_t n) const;
+
+    // Part of the world covered by given screen rect, used for culling.
+    Rect visible_world_rect(const QRect &screen_rect) const;
+
     void mark_object_selected(const PointObj &o);
     void mark_object_selected(const LineObj &o);
     void unmark_object_selected(const PointObj &o);
@@ -114,30 +138,60 @@ class CanvasWidget : public QWidget, public IToolHost {
     bool is_object_selected(const PointObj &o);
     bool is_object_selected(const LineObj &o);
 
-    QTransform get_transformation_matrix() const;
+    const QTransform &get_transformation_matrix() const { return m_view_transform; }
+
+    // Must be called whenever pan, zoom or widget size changes.
+    void update_view_transform();
 
     double width_f() const { return static_cast<double>(width()); }
     double height_f() const { return static_cast<double>(height()); }
 
     // TODO: move this to separate unit and have some good unit tests for this module.
-    bool can_be_next_point_in_duct_polyline(const std::vector<Point> &points, Point x);
-    std::optional<Point> suggest_possible_leg_placement(Point x, std::vector<Point> &points);
-
-    // Based on current cursor position and existing polyline, suggest some points that where
-    // polyline can be continued.
-    std::vector<Point> possible_points_for_next_duct_in_polyline(const std::vector<Point> &points,
-                                                                 Point x);
+    void update_duct_route(Point mouse_world);
+    void place_adapter(Point mouse_world, bool larger);
+    // Elements are matched by id, the model gets given state of each.
+    void replace_elements(const std::vector<Duct> &ducts, const std::vector<Fitting> &fittings);
+    void replace_line(const std::string &id, Line l);
+    // Writes results of connected move to the model at their indices, within the open batch.
+    void put_connected_move(const std::vector<std::pair<size_t, Duct>> &ducts,
+                            const std::vector<std::pair<size_t, Fitting>> &fittings);
+    // Puts elements moved by unfinished connected move back.
+    void cancel_connected_move();
+    // Leaves elements moved by unfinished connected move where they are, as one undo step.
+    void finish_connected_move();
+    // Solves invalidated airflow on a copy of the network, unless a solve is already running.
+    void solve_airflow_in_background();
+    void ensure_snap_index();
+    Point snap_cursor(Point mouse_world);
+    Point snap_cursor_along(Point origin, Point mouse_world);
 
   private:
+    friend class EditDuctsCommand;
+    friend class MoveLineCommand;
+
     CanvasState m_state = CanvasState::idle;
     Tool m_selected_tool = Tool::hand;
 
-    int m_translate_x = 0;
-    int m_translate_y = 0;
+    double m_translate_x = 0.0;
+    double m_translate_y = 0.0;
     double m_scale = 1.0;
 
+    QTransform m_view_transform;
+    QTransform m_view_transform_inverted;
+
     std::optional<Point> m_zoom_center_opt;
 
+    struct {
+        std::optional<Point> mouse_move; // latest cursor position not yet seen by tools
+        int wheel_angle_delta = 0;       // accumulated since last processing
+        Point wheel_position;
+    } m_pending_input;
+    QTimer m_input_timer;
+    QElapsedTimer m_since_input_processed;
+
+    // Temporaries of one paint or input handler, reset when the next one starts.
+    FrameArena m_frame;
+
     HandToolState m_hand_tool_state = HandToolState::idle;
     int m_prev_x = 0;
     int m_prev_y = 0;
@@ -145,14 +199,62 @@ class CanvasWidget : public QWidget, public IToolHost {
     DrawLineState m_draw_line_state;
     Point m_line_point_a{0, 0};
     Point m_line_point_b{0, 0};
+    // Kept between frames, cleared and refilled per click without giving its capacity back.
     std::vector<Point> m_projection_points;
 
     std::vector<std::string> m_selected_objects;
     std::string m_hitting_line_id;
 
     Model m_model;
+    // Every edit of the model goes through it, observers below follow the changed elements.
+    ModelNotifier m_changes;
+    // Counts batches which changed ducts or fittings, background results of older ones are stale.
+    uint64_t m_ducts_revision = 0;
     MoveTool m_move_tool;
 
+    GridRenderer m_grid_renderer;
+
+    // Tessellated duct bodies, follow changed ducts and rebuild on next render.
+    DuctBodyCache m_duct_bodies;
+
+    // Connectivity between ducts and fittings, kept in sync with every duct/fitting edit.
+    DuctNetwork m_network;
+
+    // Airflow through the network, components touched by edits are solved in background after
+    // next render.
+    AirflowSolver m_airflow;
+    JobHandle m_airflow_job;
+
+    DuctRouter m_router;
+
+    // Material totals, updated with every duct/fitting edit.
+    BillOfMaterials m_bom;
+
+    // Ducts and fittings cutting walls or each other, rechecked per edited element.
+    ClashDetector m_clashes;
+
+    // Crossings of walls, guides and duct centrelines, kept up to date the same way.
+    IntersectionIndex m_intersections;
+
+    // Ends of points, lines, ducts and fittings, for hovering and for connecting what is drawn.
+    EndpointIndex m_endpoints;
+
+    // Duct clearance zones, rebuilt for the ducts which changed when drawn.
+    OffsetCache m_offsets;
+
+    // Proposed size by duct id, only ducts which would change.
+    std::unordered_map<std::string, unsigned> m_sizing_preview;
+
+    UndoStack m_undo_stack;
+
+    // Parts available for fittings and sizing, nothing can be placed from it until loaded.
+    std::optional<Catalogue> m_catalogue;
+
+    // Geometry to snap to, rebuilt lazily after presses and releases which may edit the model.
+    SnapEngine m_snap;
+    bool m_snap_index_dirty = true;
+    std::optional<SnapResult> m_last_snap;
+
     struct {
         bool guide_active = false; // whether guide is current being displayed
         Line anchor_line;          // the line from which a guide originated
@@ -173,10 +275,63 @@ class CanvasWidget : public QWidget, public IToolHost {
         Point next_end;
 
         std::vector<Line> directional_lines;
+
+        // Auto-routed continuation of the polyline to the cursor, previewed while Shift is held.
+        std::vector<Point> route;
+        bool routing = false;
     } m_duct_tool_state;
 
     struct {
         Adapter shadow_adapter;
         Point center;
     } m_fitting_tool_state;
+
+    // Duct picked by move tool, connected elements follow it until next click.
+    struct {
+        std::optional<ConnectedMove> move;
+        Point origin;
+    } m_connected_move_state;
+
+    // Last, so that workers are stopped before anything their jobs could refer to goes away.
+    JobSystem m_jobs;
+};
+
+// Changes any number of ducts and fittings at once, e.g. whole network after sizing or everything
+// following a connected move.
+class EditDuctsCommand {
+  public:
+    EditDuctsCommand(CanvasWidget &canvas, std::vector<Duct> ducts_before,
+                     std::vector<Duct> ducts_after, std::vector<Fitting> fittings_before,
+                     std::vector<Fitting> fittings_after)
+        : m_canvas(&canvas), m_ducts_before(std::move(ducts_before)),
+          m_ducts_after(std::move(ducts_after)), m_fittings_before(std::move(fittings_before)),
+          m_fittings_after(std::move(fittings_after)) {}
+
+    void execute();
+    void undo();
+
+  private:
+    CanvasWidget *m_canvas;
+    std::vector<Duct> m_ducts_before;
+    std::vector<Duct> m_ducts_after;
+    std::vector<Fitting> m_fittings_before;
+    std::vector<Fitting> m_fittings_after;
+};
+
+// Moves a wall line or one of its ends.
+class MoveLineCommand {
+  public:
+    MoveLineCommand(CanvasWidget &canvas, std::string id, Line before, Line after)
+        : m_canvas(&canvas), m_id(std::move(id)), m_before(before), m_after(after) {}
+
+    void execute();
+    void undo();
+    // Successive moves of the same line within one transaction become one.
+    bool merge(const MoveLineCommand &next);
+
+  private:
+    CanvasWidget *m_canvas;
+    std::string m_id;
+    Line m_before;
+    Line m_after;
 };
@@ -0,0 +1,224 @@
+#include "catalogue.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <tuple>
+#include <unordered_map>
+
+namespace {
+const char MAGIC[4] = {'P', 'C', 'A', 'T'};
+const uint32_t VERSION = 1;
+
+using Key = std::tuple<unsigned, unsigned, unsigned, unsigned>;
+
+Key primary_key(const CatalogueRecord &r) {
+    return Key{static_cast<unsigned>(r.type), r.d1_mm, r.d2_mm, r.angle_deg};
+}
+
+Key secondary_key(const CatalogueRecord &r) {
+    return Key{static_cast<unsigned>(r.type), r.d2_mm, r.d1_mm, r.angle_deg};
+}
+
+Key primary_key(const CataloguePart &p) {
+    return Key{static_cast<unsigned>(p.type), p.d1_mm, p.d2_mm, p.angle_deg};
+}
+
+unsigned type_key(PartType t) { return static_cast<unsigned>(t); }
+
+template <typename T> void write_pod(std::ostream &os, const T &v) {
+    os.write(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+} // namespace
+
+bool write_catalogue(std::ostream &os, std::vector<CataloguePart> parts) {
+    const unsigned max_u16 = std::numeric_limits<uint16_t>::max();
+    for (auto &p : parts) {
+        if (p.d2_mm == 0) {
+            p.d2_mm = p.d1_mm;
+        }
+        if (p.d1_mm > p.d2_mm) {
+            std::swap(p.d1_mm, p.d2_mm);
+        }
+        if (p.d2_mm > max_u16 || p.angle_deg > max_u16) {
+            return false;
+        }
+    }
+    std::sort(parts.begin(), parts.end(), [](const CataloguePart &a, const CataloguePart &b) {
+        return primary_key(a) < primary_key(b);
+    });
+
+    // Manufacturer names repeat a lot, every distinct string is stored once.
+    std::string strings;
+    std::unordered_map<std::string, uint32_t> string_offsets;
+    auto intern = [&](const std::string &s) {
+        auto [it, inserted] = string_offsets.emplace(s, static_cast<uint32_t>(strings.size()));
+        if (inserted) {
+            strings.append(s);
+            strings.push_back('\0');
+        }
+        return it->second;
+    };
+
+    std::vector<CatalogueRecord> records;
+    records.reserve(parts.size());
+    for (auto &p : parts) {
+        CatalogueRecord r{};
+        r.type = p.type;
+        r.angle_deg = static_cast<uint16_t>(p.angle_deg);
+        r.d1_mm = static_cast<uint16_t>(p.d1_mm);
+        r.d2_mm = static_cast<uint16_t>(p.d2_mm);
+        r.length_mm = p.length_mm;
+        r.price_cents = p.price_cents;
+        r.sku_offset = intern(p.sku);
+        r.manufacturer_offset = intern(p.manufacturer);
+        records.push_back(r);
+    }
+    if (strings.empty()) {
+        strings.push_back('\0');
+    }
+
+    std::vector<uint32_t> by_d2(records.size());
+    std::iota(by_d2.begin(), by_d2.end(), 0);
+    std::stable_sort(by_d2.begin(), by_d2.end(), [&records](uint32_t a, uint32_t b) {
+        return secondary_key(records[a]) < secondary_key(records[b]);
+    });
+
+    CatalogueHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.record_count = static_cast<uint32_t>(records.size());
+    header.strings_size = static_cast<uint32_t>(strings.size());
+
+    write_pod(os, header);
+    os.write(reinterpret_cast<const char *>(records.data()),
+             static_cast<std::streamsize>(records.size() * sizeof(CatalogueRecord)));
+    os.write(reinterpret_cast<const char *>(by_d2.data()),
+             static_cast<std::streamsize>(by_d2.size() * sizeof(uint32_t)));
+    os.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+    return static_cast<bool>(os);
+}
+
+std::optional<Catalogue> Catalogue::from_memory(std::shared_ptr<const uint8_t> owner,
+                                                size_t size) {
+    if (!owner || size < sizeof(CatalogueHeader)) {
+        return std::nullopt;
+    }
+    auto header = reinterpret_cast<const CatalogueHeader *>(owner.get());
+    if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION) {
+        return std::nullopt;
+    }
+    const size_t n = header->record_count;
+    const size_t expected_size = sizeof(CatalogueHeader) + n * sizeof(CatalogueRecord) +
+                                 n * sizeof(uint32_t) + header->strings_size;
+    if (size != expected_size || header->strings_size == 0) {
+        return std::nullopt;
+    }
+
+    Catalogue c;
+    c.m_header = header;
+    c.m_records = reinterpret_cast<const CatalogueRecord *>(owner.get() + sizeof(CatalogueHeader));
+    c.m_by_d2 = reinterpret_cast<const uint32_t *>(c.m_records + n);
+    c.m_strings = reinterpret_cast<const char *>(c.m_by_d2 + n);
+    if (c.m_strings[header->strings_size - 1] != '\0') {
+        return std::nullopt;
+    }
+
+    // Lookups rely on the order, so it is checked once instead of trusting the file.
+    for (size_t i = 0; i < n; ++i) {
+        auto &r = c.m_records[i];
+        if (r.type > PartType::elbow || r.sku_offset >= header->strings_size ||
+            r.manufacturer_offset >= header->strings_size || c.m_by_d2[i] >= n) {
+            return std::nullopt;
+        }
+        if (i > 0 && primary_key(r) < primary_key(c.m_records[i - 1])) {
+            return std::nullopt;
+        }
+        if (i > 0 && secondary_key(c.m_records[c.m_by_d2[i]]) <
+                         secondary_key(c.m_records[c.m_by_d2[i - 1]])) {
+            return std::nullopt;
+        }
+    }
+
+    c.m_owner = std::move(owner);
+    return c;
+}
+
+namespace {
+const CatalogueRecord *lower(const CatalogueRecord *first, const CatalogueRecord *last, Key key) {
+    return std::partition_point(
+        first, last, [&key](const CatalogueRecord &r) { return primary_key(r) < key; });
+}
+} // namespace
+
+Catalogue::Range Catalogue::parts(PartType type) const {
+    const auto t = type_key(type);
+    auto first = lower(m_records, m_records + size(), Key{t, 0, 0, 0});
+    auto last = lower(first, m_records + size(), Key{t + 1, 0, 0, 0});
+    return Range{first, last};
+}
+
+Catalogue::Range Catalogue::parts(PartType type, unsigned d1_mm, unsigned d2_mm) const {
+    if (d1_mm > d2_mm) {
+        std::swap(d1_mm, d2_mm);
+    }
+    const auto t = type_key(type);
+    auto first = lower(m_records, m_records + size(), Key{t, d1_mm, d2_mm, 0});
+    auto last = lower(first, m_records + size(), Key{t, d1_mm, d2_mm + 1, 0});
+    return Range{first, last};
+}
+
+Catalogue::Range Catalogue::parts(PartType type, unsigned d1_mm, unsigned d2_mm,
+                                  unsigned angle_deg) const {
+    if (d1_mm > d2_mm) {
+        std::swap(d1_mm, d2_mm);
+    }
+    const auto t = type_key(type);
+    auto first = lower(m_records, m_records + size(), Key{t, d1_mm, d2_mm, angle_deg});
+    auto last = lower(first, m_records + size(), Key{t, d1_mm, d2_mm, angle_deg + 1});
+    return Range{first, last};
+}
+
+std::vector<const CatalogueRecord *> Catalogue::compatible(PartType type, unsigned d_mm) const {
+    std::vector<const CatalogueRecord *> result;
+    const auto t = type_key(type);
+
+    // Parts having `d_mm` as smaller size come from the main order...
+    auto first = lower(m_records, m_records + size(), Key{t, d_mm, 0, 0});
+    auto last = lower(first, m_records + size(), Key{t, d_mm + 1, 0, 0});
+    for (auto it = first; it != last; ++it) {
+        result.push_back(it);
+    }
+
+    // ...and those having it as the larger one from the secondary index.
+    auto by_key = [this](uint32_t idx, const Key &key) {
+        return secondary_key(m_records[idx]) < key;
+    };
+    auto index_first = std::lower_bound(m_by_d2, m_by_d2 + size(), Key{t, d_mm, 0, 0}, by_key);
+    auto index_last = std::lower_bound(index_first, m_by_d2 + size(), Key{t, d_mm + 1, 0, 0},
+                                       by_key);
+    for (auto it = index_first; it != index_last; ++it) {
+        if (m_records[*it].d1_mm != d_mm) {
+            result.push_back(&m_records[*it]);
+        }
+    }
+    return result;
+}
+
+std::optional<unsigned> Catalogue::duct_size_at_least(unsigned d_mm) const {
+    const auto t = type_key(PartType::duct);
+    auto it = lower(m_records, m_records + size(), Key{t, d_mm, 0, 0});
+    if (it == m_records + size() || it->type != PartType::duct) {
+        return std::nullopt;
+    }
+    return it->d1_mm;
+}
+
+std::string_view Catalogue::sku(const CatalogueRecord &r) const {
+    return std::string_view(m_strings + r.sku_offset);
+}
+
+std::string_view Catalogue::manufacturer(const CatalogueRecord &r) const {
+    return std::string_view(m_strings + r.manufacturer_offset);
+}
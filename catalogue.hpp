@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class PartType : uint16_t { duct, adapter, split3, elbow };
+
+// Catalogue file layout, all integers little-endian:
+//
+//   CatalogueHeader
+//   CatalogueRecord[record_count]   sorted by (type, d1_mm, d2_mm, angle_deg)
+//   uint32_t[record_count]          record indices sorted by (type, d2_mm, d1_mm, angle_deg)
+//   char[strings_size]              zero terminated strings referenced by records
+//
+// Records are read in place from the mapped file, lookups are binary searches over them.
+struct CatalogueHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t record_count;
+    uint32_t strings_size;
+};
+
+struct CatalogueRecord {
+    PartType type;
+    uint16_t angle_deg; // elbows and branches, zero otherwise
+    uint16_t d1_mm;     // for parts joining two sizes the smaller one
+    uint16_t d2_mm;
+    uint32_t length_mm;
+    uint32_t price_cents;
+    uint32_t sku_offset;
+    uint32_t manufacturer_offset;
+};
+
+static_assert(sizeof(CatalogueHeader) == 16);
+static_assert(sizeof(CatalogueRecord) == 24);
+
+// Part description used to write catalogues.
+struct CataloguePart {
+    PartType type = PartType::duct;
+    unsigned d1_mm = 0;
+    unsigned d2_mm = 0;
+    unsigned angle_deg = 0;
+    unsigned length_mm = 0;
+    unsigned price_cents = 0;
+    std::string sku;
+    std::string manufacturer;
+};
+
+// Parts of several manufacturers are merged into one file.
+bool write_catalogue(std::ostream &os, std::vector<CataloguePart> parts);
+
+// Read-only view of a catalogue file kept in memory by `owner`, normally a mapping of the file.
+// Nothing is copied or allocated per part.
+class Catalogue {
+  public:
+    struct Range {
+        const CatalogueRecord *first = nullptr;
+        const CatalogueRecord *last = nullptr;
+
+        const CatalogueRecord *begin() const { return first; }
+        const CatalogueRecord *end() const { return last; }
+        size_t size() const { return static_cast<size_t>(last - first); }
+        bool empty() const { return first == last; }
+    };
+
+    // Validates the data, nullopt if it is not a catalogue or is damaged.
+    static std::optional<Catalogue> from_memory(std::shared_ptr<const uint8_t> owner,
+                                                size_t size);
+
+    size_t size() const { return m_header->record_count; }
+    Range parts() const { return Range{m_records, m_records + size()}; }
+
+    Range parts(PartType type) const;
+    // Order of diameters does not matter.
+    Range parts(PartType type, unsigned d1_mm, unsigned d2_mm) const;
+    Range parts(PartType type, unsigned d1_mm, unsigned d2_mm, unsigned angle_deg) const;
+
+    // Parts of the type which connect to `d_mm` at any of their ends.
+    std::vector<const CatalogueRecord *> compatible(PartType type, unsigned d_mm) const;
+
+    // Smallest duct size available which is not less than `d_mm`.
+    std::optional<unsigned> duct_size_at_least(unsigned d_mm) const;
+
+    std::string_view sku(const CatalogueRecord &r) const;
+    std::string_view manufacturer(const CatalogueRecord &r) const;
+
+  private:
+    Catalogue() = default;
+
+    std::shared_ptr<const uint8_t> m_owner;
+    const CatalogueHeader *m_header = nullptr;
+    const CatalogueRecord *m_records = nullptr;
+    const uint32_t *m_by_d2 = nullptr;
+    const char *m_strings = nullptr;
+};
@@ -0,0 +1,27 @@
+#include "catalogue_file.hpp"
+
+#include <QDebug>
+#include <QFile>
+
+std::optional<Catalogue> load_catalogue(const QString &path) {
+    auto file = std::make_shared<QFile>(path);
+    if (!file->open(QFile::ReadOnly)) {
+        qDebug() << "catalogue: failed to open " << path;
+        return std::nullopt;
+    }
+    const auto size = file->size();
+    uchar *data = size > 0 ? file->map(0, size) : nullptr;
+    if (!data) {
+        qDebug() << "catalogue: failed to map " << path;
+        return std::nullopt;
+    }
+
+    // File is closed and unmapped together with the last copy of the catalogue.
+    std::shared_ptr<const uint8_t> owner(
+        data, [file](const uint8_t *p) { file->unmap(const_cast<uchar *>(p)); });
+    auto catalogue = Catalogue::from_memory(std::move(owner), static_cast<size_t>(size));
+    if (!catalogue) {
+        qDebug() << "catalogue: not a valid catalogue: " << path;
+    }
+    return catalogue;
+}
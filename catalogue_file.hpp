@@ -0,0 +1,10 @@
+#pragma once
+
+#include "catalogue.hpp"
+
+#include <optional>
+
+class QString;
+
+// Maps catalogue file into memory. Mapping stays alive while the catalogue or any copy of it does.
+std::optional<Catalogue> load_catalogue(const QString &path);
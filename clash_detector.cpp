@@ -0,0 +1,351 @@
+#include "clash_detector.hpp"
+
+#include "duct_body.hpp"
+#include "duct_network.hpp"
+#include "math.hpp"
+#include "v2.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace {
+// Overlap not deeper than this is touching, e.g. a duct laid along a wall.
+const double OVERLAP_TOLERANCE = 0.01;
+// Same as DuctNetwork default, ends closer than this are joined.
+const double JOINT_TOLERANCE = 0.5;
+
+struct Box {
+    double min_x = std::numeric_limits<double>::max();
+    double min_y = std::numeric_limits<double>::max();
+    double max_x = std::numeric_limits<double>::lowest();
+    double max_y = std::numeric_limits<double>::lowest();
+
+    void add(Point p) {
+        min_x = std::min(min_x, p.x);
+        min_y = std::min(min_y, p.y);
+        max_x = std::max(max_x, p.x);
+        max_y = std::max(max_y, p.y);
+    }
+    bool intersects(const Box &o) const {
+        return min_x <= o.max_x && o.min_x <= max_x && min_y <= o.max_y && o.min_y <= max_y;
+    }
+};
+
+template <typename P> Box box_of(const P &part) {
+    Box b;
+    for (uint8_t i = 0; i < part.size; ++i) {
+        b.add(part.points[i]);
+    }
+    return b;
+}
+
+template <typename P> std::pair<double, double> project(const P &part, v2 axis) {
+    double lo = std::numeric_limits<double>::max();
+    double hi = std::numeric_limits<double>::lowest();
+    for (uint8_t i = 0; i < part.size; ++i) {
+        const double t = dot(v2(part.points[i]), axis);
+        lo = std::min(lo, t);
+        hi = std::max(hi, t);
+    }
+    return {lo, hi};
+}
+
+// Separating axis test. Axes are edge normals of both polygons, a segment adds its own direction
+// as well so that two collinear segments are separated by their gap.
+template <typename P> bool overlapping(const P &a, const P &b) {
+    auto separated_along_edges_of = [](const P &p, const P &a, const P &b) {
+        const uint8_t edges = p.size == 2 ? 1 : p.size;
+        for (uint8_t i = 0; i < edges; ++i) {
+            const v2 edge{p.points[i], p.points[(i + 1) % p.size]};
+            if (len2(edge) == 0.0) {
+                continue;
+            }
+            for (v2 axis : {normalized(normal(edge)), normalized(edge)}) {
+                const auto [a_lo, a_hi] = project(a, axis);
+                const auto [b_lo, b_hi] = project(b, axis);
+                // Penetration depth, a segment along its own normal projects to a point.
+                if (std::min(a_hi - b_lo, b_hi - a_lo) <= OVERLAP_TOLERANCE) {
+                    return true;
+                }
+                if (p.size > 2) {
+                    break; // polygon edge directions are normals of other edges
+                }
+            }
+        }
+        return false;
+    };
+    return !separated_along_edges_of(a, a, b) && !separated_along_edges_of(b, a, b);
+}
+} // namespace
+
+ClashDetector::ClashDetector(double cell_size) : m_cell_size(cell_size) {}
+
+void ClashDetector::set_duct(const Duct &d) {
+    std::vector<Part> parts;
+    const v2 axis{d.begin, d.end};
+    if (len2(axis) > 0.0) {
+        const v2 side = normalized(normal(axis)) * (duct_width(d) / 2.0);
+        Part body;
+        body.points = {v2(d.begin) + side, v2(d.end) + side, v2(d.end) - side,
+                       v2(d.begin) - side};
+        body.size = 4;
+        parts.push_back(body);
+    }
+    set_element(ClashRef{ClashElement::duct, d.id}, false, std::move(parts), {d.begin, d.end});
+}
+
+void ClashDetector::set_fitting(const Fitting &f) {
+    const auto ends = fitting_endpoints(f);
+    std::vector<Part> parts;
+    const v2 axis{ends[0], ends[1]};
+    if (len2(axis) > 0.0) {
+        Part body;
+        if (auto adapter = std::get_if<Adapter>(&f.fitting_variant)) {
+            // Trapezoid, same as rendered.
+            const v2 n = normalized(normal(axis));
+            body.points = {v2(ends[0]) + n * (adapter->begin_d / 2.0),
+                           v2(ends[1]) + n * (adapter->end_d / 2.0),
+                           v2(ends[1]) - n * (adapter->end_d / 2.0),
+                           v2(ends[0]) - n * (adapter->begin_d / 2.0)};
+            body.size = 4;
+        } else {
+            // Split has no body yet, its axis is what can clash.
+            body.points[0] = ends[0];
+            body.points[1] = ends[1];
+            body.size = 2;
+        }
+        parts.push_back(body);
+    }
+    set_element(ClashRef{ClashElement::fitting, f.id}, false, std::move(parts), ends);
+}
+
+void ClashDetector::set_line(const LineObj &l) {
+    Part wall;
+    wall.points[0] = l.l.a;
+    wall.points[1] = l.l.b;
+    wall.size = 2;
+    set_element(ClashRef{ClashElement::line, l.id}, true, {wall}, {l.l.a, l.l.b});
+}
+
+void ClashDetector::set_rect(const RectObj &r) {
+    // Room is hollow, only its walls clash.
+    std::vector<Part> parts;
+    for (const Line &edge : {r.rect.top_line(), r.rect.right_line(), r.rect.bottom_line(),
+                             r.rect.left_line()}) {
+        Part wall;
+        wall.points[0] = edge.a;
+        wall.points[1] = edge.b;
+        wall.size = 2;
+        parts.push_back(wall);
+    }
+    set_element(ClashRef{ClashElement::rect, r.id}, true, std::move(parts),
+                {r.rect.upper_left_corner(), r.rect.bottom_right_corner()});
+}
+
+void ClashDetector::remove(const ClashRef &ref) {
+    auto it = m_index.find(ref);
+    if (it == m_index.end()) {
+        return;
+    }
+    const auto idx = it->second;
+    unlink(idx);
+    m_elements[idx] = Element{};
+    m_free.push_back(idx);
+    m_index.erase(it);
+}
+
+void ClashDetector::clear() {
+    m_elements.clear();
+    m_free.clear();
+    m_index.clear();
+    m_grid.clear();
+    m_clashes.clear();
+    m_stamps.clear();
+    m_stamp = 0;
+    m_clash_list.clear();
+    m_clash_list_dirty = false;
+}
+
+void ClashDetector::rebuild(const Model &m) {
+    clear();
+    for (auto &d : m.ducts) {
+        set_duct(d);
+    }
+    for (auto &f : m.fittings) {
+        set_fitting(f);
+    }
+    for (auto &l : m.lines) {
+        set_line(l);
+    }
+    for (auto &r : m.rects) {
+        set_rect(r);
+    }
+}
+
+void ClashDetector::model_changed(const ModelChanges &changes) {
+    const unsigned shape = ChangedField::geometry | ChangedField::size;
+    auto follow = [this, shape](auto &list, ClashElement kind, auto set) {
+        for (auto &c : list) {
+            if (c.kind == ChangeKind::removed) {
+                remove(ClashRef{kind, c.id()});
+            } else if (c.touches(shape)) {
+                (this->*set)(*c.after);
+            }
+        }
+    };
+    follow(changes.ducts, ClashElement::duct, &ClashDetector::set_duct);
+    follow(changes.fittings, ClashElement::fitting, &ClashDetector::set_fitting);
+    follow(changes.lines, ClashElement::line, &ClashDetector::set_line);
+    follow(changes.rects, ClashElement::rect, &ClashDetector::set_rect);
+}
+
+const std::vector<Clash> &ClashDetector::clashes() const {
+    if (m_clash_list_dirty) {
+        m_clash_list.clear();
+        m_clash_list.reserve(m_clashes.size());
+        for (auto &[key, location] : m_clashes) {
+            const auto a = static_cast<uint32_t>(key >> 32);
+            const auto b = static_cast<uint32_t>(key & 0xffffffff);
+            m_clash_list.push_back(Clash{m_elements[a].ref, m_elements[b].ref, location});
+        }
+        m_clash_list_dirty = false;
+    }
+    return m_clash_list;
+}
+
+bool ClashDetector::is_clashing(const ClashRef &ref) const {
+    auto it = m_index.find(ref);
+    return it != m_index.end() && !m_elements[it->second].partners.empty();
+}
+
+void ClashDetector::set_element(ClashRef ref, bool wall, std::vector<Part> parts,
+                                std::array<Point, 2> ends) {
+    uint32_t idx;
+    if (auto it = m_index.find(ref); it != m_index.end()) {
+        idx = it->second;
+        unlink(idx);
+    } else if (!m_free.empty()) {
+        idx = m_free.back();
+        m_free.pop_back();
+        m_index.emplace(ref, idx);
+    } else {
+        idx = static_cast<uint32_t>(m_elements.size());
+        m_elements.emplace_back();
+        m_stamps.push_back(0);
+        m_index.emplace(ref, idx);
+    }
+
+    auto &e = m_elements[idx];
+    e.ref = std::move(ref);
+    e.wall = wall;
+    e.parts = std::move(parts);
+    e.ends = ends;
+    e.cells = cells_of(e.parts);
+
+    // Only this element is tested, against whatever shares a cell with it.
+    m_last_narrow_tests = 0;
+    ++m_stamp;
+    m_stamps[idx] = m_stamp;
+    for (auto &key : e.cells) {
+        auto &cell = m_grid[key];
+        for (auto other_idx : cell) {
+            if (std::exchange(m_stamps[other_idx], m_stamp) == m_stamp) {
+                continue;
+            }
+            auto &other = m_elements[other_idx];
+            if ((e.wall && other.wall) || connected(e, other)) {
+                continue;
+            }
+            ++m_last_narrow_tests;
+            if (auto location = overlap(e, other)) {
+                m_clashes.emplace(pair_key(idx, other_idx), *location);
+                e.partners.push_back(other_idx);
+                other.partners.push_back(idx);
+                m_clash_list_dirty = true;
+            }
+        }
+        cell.push_back(idx);
+    }
+}
+
+void ClashDetector::unlink(uint32_t idx) {
+    auto &e = m_elements[idx];
+    for (auto &key : e.cells) {
+        auto it = m_grid.find(key);
+        auto &cell = it->second;
+        cell.erase(std::find(cell.begin(), cell.end(), idx));
+        if (cell.empty()) {
+            m_grid.erase(it);
+        }
+    }
+    e.cells.clear();
+
+    for (auto partner : e.partners) {
+        m_clashes.erase(pair_key(idx, partner));
+        auto &back = m_elements[partner].partners;
+        back.erase(std::find(back.begin(), back.end(), idx));
+        m_clash_list_dirty = true;
+    }
+    e.partners.clear();
+}
+
+std::vector<ClashDetector::CellKey> ClashDetector::cells_of(const std::vector<Part> &parts) const {
+    std::vector<CellKey> cells;
+    for (auto &part : parts) {
+        const Box b = box_of(part);
+        const auto x0 = static_cast<int64_t>(std::floor(b.min_x / m_cell_size));
+        const auto y0 = static_cast<int64_t>(std::floor(b.min_y / m_cell_size));
+        const auto x1 = static_cast<int64_t>(std::floor(b.max_x / m_cell_size));
+        const auto y1 = static_cast<int64_t>(std::floor(b.max_y / m_cell_size));
+        for (int64_t x = x0; x <= x1; ++x) {
+            for (int64_t y = y0; y <= y1; ++y) {
+                cells.push_back(CellKey{x, y});
+            }
+        }
+    }
+    std::sort(cells.begin(), cells.end());
+    cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+    return cells;
+}
+
+bool ClashDetector::connected(const Element &a, const Element &b) const {
+    if (a.wall || b.wall) {
+        return false;
+    }
+    for (auto p : a.ends) {
+        for (auto q : b.ends) {
+            if (math::points_distance(p, q) <= JOINT_TOLERANCE) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+std::optional<Point> ClashDetector::overlap(const Element &a, const Element &b) const {
+    for (auto &pa : a.parts) {
+        const Box box_a = box_of(pa);
+        for (auto &pb : b.parts) {
+            const Box box_b = box_of(pb);
+            if (!box_a.intersects(box_b) || !overlapping(pa, pb)) {
+                continue;
+            }
+            // Middle of common part of bounding boxes is good enough for a marker.
+            const double x0 = std::max(box_a.min_x, box_b.min_x);
+            const double x1 = std::min(box_a.max_x, box_b.max_x);
+            const double y0 = std::max(box_a.min_y, box_b.min_y);
+            const double y1 = std::min(box_a.max_y, box_b.max_y);
+            return Point((x0 + x1) / 2.0, (y0 + y1) / 2.0);
+        }
+    }
+    return std::nullopt;
+}
+
+uint64_t ClashDetector::pair_key(uint32_t a, uint32_t b) {
+    if (a > b) {
+        std::swap(a, b);
+    }
+    return (static_cast<uint64_t>(a) << 32) | b;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "model_changes.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Lines and rect edges are walls, ducts and fittings must not cut through them or each other.
+enum class ClashElement { duct, fitting, line, rect };
+
+struct ClashRef {
+    ClashElement kind = ClashElement::duct;
+    std::string id;
+
+    bool operator==(const ClashRef &o) const { return kind == o.kind && id == o.id; }
+    bool operator!=(const ClashRef &o) const { return !(*this == o); }
+};
+
+struct ClashRefHash {
+    size_t operator()(const ClashRef &r) const {
+        return std::hash<std::string>()(r.id) ^ (static_cast<size_t>(r.kind) * 0x9e3779b9);
+    }
+};
+
+struct Clash {
+    ClashRef a;
+    ClashRef b;
+    Point location; // somewhere in the overlap, for markers
+};
+
+// Finds ducts and fittings overlapping walls, other ducts or fittings.
+//
+// Every element is a few convex parts: a duct is its body quad, an adapter its trapezoid, a
+// line or rect edge is a segment. Elements are indexed in a uniform grid by bounding box; an
+// exact separating axis test runs only on pairs sharing a cell. Setting or removing an element
+// rechecks that element alone, everything else keeps its clashes, so dragging or drawing in a
+// large model costs the same as in a small one.
+//
+// Elements touching at an endpoint are connected, not clashing: consecutive ducts of a run and
+// fittings on duct ends overlap a little at the joint by construction.
+class ClashDetector : public IModelObserver {
+  public:
+    explicit ClashDetector(double cell_size = 100.0);
+
+    // Adds element or replaces its previous geometry.
+    void set_duct(const Duct &d);
+    void set_fitting(const Fitting &f);
+    void set_line(const LineObj &l);
+    void set_rect(const RectObj &r);
+    void remove(const ClashRef &ref);
+
+    void clear();
+    // For loading a model, edits should use methods above.
+    void rebuild(const Model &m);
+    // Follows ducts, fittings, lines and rects changed in geometry or size.
+    void model_changed(const ModelChanges &changes) override;
+
+    const std::vector<Clash> &clashes() const;
+    size_t clash_count() const { return m_clashes.size(); }
+    bool is_clashing(const ClashRef &ref) const;
+
+    // Pairs passed to exact test by the last set_* call, tells how much the grid culls.
+    size_t last_narrow_tests() const { return m_last_narrow_tests; }
+
+  private:
+    // Convex polygon, two points for a segment.
+    struct Part {
+        std::array<Point, 4> points;
+        uint8_t size = 0;
+    };
+    struct CellKey {
+        int64_t x;
+        int64_t y;
+        bool operator==(const CellKey &o) const { return x == o.x && y == o.y; }
+        bool operator<(const CellKey &o) const { return x < o.x || (x == o.x && y < o.y); }
+    };
+    struct CellKeyHash {
+        size_t operator()(const CellKey &k) const {
+            return std::hash<int64_t>()(k.x) ^ (std::hash<int64_t>()(k.y) * 31);
+        }
+    };
+    struct Element {
+        ClashRef ref;
+        bool wall = false;
+        std::vector<Part> parts;
+        std::array<Point, 2> ends; // joints of ducts and fittings, see `connected`
+        std::vector<CellKey> cells;
+        std::vector<uint32_t> partners;
+    };
+
+    void set_element(ClashRef ref, bool wall, std::vector<Part> parts, std::array<Point, 2> ends);
+    void unlink(uint32_t idx);
+    // Cells overlapped by bounding boxes of the parts, each once.
+    std::vector<CellKey> cells_of(const std::vector<Part> &parts) const;
+    bool connected(const Element &a, const Element &b) const;
+    std::optional<Point> overlap(const Element &a, const Element &b) const;
+    static uint64_t pair_key(uint32_t a, uint32_t b);
+
+    double m_cell_size;
+    std::vector<Element> m_elements;
+    std::vector<uint32_t> m_free;
+    std::unordered_map<ClashRef, uint32_t, ClashRefHash> m_index;
+    std::unordered_map<CellKey, std::vector<uint32_t>, CellKeyHash> m_grid;
+    std::unordered_map<uint64_t, Point> m_clashes;
+
+    // Candidates are met in every cell they share, stamps let each be tested once.
+    std::vector<uint32_t> m_stamps;
+    uint32_t m_stamp = 0;
+    size_t m_last_narrow_tests = 0;
+
+    mutable std::vector<Clash> m_clash_list;
+    mutable bool m_clash_list_dirty = false;
+};
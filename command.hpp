@@ -0,0 +1,188 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Commands may take over the next one of their own type by `bool merge(const T &next)`, e.g.
+// successive steps of one drag. The merged command undoes both and redoes both.
+template <class T, class = void> struct is_mergeable_command : std::false_type {};
+template <class T>
+struct is_mergeable_command<
+    T, std::void_t<decltype(std::declval<T &>().merge(std::declval<const T &>()))>>
+    : std::true_type {};
+
+// Represents an editor edit. Whenver we need to change the model, we do it through a command.
+struct Command {
+  public:
+    struct Base {
+        virtual ~Base() = default;
+        virtual std::unique_ptr<Base> clone() = 0;
+        virtual void execute() = 0;
+        virtual void undo() = 0;
+        virtual bool merge(const Base &next) = 0;
+    };
+    template <class T> struct Derived : public Base {
+        Derived(T o) : m_o(std::move(o)) {}
+        virtual std::unique_ptr<Base> clone() override { return std::make_unique<Derived<T>>(m_o); }
+        virtual void execute() override { m_o.execute(); }
+        virtual void undo() override { m_o.undo(); }
+        virtual bool merge(const Base &next) override {
+            if constexpr (is_mergeable_command<T>::value) {
+                if (auto *o = dynamic_cast<const Derived<T> *>(&next)) {
+                    return m_o.merge(o->m_o);
+                }
+            }
+            return false;
+        }
+        T m_o;
+    };
+
+  public:
+    template <class T, class = std::enable_if_t<!std::is_same_v<std::decay_t<T>, Command>>>
+    Command(T t) : m_impl(std::make_unique<Derived<T>>(std::move(t))) {}
+    Command(const Command &o) : m_impl(o.m_impl->clone()) {}
+    Command(Command &&) = default;
+    Command &operator=(const Command &o) {
+        m_impl = o.m_impl->clone();
+        return *this;
+    }
+    Command &operator=(Command &&) = default;
+
+    void execute() { return m_impl->execute(); }
+    void undo() { return m_impl->undo(); }
+    // Whether this command took over `next`, which has to be executed already.
+    bool merge(const Command &next) { return m_impl->merge(*next.m_impl); }
+
+  private:
+    std::unique_ptr<Base> m_impl;
+};
+
+// Commands undone and redone as one, what a transaction leaves on the undo stack.
+class CommandBatch {
+  public:
+    explicit CommandBatch(std::vector<Command> commands) : m_commands(std::move(commands)) {}
+
+    void execute() {
+        for (auto &c : m_commands) {
+            c.execute();
+        }
+    }
+    void undo() {
+        for (auto it = m_commands.rbegin(); it != m_commands.rend(); ++it) {
+            it->undo();
+        }
+    }
+
+  private:
+    std::vector<Command> m_commands;
+};
+
+// Commands done so far, undone in reverse order.
+//
+// Commands pushed between begin() and commit() form a transaction: they are executed right away,
+// but become one undo step, and each one is first offered to the previous one to merge. A drag
+// pushing a command per mouse move thus leaves a single command behind. Whoever derives state from
+// the model can wait for the step callback instead of following every command, so that a whole
+// transaction costs one update. Outside of transactions every push is its own undo step.
+class UndoStack {
+  public:
+    // Executes the command, anything undone before can no longer be redone.
+    void push(Command c) {
+        c.execute();
+        if (m_depth > 0) {
+            if (m_transaction.empty() || !m_transaction.back().merge(c)) {
+                m_transaction.push_back(std::move(c));
+            }
+            return;
+        }
+        m_done.push_back(std::move(c));
+        m_undone.clear();
+        step_done();
+    }
+
+    // Transactions nest, only the outermost commit closes one.
+    void begin() { ++m_depth; }
+    void commit() {
+        if (m_depth == 0 || --m_depth > 0) {
+            return;
+        }
+        auto commands = std::move(m_transaction);
+        m_transaction.clear();
+        if (commands.empty()) {
+            return;
+        }
+        if (commands.size() == 1) {
+            m_done.push_back(std::move(commands.front()));
+        } else {
+            m_done.push_back(CommandBatch{std::move(commands)});
+        }
+        m_undone.clear();
+        step_done();
+    }
+    // Undoes everything pushed since the outermost begin() and closes the transaction.
+    void rollback() {
+        if (m_depth == 0) {
+            return;
+        }
+        m_depth = 0;
+        auto commands = std::move(m_transaction);
+        m_transaction.clear();
+        CommandBatch{std::move(commands)}.undo();
+        step_done();
+    }
+    bool in_transaction() const { return m_depth > 0; }
+
+    // Called after every completed step: a push outside of transaction, a commit, a rollback, an
+    // undo or a redo.
+    void set_step_callback(std::function<void()> callback) {
+        m_step_callback = std::move(callback);
+    }
+
+    bool can_undo() const { return !m_done.empty() && m_depth == 0; }
+    bool can_redo() const { return !m_undone.empty() && m_depth == 0; }
+
+    void undo() {
+        if (!can_undo()) {
+            return;
+        }
+        m_done.back().undo();
+        m_undone.push_back(std::move(m_done.back()));
+        m_done.pop_back();
+        step_done();
+    }
+
+    void redo() {
+        if (!can_redo()) {
+            return;
+        }
+        m_undone.back().execute();
+        m_done.push_back(std::move(m_undone.back()));
+        m_undone.pop_back();
+        step_done();
+    }
+
+    void clear() {
+        m_done.clear();
+        m_undone.clear();
+        m_transaction.clear();
+        m_depth = 0;
+    }
+
+    size_t size() const { return m_done.size(); }
+
+  private:
+    void step_done() {
+        if (m_step_callback) {
+            m_step_callback();
+        }
+    }
+
+    std::vector<Command> m_done;
+    std::vector<Command> m_undone;
+    std::vector<Command> m_transaction;
+    int m_depth = 0;
+    std::function<void()> m_step_callback;
+};
@@ -0,0 +1,134 @@
+#include "connected_move.hpp"
+
+#include <deque>
+
+namespace {
+// A duct is never shortened below this, it is moved along instead.
+const double MIN_LEG_LENGTH = 1.0;
+// Shifts smaller than this do not propagate.
+const double SHIFT_EPSILON = 1e-9;
+
+Point shifted(Point p, v2 s) { return Point(p.x + s.x, p.y + s.y); }
+} // namespace
+
+ConnectedMove::ConnectedMove(const Model &m, const DuctNetwork &network, const ElementRef &moved)
+    : m_model(m), m_network(network), m_moved(moved) {
+    for (size_t i = 0; i < m.ducts.size(); ++i) {
+        m_duct_index.emplace(m.ducts[i].id, i);
+    }
+    for (size_t i = 0; i < m.fittings.size(); ++i) {
+        m_fitting_index.emplace(m.fittings[i].id, i);
+    }
+}
+
+ConnectedMove::Reached *ConnectedMove::reach(const ElementRef &e) {
+    if (auto it = m_reached.find(e); it != m_reached.end()) {
+        return &it->second;
+    }
+    auto nodes = m_network.element_nodes(e);
+    if (!nodes) {
+        return nullptr;
+    }
+    Reached r;
+    r.nodes = *nodes;
+    if (e.kind == ElementKind::duct) {
+        auto it = m_duct_index.find(e.id);
+        if (it == m_duct_index.end()) {
+            return nullptr;
+        }
+        r.index = it->second;
+        r.slot = m_ducts.size();
+        m_original_ducts.push_back(m_model.ducts[r.index]);
+        m_ducts.emplace_back(r.index, m_model.ducts[r.index]);
+    } else {
+        auto it = m_fitting_index.find(e.id);
+        if (it == m_fitting_index.end()) {
+            return nullptr;
+        }
+        r.index = it->second;
+        r.slot = m_fittings.size();
+        m_original_fittings.push_back(m_model.fittings[r.index]);
+        m_fittings.emplace_back(r.index, m_model.fittings[r.index]);
+    }
+    return &m_reached.emplace(e, r).first->second;
+}
+
+void ConnectedMove::solve(v2 shift) {
+    for (size_t i = 0; i < m_ducts.size(); ++i) {
+        m_ducts[i].second = m_original_ducts[i];
+    }
+    for (size_t i = 0; i < m_fittings.size(); ++i) {
+        m_fittings[i].second = m_original_fittings[i];
+    }
+    ++m_pass;
+
+    std::unordered_map<DuctNetwork::NodeId, v2> shifts;
+    std::deque<DuctNetwork::NodeId> queue;
+
+    // Moves element with given shifts of its nodes.
+    auto apply = [&](const ElementRef &e, const Reached &r, v2 s0, v2 s1) {
+        if (e.kind == ElementKind::duct) {
+            auto &d = m_ducts[r.slot].second;
+            d.begin = shifted(d.begin, s0);
+            d.end = shifted(d.end, s1);
+        } else {
+            auto &f = m_fittings[r.slot].second;
+            f.center = shifted(f.center, s0);
+        }
+    };
+
+    Reached *moved = reach(m_moved);
+    if (!moved) {
+        return;
+    }
+    moved->pass = m_pass;
+    apply(m_moved, *moved, shift, shift);
+    for (auto n : moved->nodes) {
+        if (shifts.emplace(n, shift).second) {
+            queue.push_back(n);
+        }
+    }
+
+    while (!queue.empty()) {
+        const auto n = queue.front();
+        queue.pop_front();
+        const v2 s = shifts[n];
+        for (auto &e : m_network.node_elements(n)) {
+            auto r = reach(e);
+            if (!r || r->pass == m_pass) {
+                continue;
+            }
+            r->pass = m_pass;
+            const bool near_is_first = r->nodes[0] == n;
+            const auto far = near_is_first ? r->nodes[1] : r->nodes[0];
+
+            v2 far_shift = s;
+            if (auto it = shifts.find(far); it != shifts.end()) {
+                far_shift = it->second;
+            } else {
+                if (e.kind == ElementKind::duct) {
+                    auto &d = m_original_ducts[r->slot];
+                    const v2 axis = near_is_first ? v2{d.begin, d.end} : v2{d.end, d.begin};
+                    const double length = len(axis);
+                    if (length > 0.0) {
+                        const v2 u = axis / length;
+                        const double along = dot(s, u);
+                        if (length - along >= MIN_LEG_LENGTH) {
+                            far_shift = s - u * along;
+                        }
+                    }
+                }
+                shifts.emplace(far, far_shift);
+                if (len2(far_shift) > SHIFT_EPSILON * SHIFT_EPSILON) {
+                    queue.push_back(far);
+                }
+            }
+
+            if (near_is_first) {
+                apply(e, *r, s, far_shift);
+            } else {
+                apply(e, *r, far_shift, s);
+            }
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "duct_network.hpp"
+#include "types.hpp"
+#include "v2.hpp"
+
+#include <unordered_map>
+#include <vector>
+
+// Moves one duct or fitting and lets connected elements follow, keeping every joint connected
+// and every duct in its direction.
+//
+// Shift of a node is passed to each element at it. A duct takes the part of the shift along its
+// own axis by getting longer or shorter, only the rest goes to its other end. A fitting has a
+// fixed shape, it passes the whole shift on. Propagation stops at nodes which do not move, so
+// moving a trunk sideways only stretches the first legs of its branches, nothing behind them is
+// visited. In a loop the element closing it keeps both ends where its nodes went, it may turn.
+//
+// Geometry is read from the model when an element is first reached and kept, so the model may be
+// updated with results while dragging.
+class ConnectedMove {
+  public:
+    ConnectedMove(const Model &m, const DuctNetwork &network, const ElementRef &moved);
+
+    // Elements reached so far and their geometry with the moved element translated by `shift`
+    // from where it was at construction. Elements reached by a previous call and not moving any
+    // more come back with their original geometry.
+    void solve(v2 shift);
+
+    // Indices into the model.
+    const std::vector<std::pair<size_t, Duct>> &ducts() const { return m_ducts; }
+    const std::vector<std::pair<size_t, Fitting>> &fittings() const { return m_fittings; }
+
+    // Geometry of reached elements before the move, in the same order as above.
+    const std::vector<Duct> &original_ducts() const { return m_original_ducts; }
+    const std::vector<Fitting> &original_fittings() const { return m_original_fittings; }
+
+  private:
+    struct Reached {
+        size_t index = 0; // into model ducts or fittings
+        size_t slot = 0;  // into m_ducts or m_fittings
+        std::array<DuctNetwork::NodeId, 2> nodes;
+        uint32_t pass = 0; // last solve() which moved it
+    };
+
+    Reached *reach(const ElementRef &e);
+
+    const Model &m_model;
+    const DuctNetwork &m_network;
+    ElementRef m_moved;
+
+    std::unordered_map<std::string, size_t> m_duct_index;
+    std::unordered_map<std::string, size_t> m_fitting_index;
+
+    std::unordered_map<ElementRef, Reached, ElementRefHash> m_reached;
+    std::vector<Duct> m_original_ducts;
+    std::vector<Fitting> m_original_fittings;
+    std::vector<std::pair<size_t, Duct>> m_ducts;
+    std::vector<std::pair<size_t, Fitting>> m_fittings;
+    uint32_t m_pass = 0;
+};
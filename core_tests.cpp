@@ -0,0 +1,943 @@
+// Headless checks of pipd_core, no Qt involved. `pipd_core_tests` runs the checks and exits with
+// non-zero status if any fails, `pipd_core_tests --bench` times hot paths on a generated model
+// instead, for profiling without the GUI.
+
+#include "airflow_solver.hpp"
+#include "bill_of_materials.hpp"
+#include "catalogue.hpp"
+#include "clash_detector.hpp"
+#include "command.hpp"
+#include "connected_move.hpp"
+#include "duct_body.hpp"
+#include "duct_network.hpp"
+#include "duct_router.hpp"
+#include "duct_run.hpp"
+#include "duct_sizing.hpp"
+#include "endpoint_index.hpp"
+#include "frame_arena.hpp"
+#include "geometry.hpp"
+#include "intersection_index.hpp"
+#include "job_system.hpp"
+#include "mesh_export.hpp"
+#include "model_changes.hpp"
+#include "polygon_offset.hpp"
+#include "rect_union.hpp"
+#include "snap_engine.hpp"
+#include "v2.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+int g_failures = 0;
+
+#define CHECK(cond)                                                                                \
+    do {                                                                                           \
+        if (!(cond)) {                                                                             \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);         \
+            ++g_failures;                                                                          \
+        }                                                                                          \
+    } while (false)
+
+bool near(double a, double b, double eps = 1e-9) { return std::fabs(a - b) <= eps; }
+
+double ring_area(const std::vector<Point> &ring) {
+    double area = 0.0;
+    for (size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++) {
+        area += (ring[j].x - ring[i].x) * (ring[j].y + ring[i].y);
+    }
+    return area / 2.0;
+}
+
+Duct make_duct(std::string id, Point a, Point b, unsigned size_mm = 160) {
+    Duct d;
+    d.id = std::move(id);
+    d.size_mm = size_mm;
+    d.begin = a;
+    d.end = b;
+    return d;
+}
+
+LineObj make_line(std::string id, Point a, Point b) {
+    LineObj l;
+    l.id = std::move(id);
+    l.l = Line(a, b);
+    return l;
+}
+
+void test_geometry() {
+    using geom::vec2;
+    static_assert(geom::cross(vec2<int32_t>{100000, 0}, vec2<int32_t>{0, 100000}) ==
+                  10000000000LL);
+    CHECK(v2().x == 0.0 && v2().y == 0.0);
+    CHECK(near(cross2d(v2{1, 0}, v2{0, 1}), 1.0));
+    CHECK(near(len(v2{Point(0, 0), Point(3, 4)}), 5.0));
+
+    auto c = geom::crossing(geom::segment<int>{{0, 0}, {10, 10}},
+                            geom::segment<int>{{0, 10}, {10, 0}});
+    CHECK(c && near(c->first, 0.5) && near(c->second, 0.5));
+    CHECK(!geom::crossing(geom::segment<float>{{0, 0}, {1, 0}},
+                          geom::segment<float>{{0, 1}, {1, 1}}));
+
+    const vec2<int> pts[] = {{5, 5}, {-3, 2}, {7, -1}};
+    const auto b = geom::bounds(pts, 3);
+    CHECK(b.x == -3 && b.y == -1 && b.width == 10 && b.height == 6);
+    CHECK(geom::closest(pts, 3, vec2<int>{6, 0}) == 2);
+
+    // Narrow coordinates are promoted in arithmetic, results come back as int16_t.
+    using v16 = vec2<int16_t>;
+    constexpr v16 p{300, -200}, q{-100, 50};
+    static_assert(p + q == v16{200, -150} && p - q == v16{400, -250} && -p == v16{-300, 200});
+    static_assert(p * int16_t(2) == v16{600, -400} && p / int16_t(2) == v16{150, -100});
+    static_assert(geom::normal(q) == v16{-50, -100});
+    static_assert(geom::cross(v16{30000, 0}, v16{0, 30000}) == 900000000);
+    CHECK(near(geom::len(v16{3, 4}), 5.0));
+    using r16 = geom::rect<int16_t>;
+    constexpr r16 r = r16::from_points(p, q).united(v16{400, 0}).grown(10);
+    static_assert(r.x == -110 && r.y == -210 && r.width == 520 && r.height == 270);
+    const v16 narrow[] = {p, q};
+    CHECK(geom::bounds(narrow, 2).width == 400);
+    CHECK((geom::affine<int16_t>{1, 0, 0, 1, 5, 5}.map(q) == v16{-95, 55}));
+}
+
+void test_duct_run() {
+    const std::vector<Point> run{Point(0, 0), Point(100, 0)};
+    CHECK(can_continue_duct_run({Point(0, 0)}, Point(3, 7)));
+    CHECK(can_continue_duct_run(run, Point(200, 0)));
+    CHECK(can_continue_duct_run(run, Point(100, 100)));
+    CHECK(can_continue_duct_run(run, Point(200, 100)));
+    CHECK(!can_continue_duct_run(run, Point(200, 20)));
+
+    CHECK(duct_run_continuations(run, 50.0).size() == DirectionTable::SIZE);
+    const Point p = snap_to_duct_run_continuation(run, Point(190, 3), 500.0);
+    CHECK(near(p.x, 190.0) && near(p.y, 0.0));
+}
+
+bool route_crosses(const std::vector<Point> &route, Point a, Point b) {
+    using geom::segment;
+    using geom::vec2;
+    const segment<double> wall{vec2<double>(a.x, a.y), vec2<double>(b.x, b.y)};
+    for (size_t i = 1; i < route.size(); ++i) {
+        const segment<double> leg{vec2<double>(route[i - 1].x, route[i - 1].y),
+                                  vec2<double>(route[i].x, route[i].y)};
+        if (geom::crossing(leg, wall)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void test_duct_router() {
+    // Start closer to the wall than clearance, goal behind it: the route leaves along the wall
+    // and goes around its end.
+    DuctRouter router;
+    router.add_obstacle(Line(Point(100, -200), Point(100, 200)));
+    auto route = router.route(RouteEnd{Point(95, 0), std::nullopt},
+                              RouteEnd{Point(300, 0), std::nullopt}, 16.0);
+    CHECK(route && near(route->front().x, 95.0) && near(route->back().x, 300.0));
+    CHECK(route && !route_crosses(*route, Point(100, -200), Point(100, 200)));
+
+    // Start next to one side of a room, none of its sides are given up.
+    router.clear_obstacles();
+    router.add_obstacle(Rect{100, -200, 400, 400});
+    route = router.route(RouteEnd{Point(95, 0), v2{1, 0}}, RouteEnd{Point(700, 0), std::nullopt},
+                         16.0);
+    CHECK(route && route->size() > 2);
+    for (auto [a, b] : {std::pair(Point(100, -200), Point(100, 200)),
+                        std::pair(Point(500, -200), Point(500, 200)),
+                        std::pair(Point(100, -200), Point(500, -200)),
+                        std::pair(Point(100, 200), Point(500, 200))}) {
+        CHECK(route && !route_crosses(*route, a, b));
+    }
+
+    // A room containing the start does not keep the route in.
+    route = router.route(RouteEnd{Point(300, 0), std::nullopt},
+                         RouteEnd{Point(300, 400), std::nullopt}, 16.0);
+    CHECK(route.has_value());
+}
+
+void test_rect_union() {
+    // Two overlapping squares make one outline, a separate one stays apart.
+    const auto outlines =
+        rect_union({Rect{0, 0, 10, 10}, Rect{5, 5, 10, 10}, Rect{100, 100, 1, 1}});
+    CHECK(outlines.size() == 2);
+    double area = 0.0;
+    for (auto &o : outlines) {
+        CHECK(o.holes.empty());
+        area += std::fabs(ring_area(o.outer));
+    }
+    CHECK(near(area, 175.0 + 1.0));
+
+    // Frame of four rects has a hole.
+    const auto frame = rect_union(
+        {Rect{0, 0, 10, 2}, Rect{0, 8, 10, 2}, Rect{0, 0, 2, 10}, Rect{8, 0, 2, 10}});
+    CHECK(frame.size() == 1 && frame.front().holes.size() == 1);
+}
+
+void test_polygon_offset() {
+    const std::vector<Point> square{Point(0, 0), Point(10, 0), Point(10, 10), Point(0, 10)};
+    OffsetSettings s;
+    s.join = OffsetJoin::mitre;
+    CHECK(near(std::fabs(ring_area(offset_ring(square, 1.0, s))), 144.0));
+    CHECK(near(std::fabs(ring_area(offset_ring(square, -1.0, s))), 64.0));
+    CHECK(offset_ring(square, -6.0, s).empty());
+
+    s.ends = OffsetJoin::square;
+    const auto wall = offset_polyline({Point(0, 0), Point(10, 0)}, 1.0, s);
+    CHECK(near(std::fabs(ring_area(wall)), 12.0 * 2.0));
+}
+
+void test_endpoint_index() {
+    Model m;
+    m.ducts.push_back(make_duct("a", Point(0, 0), Point(100, 0)));
+    m.ducts.push_back(make_duct("b", Point(100, 0), Point(100, 100)));
+    EndpointIndex index;
+    index.rebuild(m);
+    CHECK(index.size() == 4);
+    CHECK(index.within(Point(100.2, 0), 1.0).size() == 2);
+
+    auto end = index.closest(Point(1, 1), 5.0, EndpointMask::duct);
+    CHECK(end && end->id == "a" && end->end == 0 && near(end->other.x, 100.0));
+
+    m.ducts[1].end = Point(300, 300);
+    index.set_duct(m.ducts[1]);
+    CHECK(index.within(Point(100, 100), 1.0).empty());
+    CHECK(index.nearest(Point(290, 290), 1).front().id == "b");
+    index.remove(EndpointOwner::duct, "a");
+    CHECK(index.size() == 2);
+
+    // Line ends meeting get a shared point.
+    Model lines;
+    lines.lines.push_back(make_line("l1", Point(0, 0), Point(10, 0)));
+    lines.lines.push_back(make_line("l2", Point(10.2, 0.1), Point(10, 20)));
+    EndpointIndex line_index;
+    line_index.rebuild(lines);
+    CHECK(connect_all_line_endpoints(lines, line_index, 0.5) == 2);
+    CHECK(lines.points.size() == 1);
+    CHECK(lines.lines[0].endpoint_b_ref == lines.lines[1].endpoint_a_ref);
+    CHECK(!lines.lines[0].endpoint_a_ref);
+}
+
+void test_intersection_index() {
+    IntersectionIndex index;
+    index.set_line(make_line("h", Point(0, 0), Point(100, 0)));
+    index.set_line(make_line("v", Point(50, -50), Point(50, 50)));
+    index.set_line(make_line("joint", Point(100, 0), Point(100, 50)));
+    CHECK(index.intersection_count() == 1);
+    index.remove(IntersectionRef{IntersectionElement::line, "v"});
+    CHECK(index.intersection_count() == 0);
+}
+
+void test_duct_network() {
+    DuctNetwork net;
+    net.add_duct(make_duct("a", Point(0, 0), Point(100, 0)));
+    net.add_duct(make_duct("b", Point(100, 0), Point(100, 100)));
+    net.add_duct(make_duct("c", Point(500, 0), Point(600, 0)));
+    CHECK(net.component_count() == 2);
+    CHECK(net.neighbours(ElementRef{ElementKind::duct, "a"}).size() == 1);
+
+    net.update_duct(make_duct("c", Point(100, 100), Point(200, 100)));
+    CHECK(net.component_count() == 1);
+    CHECK(net.run(ElementRef{ElementKind::duct, "a"}).size() == 3);
+}
+
+void test_bill_of_materials() {
+    BillOfMaterials bom;
+    const Duct a = make_duct("a", Point(0, 0), Point(100, 0), 160);
+    bom.add_duct(a);
+    bom.add_duct(make_duct("b", Point(0, 0), Point(0, 50), 160));
+    CHECK(bom.total_duct_length_mm() == 1500);
+    bom.update_duct(a, make_duct("a", Point(0, 0), Point(200, 0), 200));
+    CHECK(bom.duct_totals().size() == 2);
+    CHECK(bom.total_duct_length_mm() == 2500);
+    CHECK(!bom.remove_duct(make_duct("c", Point(0, 0), Point(10, 0), 315)));
+    CHECK(bom.total_duct_length_mm() == 2500);
+
+    std::ostringstream csv;
+    csv << 0.5;
+    bom.write_csv(csv);
+    csv << 0.5;
+    CHECK(csv.str() == "0.5item,size_mm,quantity,unit\nduct,160,0.500,m\nduct,200,2.000,m\n0.5");
+}
+
+// Trunk from the source to a fork, branches to two terminals.
+Model fork_model() {
+    Model m;
+    m.ducts.push_back(make_duct("trunk", Point(0, 0), Point(1000, 0)));
+    m.ducts.push_back(make_duct("east", Point(1000, 0), Point(2000, 0)));
+    m.ducts.push_back(make_duct("south", Point(1000, 0), Point(1000, 1000)));
+    return m;
+}
+
+void test_airflow_solver() {
+    const Model m = fork_model();
+    DuctNetwork network;
+    network.rebuild(m);
+    AirflowSolver solver;
+    solver.set_source(Point(0, 0));
+    solver.set_terminal_flow(Point(2000, 0), 100.0);
+    solver.set_terminal_flow(Point(1000, 1000), 300.0);
+    CHECK(solver.solve(m, network) == 1);
+    CHECK(!solver.has_pending());
+
+    auto trunk = solver.flow(ElementRef{ElementKind::duct, "trunk"});
+    auto east = solver.flow(ElementRef{ElementKind::duct, "east"});
+    auto south = solver.flow(ElementRef{ElementKind::duct, "south"});
+    CHECK(trunk && east && south);
+    if (trunk && east && south) {
+        // Whatever enters the fork leaves it.
+        CHECK(near(std::fabs(trunk->flow_m3s), 400.0 / 3600.0));
+        CHECK(near(std::fabs(east->flow_m3s), 100.0 / 3600.0));
+        const double branches = std::fabs(east->flow_m3s) + std::fabs(south->flow_m3s);
+        CHECK(near(std::fabs(trunk->flow_m3s), branches));
+        CHECK(trunk->pressure_drop_pa > 0.0 && trunk->velocity_ms > south->velocity_ms);
+    }
+    auto source = network.node_at(Point(0, 0));
+    auto terminal = network.node_at(Point(1000, 1000));
+    CHECK(source && terminal && solver.node_pressure(*source) && solver.node_pressure(*terminal));
+    if (source && terminal) {
+        CHECK(*solver.node_pressure(*terminal) < *solver.node_pressure(*source));
+    }
+
+    // Nothing invalidated, nothing solved again.
+    CHECK(solver.solve(m, network) == 0);
+    solver.invalidate(ElementRef{ElementKind::duct, "east"});
+    CHECK(solver.solve(m, network) == 1);
+
+    // Node of a removed duct is reused by the network, it has no pressure until solved.
+    Model smaller = m;
+    smaller.ducts.erase(smaller.ducts.begin() + 1);
+    network.remove(ElementRef{ElementKind::duct, "east"});
+    solver.invalidate(ElementRef{ElementKind::duct, "east"});
+    solver.invalidate(ElementRef{ElementKind::duct, "trunk"});
+    solver.solve(smaller, network);
+    CHECK(!solver.flow(ElementRef{ElementKind::duct, "east"}));
+    smaller.ducts.push_back(make_duct("far", Point(5000, 5000), Point(6000, 5000)));
+    network.add_duct(smaller.ducts.back());
+    auto reused = network.node_at(Point(5000, 5000));
+    CHECK(reused && !solver.node_pressure(*reused));
+}
+
+void test_duct_sizing() {
+    const Model m = fork_model();
+    DuctNetwork network;
+    network.rebuild(m);
+    AirflowSolver solver;
+    solver.set_source(Point(0, 0));
+    solver.set_terminal_flow(Point(2000, 0), 100.0);
+    solver.set_terminal_flow(Point(1000, 1000), 300.0);
+    solver.solve(m, network);
+
+    SizingSettings settings;
+    settings.method = SizingMethod::velocity;
+    settings.max_velocity_ms = 5.0;
+    auto sized = propose_duct_sizes(m, network, solver, settings);
+    CHECK(sized.size() == 3);
+    auto proposed = [&sized](const std::string &id) {
+        for (auto &s : sized) {
+            if (s.id == id) {
+                return s.proposed_mm;
+            }
+        }
+        return 0u;
+    };
+    // Smallest standard sizes keeping 400, 100 and 300 m3/h under 5 m/s.
+    CHECK(proposed("trunk") == 200);
+    CHECK(proposed("east") == 100);
+    CHECK(proposed("south") == 160);
+    for (auto &s : sized) {
+        CHECK(s.velocity_ms <= settings.max_velocity_ms);
+    }
+
+    settings.method = SizingMethod::equal_friction;
+    for (auto &s : propose_duct_sizes(m, network, solver, settings)) {
+        CHECK(s.friction_pa_m <= settings.friction_rate_pa_m);
+    }
+
+    // Branches sized as tasks come out the same, a cancelled job stops sizing.
+    JobSystem jobs(2);
+    Job job("sizing");
+    const auto sequential = propose_duct_sizes(m, network, solver, settings);
+    const auto tasked = propose_duct_sizes(m, network, solver, settings, &jobs, &job);
+    CHECK(tasked.size() == sequential.size());
+    for (size_t i = 0; i < tasked.size() && i < sequential.size(); ++i) {
+        CHECK(tasked[i].id == sequential[i].id &&
+              tasked[i].proposed_mm == sequential[i].proposed_mm);
+    }
+    job.cancel();
+    bool stopped = false;
+    try {
+        propose_duct_sizes(m, network, solver, settings, &jobs, &job);
+    } catch (const JobCancelled &) {
+        stopped = true;
+    }
+    CHECK(stopped);
+}
+
+void test_clash_detector() {
+    Model m;
+    m.ducts.push_back(make_duct("a", Point(0, 0), Point(100, 0)));
+    m.ducts.push_back(make_duct("b", Point(100, 0), Point(100, 100)));
+    m.lines.push_back(make_line("wall", Point(50, -50), Point(50, 50)));
+    ClashDetector clashes;
+    clashes.rebuild(m);
+
+    // The wall cuts through the first duct, the joint of the two is no clash.
+    CHECK(clashes.clash_count() == 1);
+    CHECK(clashes.is_clashing(ClashRef{ClashElement::duct, "a"}));
+    CHECK(clashes.is_clashing(ClashRef{ClashElement::line, "wall"}));
+    CHECK(!clashes.is_clashing(ClashRef{ClashElement::duct, "b"}));
+
+    // Crossing ducts clash, once moved apart they do not.
+    Duct crossing = make_duct("c", Point(50, 100), Point(150, 100));
+    clashes.set_duct(crossing);
+    CHECK(clashes.is_clashing(ClashRef{ClashElement::duct, "c"}));
+    crossing.begin = Point(200, 100);
+    crossing.end = Point(300, 100);
+    clashes.set_duct(crossing);
+    CHECK(!clashes.is_clashing(ClashRef{ClashElement::duct, "c"}));
+
+    clashes.remove(ClashRef{ClashElement::line, "wall"});
+    CHECK(clashes.clash_count() == 0);
+}
+
+std::optional<Catalogue> catalogue_from(const std::string &bytes) {
+    std::shared_ptr<uint8_t> data(new uint8_t[bytes.size()], std::default_delete<uint8_t[]>());
+    std::memcpy(data.get(), bytes.data(), bytes.size());
+    return Catalogue::from_memory(data, bytes.size());
+}
+
+void test_catalogue() {
+    std::vector<CataloguePart> parts = {
+        {PartType::duct, 200, 0, 0, 3000, 2400, "D200", "Acme"},
+        {PartType::duct, 125, 0, 0, 3000, 1500, "D125", "Acme"},
+        {PartType::duct, 160, 0, 0, 3000, 1900, "D160", "Vent"},
+        {PartType::adapter, 200, 160, 0, 150, 900, "A200-160", "Vent"},
+        {PartType::elbow, 160, 0, 90, 0, 700, "E160-90", "Acme"},
+    };
+    std::ostringstream os;
+    CHECK(write_catalogue(os, parts));
+    const std::string bytes = os.str();
+
+    auto c = catalogue_from(bytes);
+    CHECK(c && c->size() == parts.size());
+    if (c) {
+        CHECK(c->parts(PartType::duct).size() == 3);
+        auto adapters = c->parts(PartType::adapter, 200, 160);
+        CHECK(adapters.size() == 1 && c->sku(*adapters.begin()) == "A200-160");
+        CHECK(c->parts(PartType::adapter, 160, 200).size() == 1);
+        CHECK(c->parts(PartType::elbow, 160, 160, 90).size() == 1);
+        CHECK(c->compatible(PartType::adapter, 160).size() == 1);
+        CHECK(c->duct_size_at_least(150) == 160u);
+        CHECK(!c->duct_size_at_least(250));
+        CHECK(duct_sizes(*c) == std::vector<unsigned>({125, 160, 200}));
+    }
+
+    // Damaged files are refused instead of read out of bounds or searched out of order.
+    CHECK(!catalogue_from(bytes.substr(0, bytes.size() - 1)));
+    std::string bad_magic = bytes;
+    bad_magic[0] = 'X';
+    CHECK(!catalogue_from(bad_magic));
+    std::string unsorted = bytes;
+    const size_t first = sizeof(CatalogueHeader);
+    std::swap_ranges(unsorted.begin() + first, unsorted.begin() + first + sizeof(CatalogueRecord),
+                     unsorted.begin() + first + sizeof(CatalogueRecord));
+    CHECK(!catalogue_from(unsorted));
+}
+
+// Counts what the generator emits.
+struct CountingSink : IMeshSink {
+    size_t groups = 0, meshes = 0, vertices = 0, indices = 0;
+    bool indices_in_range = true;
+
+    void begin_group(const std::string &) override { ++groups; }
+    void add_mesh(const std::string &, const MeshVertex *, size_t vertex_count,
+                  const uint32_t *mesh_indices, size_t index_count) override {
+        ++meshes;
+        vertices += vertex_count;
+        indices += index_count;
+        for (size_t i = 0; i < index_count; ++i) {
+            indices_in_range = indices_in_range && mesh_indices[i] < vertex_count;
+        }
+    }
+    void end_group() override {}
+    bool finish() override { return true; }
+};
+
+size_t count_lines(const std::string &text, const char *prefix) {
+    size_t count = 0;
+    std::istringstream is(text);
+    for (std::string line; std::getline(is, line);) {
+        count += line.rfind(prefix, 0) == 0;
+    }
+    return count;
+}
+
+void test_mesh_export() {
+    Model m;
+    m.ducts.push_back(make_duct("a", Point(0, 0), Point(100, 0), 160));
+    const std::vector<FloorModel> floors = {{&m, 0.0, "ground"}};
+    MeshSettings settings;
+
+    // 160 mm gets 11 sides of at most 5 cm: two rings of the mantle and two capped discs.
+    const size_t sides = 11;
+    const size_t vertices = 2 * sides + 2 * (sides + 1);
+    const size_t indices = 6 * sides + 2 * 3 * sides;
+    CountingSink counts;
+    CHECK(generate_meshes(floors, settings, counts));
+    CHECK(counts.groups == 1 && counts.meshes == 1);
+    CHECK(counts.vertices == vertices && counts.indices == indices);
+    CHECK(counts.indices_in_range);
+
+    std::ostringstream obj;
+    ObjWriter obj_writer(obj);
+    CHECK(generate_meshes(floors, settings, obj_writer));
+    CHECK(count_lines(obj.str(), "v ") == vertices);
+    CHECK(count_lines(obj.str(), "vn ") == vertices);
+    CHECK(count_lines(obj.str(), "f ") == indices / 3);
+
+    std::ostringstream json, bin;
+    GltfWriter gltf_writer(json, bin, "model.bin");
+    CHECK(generate_meshes(floors, settings, gltf_writer));
+    const size_t bin_size = vertices * sizeof(MeshVertex) + indices * sizeof(uint32_t);
+    CHECK(bin.str().size() == bin_size);
+    CHECK(json.str().find("\"byteLength\":" + std::to_string(bin_size) + "}") !=
+          std::string::npos);
+}
+
+void test_connected_move() {
+    Model m;
+    m.ducts.push_back(make_duct("t1", Point(0, 0), Point(500, 0)));
+    m.ducts.push_back(make_duct("t2", Point(500, 0), Point(1000, 0)));
+    m.ducts.push_back(make_duct("b1", Point(500, 0), Point(500, 500)));
+    m.ducts.push_back(make_duct("b2", Point(500, 500), Point(800, 500)));
+    DuctNetwork network;
+    network.rebuild(m);
+
+    // Trunk moved sideways: the rest of it follows, the branch leg along the shift gets shorter
+    // and nothing behind it moves.
+    ConnectedMove move(m, network, ElementRef{ElementKind::duct, "t1"});
+    move.solve(v2{0, 100});
+    auto moved = [&move](const std::string &id) -> const Duct * {
+        for (auto &[idx, d] : move.ducts()) {
+            if (d.id == id) {
+                return &d;
+            }
+        }
+        return nullptr;
+    };
+    auto t1 = moved("t1"), t2 = moved("t2"), b1 = moved("b1");
+    CHECK(t1 && t2 && b1 && !moved("b2"));
+    if (t1 && t2 && b1) {
+        CHECK(near(t1->begin.y, 100.0) && near(t1->end.y, 100.0));
+        CHECK(near(t2->begin.y, 100.0) && near(t2->end.y, 100.0) && near(t2->end.x, 1000.0));
+        CHECK(near(b1->begin.x, 500.0) && near(b1->begin.y, 100.0));
+        CHECK(near(b1->end.x, 500.0) && near(b1->end.y, 500.0));
+    }
+
+    // Back at the start everything reached has its original geometry.
+    move.solve(v2{0, 0});
+    b1 = moved("b1");
+    CHECK(b1 && near(b1->begin.y, 0.0));
+}
+
+void test_duct_bodies() {
+    std::vector<Duct> ducts = {make_duct("a", Point(0, 0), Point(100, 0), 200),
+                               make_duct("b", Point(100, 0), Point(100, 100), 200)};
+    DuctBodyCache cache;
+    ModelNotifier notifier;
+    notifier.subscribe(&cache);
+    for (auto &d : ducts) {
+        notifier.added(d);
+    }
+    CHECK(cache.body("a") == nullptr);
+    CHECK(cache.sync() == 2);
+    CHECK(cache.sync() == 0);
+
+    // Mitred legs share the cut: end corners of one are begin corners of the other.
+    auto &a = *cache.body("a");
+    auto &b = *cache.body("b");
+    CHECK(near(a.outline[1].x, b.outline[0].x) && near(a.outline[1].y, b.outline[0].y));
+    CHECK(near(a.outline[2].x, b.outline[3].x) && near(a.outline[2].y, b.outline[3].y));
+
+    // Moving the far end of one leg rebuilds it and its neighbour only, setting it again nothing.
+    ducts.push_back(make_duct("c", Point(500, 500), Point(600, 500), 200));
+    cache.set_duct(ducts[2]);
+    CHECK(cache.sync() == 1);
+    ducts[1].end = Point(100, 200);
+    cache.set_duct(ducts[1]);
+    CHECK(cache.sync() == 2);
+    cache.set_duct(ducts[1]);
+    CHECK(cache.sync() == 0);
+
+    cache.set_joint_style(DuctJoint::round);
+    CHECK(cache.sync() == 3);
+    CHECK(cache.body("a")->round_end && cache.body("b")->round_begin);
+    CHECK(!cache.body("c")->round_begin);
+
+    // Removing a duct rebuilds only the one it was joined to, which gets a flat end.
+    notifier.removed(ducts[2]);
+    CHECK(cache.sync() == 0);
+    notifier.removed(ducts[0]);
+    CHECK(cache.sync() == 1);
+    CHECK(cache.body("a") == nullptr && cache.size() == 1);
+    CHECK(!cache.body("b")->round_begin);
+}
+
+// Remembers what it was told, for checking folding.
+struct RecordingObserver : IModelObserver {
+    std::vector<ModelChanges> seen;
+    void model_changed(const ModelChanges &changes) override { seen.push_back(changes); }
+};
+
+void test_model_changes() {
+    Model m;
+    ModelNotifier changes;
+    RecordingObserver recorder;
+    DuctNetwork network;
+    BillOfMaterials bom;
+    EndpointIndex endpoints;
+    changes.subscribe(&recorder);
+    changes.subscribe(&network);
+    changes.subscribe(&bom);
+    changes.subscribe(&endpoints);
+
+    {
+        ModelBatch batch(changes);
+        m.ducts.push_back(make_duct("a", Point(0, 0), Point(100, 0)));
+        changes.added(m.ducts.back());
+        m.ducts.push_back(make_duct("b", Point(100, 0), Point(100, 100)));
+        changes.added(m.ducts.back());
+        m.ducts.push_back(make_duct("gone", Point(500, 0), Point(600, 0)));
+        changes.added(m.ducts.back());
+        changes.removed(m.ducts.back());
+        m.ducts.pop_back();
+        // A drag of "b", many steps.
+        for (int i = 1; i <= 50; ++i) {
+            const Duct before = m.ducts[1];
+            m.ducts[1].end = Point(100, 100 + i);
+            changes.modified(before, m.ducts[1]);
+        }
+        CHECK(recorder.seen.empty());
+    }
+    CHECK(changes.delivery_count() == 1);
+    CHECK(recorder.seen.size() == 1);
+    CHECK(recorder.seen[0].ducts.size() == 2);
+    CHECK(network.element_count() == 2);
+    CHECK(network.component_count() == 1);
+    CHECK(bom.total_duct_length_mm() == 1000 + 1500);
+    CHECK(endpoints.size() == 4);
+
+    // Modified outside of a batch is delivered at once, with fields telling what changed.
+    const Duct before = m.ducts[0];
+    m.ducts[0].size_mm = 200;
+    changes.modified(before, m.ducts[0]);
+    CHECK(recorder.seen.size() == 2);
+    auto &resized = recorder.seen[1].ducts.front();
+    CHECK(resized.kind == ChangeKind::modified);
+    CHECK(resized.touches(ChangedField::size) && !resized.touches(ChangedField::geometry));
+    CHECK(bom.duct_totals().size() == 2);
+
+    // Removing and adding back within a batch is a modification.
+    changes.begin();
+    changes.removed(m.ducts[0]);
+    m.ducts[0].begin = Point(-50, 0);
+    changes.added(m.ducts[0]);
+    changes.end();
+    auto &moved = recorder.seen.back().ducts.front();
+    CHECK(moved.kind == ChangeKind::modified && moved.touches(ChangedField::geometry));
+    CHECK(bom.total_duct_length_mm() == 1500 + 1500);
+    CHECK(endpoints.closest(Point(-50, 0), 1.0).has_value());
+}
+
+// Sets one value of `values`, successive sets of the same one merge.
+struct SetValue {
+    std::vector<int> *values;
+    size_t index;
+    int before;
+    int after;
+
+    void execute() { (*values)[index] = after; }
+    void undo() { (*values)[index] = before; }
+    bool merge(const SetValue &next) {
+        if (next.index != index) {
+            return false;
+        }
+        after = next.after;
+        return true;
+    }
+};
+
+void test_undo_transactions() {
+    std::vector<int> values(2, 0);
+    int steps = 0;
+    UndoStack stack;
+    stack.set_step_callback([&steps] { ++steps; });
+
+    // A drag: many sets of one value, then of another, in one transaction.
+    stack.begin();
+    for (int i = 1; i <= 100; ++i) {
+        stack.push(SetValue{&values, 0, values[0], i});
+    }
+    stack.push(SetValue{&values, 1, values[1], 7});
+    CHECK(steps == 0);
+    CHECK(!stack.can_undo());
+    stack.commit();
+    CHECK(steps == 1);
+    CHECK(stack.size() == 1);
+    CHECK(values[0] == 100 && values[1] == 7);
+
+    stack.undo();
+    CHECK(values[0] == 0 && values[1] == 0);
+    stack.redo();
+    CHECK(values[0] == 100 && values[1] == 7);
+    CHECK(steps == 3);
+
+    // Nested transactions join the outer one, rollback undoes all of it.
+    stack.begin();
+    stack.push(SetValue{&values, 1, values[1], 8});
+    stack.begin();
+    stack.push(SetValue{&values, 0, values[0], 1});
+    stack.commit();
+    CHECK(stack.in_transaction());
+    stack.rollback();
+    CHECK(!stack.in_transaction());
+    CHECK(values[0] == 100 && values[1] == 7);
+    CHECK(stack.size() == 1);
+
+    // Outside of transactions every push is its own step, even to one target: two finished
+    // moves of one thing are undone one at a time.
+    stack.push(SetValue{&values, 0, values[0], 5});
+    stack.push(SetValue{&values, 0, values[0], 6});
+    CHECK(stack.size() == 3);
+    stack.undo();
+    CHECK(values[0] == 5);
+    stack.undo();
+    CHECK(values[0] == 100 && values[1] == 7);
+}
+
+// Waits for the workers, the way the GUI event loop would.
+void deliver_all(JobSystem &jobs) {
+    while (!jobs.active().empty()) {
+        if (jobs.deliver() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+void test_job_system() {
+    JobSystem jobs(3);
+    std::atomic<int> wakeups{0};
+    jobs.set_wakeup([&] { ++wakeups; });
+
+    // Nested parallel_for from a job runs on workers without deadlocking.
+    long sum = 0;
+    auto job = jobs.run(
+        "sum",
+        [&jobs](Job &job) {
+            std::vector<long> parts(64);
+            jobs.parallel_for(parts.size(), [&](size_t i) {
+                for (long k = 0; k < 1000; ++k) {
+                    parts[i] += k;
+                }
+            });
+            job.set_progress(0.5);
+            long total = 0;
+            for (auto p : parts) {
+                total += p;
+            }
+            return total;
+        },
+        [&sum](long total) { sum = total; });
+    deliver_all(jobs);
+    CHECK(sum == 64 * 999 * 1000 / 2);
+    CHECK(job->state() == JobState::finished && job->progress() == 1.0);
+    CHECK(wakeups > 0);
+
+    bool called = false;
+    auto failing = jobs.run(
+        "failing", [](Job &) -> int { throw std::runtime_error("broken"); },
+        [&called](int) { called = true; });
+    std::atomic<bool> release{false};
+    auto cancelled = jobs.run(
+        "cancelled",
+        [&release](Job &job) {
+            while (!release) {
+                std::this_thread::yield();
+            }
+            job.throw_if_cancelled();
+        },
+        [&called] { called = true; });
+    cancelled->cancel();
+    release = true;
+    deliver_all(jobs);
+    CHECK(!called);
+    CHECK(failing->state() == JobState::failed && failing->error() == "broken");
+    CHECK(cancelled->state() == JobState::cancelled);
+
+    // Cancelled when the work is done but not delivered yet.
+    const int before = wakeups;
+    auto late = jobs.run(
+        "late", [](Job &) { return 1; }, [&called](int) { called = true; });
+    while (wakeups == before) {
+        std::this_thread::yield();
+    }
+    jobs.cancel_all();
+    deliver_all(jobs);
+    CHECK(!called);
+    CHECK(late->state() == JobState::cancelled);
+}
+
+void test_frame_arena() {
+    FrameArena arena(256);
+    const auto frame = [&arena] {
+        arena.reset();
+        FrameVector<Point> points(arena.resource());
+        for (int i = 0; i < 100; ++i) {
+            points.emplace_back(i, i);
+        }
+        auto found = duct_run_continuations({Point(0, 0), Point(100, 0)}, 50.0, arena.resource());
+        return found.size() + points.size();
+    };
+
+    // The first frame overflows, the buffer grows to fit it and frames alike stay within.
+    CHECK(frame() > 100);
+    CHECK(arena.overflow_bytes() > 0);
+    frame();
+    CHECK(arena.grow_count() == 1 && arena.capacity() > 256);
+    CHECK(arena.overflow_bytes() == 0);
+    frame();
+    CHECK(arena.grow_count() == 1);
+
+    EndpointIndex endpoints;
+    Model m;
+    m.ducts.push_back(make_duct("d1", Point(0, 0), Point(100, 0)));
+    endpoints.rebuild(m);
+    arena.reset();
+    auto near = endpoints.within(Point(1, 0), 5.0, EndpointMask::all, arena.resource());
+    CHECK(near.size() == 1 && near[0].id == "d1");
+    CHECK(arena.overflow_bytes() == 0);
+}
+
+// Walls on a grid and duct runs along them, roughly the density of a large floor plan.
+Model generated_model(size_t rooms) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> jitter(-20.0, 20.0);
+    Model m;
+    const size_t side = static_cast<size_t>(std::sqrt(static_cast<double>(rooms))) + 1;
+    for (size_t i = 0; i < side; ++i) {
+        for (size_t j = 0; j < side; ++j) {
+            const double x = i * 600.0, y = j * 500.0;
+            const std::string id = std::to_string(i) + "_" + std::to_string(j);
+            m.lines.push_back(make_line("h" + id, Point(x, y), Point(x + 600.0, y)));
+            m.lines.push_back(make_line("v" + id, Point(x, y), Point(x, y + 500.0)));
+            const Point a(x + 300.0 + jitter(rng), y + 250.0 + jitter(rng));
+            m.ducts.push_back(make_duct("d" + id, a, Point(a.x + 600.0, a.y)));
+        }
+    }
+    return m;
+}
+
+void bench(const char *name, size_t repeat, const std::function<void()> &f) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < repeat; ++i) {
+        f();
+    }
+    const std::chrono::duration<double, std::micro> took = std::chrono::steady_clock::now() - start;
+    std::printf("%-32s %12.2f us\n", name, took.count() / repeat);
+}
+
+int run_benchmarks() {
+    const Model m = generated_model(10000);
+    std::printf("model: %zu lines, %zu ducts\n", m.lines.size(), m.ducts.size());
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> coord(0.0, 60000.0);
+
+    EndpointIndex endpoints;
+    bench("endpoints rebuild", 10, [&] { endpoints.rebuild(m); });
+    bench("endpoints within", 10000,
+          [&] { endpoints.within(Point(coord(rng), coord(rng)), 10.0); });
+    Duct dragged = m.ducts.front();
+    bench("endpoints drag", 10000, [&] {
+        dragged.end = Point(coord(rng), coord(rng));
+        endpoints.set_duct(dragged);
+    });
+
+    IntersectionIndex intersections;
+    bench("intersections rebuild", 3, [&] { intersections.rebuild(m); });
+    LineObj wall = m.lines.front();
+    bench("intersections drag", 1000, [&] {
+        wall.l.b = Point(coord(rng), coord(rng));
+        intersections.set_line(wall);
+    });
+
+    SnapEngine snap;
+    bench("snap rebuild", 3, [&] { snap.rebuild(m, intersections); });
+    bench("snap query", 10000, [&] { snap.snap(Point(coord(rng), coord(rng)), 10.0); });
+
+    DuctNetwork network;
+    bench("network rebuild", 3, [&] { network.rebuild(m); });
+
+    DuctRouter router;
+    bench("router obstacles", 3, [&] { router.set_obstacles(m); });
+    bench("route across rooms", 10, [&] {
+        router.route(RouteEnd{Point(300, 250), std::nullopt},
+                     RouteEnd{Point(2700, 2250), std::nullopt}, 16.0);
+    });
+    std::printf("%-32s %12zu\n", "route expansions", router.last_expansions());
+
+    std::vector<Rect> rects;
+    for (size_t i = 0; i < 1000; ++i) {
+        rects.push_back(Rect{coord(rng) / 20.0, coord(rng) / 20.0, 200.0, 150.0});
+    }
+    bench("rect union 1000", 10, [&] { rect_union(rects); });
+    return 0;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc > 1 && std::strcmp(argv[1], "--bench") == 0) {
+        return run_benchmarks();
+    }
+
+    test_geometry();
+    test_duct_run();
+    test_duct_router();
+    test_rect_union();
+    test_polygon_offset();
+    test_endpoint_index();
+    test_intersection_index();
+    test_duct_network();
+    test_bill_of_materials();
+    test_airflow_solver();
+    test_duct_sizing();
+    test_clash_detector();
+    test_catalogue();
+    test_mesh_export();
+    test_connected_move();
+    test_duct_bodies();
+    test_undo_transactions();
+    test_model_changes();
+    test_job_system();
+    test_frame_arena();
+
+    if (g_failures > 0) {
+        std::fprintf(stderr, "%d checks failed\n", g_failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}
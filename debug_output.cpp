@@ -1,4 +1,4 @@
-#include "types.hpp"
+#include "debug_output.hpp"
 
 QDebug &operator<<(QDebug &os, Tool t) {
     switch (t) {
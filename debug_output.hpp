@@ -0,0 +1,10 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <QDebug>
+
+// Model types in qDebug() output. Kept out of types.hpp, which is part of the Qt-free core.
+QDebug &operator<<(QDebug &os, Tool t);
+QDebug &operator<<(QDebug &os, Point p);
+QDebug &operator<<(QDebug &os, Line l);
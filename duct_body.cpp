@@ -0,0 +1,238 @@
+#include "duct_body.hpp"
+
+#include "math.hpp"
+#include "v2.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+// Quantization of duct endpoints into nodes.
+const double NODE_PRECISION = 100.0;
+
+// Mitre is not done for joints sharper than this (cosine of half of the turn angle), the end is
+// left flat instead.
+const double MIN_MITRE_COS = 0.2;
+
+Point far_endpoint(const Duct &d, Point node) {
+    return math::points_distance(d.begin, node) < math::points_distance(d.end, node) ? d.end
+                                                                                     : d.begin;
+}
+
+// Offset of the left corner from the joint point where `arriving` turns into `leaving` (both
+// normalized). Right corner is symmetric.
+std::optional<v2> mitre_offset(v2 arriving, v2 leaving, double half_width) {
+    v2 n1 = normal(arriving);
+    v2 sum = n1 + normal(leaving);
+    if (len2(sum) < 1e-12) {
+        return std::nullopt;
+    }
+    v2 m = normalized(sum);
+    double c = dot(m, n1);
+    if (c < MIN_MITRE_COS) {
+        return std::nullopt;
+    }
+    return m * (half_width / c);
+}
+
+Rect outline_bbox(const DuctBody &body, const Duct &d) {
+    double min_x = body.outline[0].x, max_x = body.outline[0].x;
+    double min_y = body.outline[0].y, max_y = body.outline[0].y;
+    for (auto &p : body.outline) {
+        min_x = std::min(min_x, p.x);
+        max_x = std::max(max_x, p.x);
+        min_y = std::min(min_y, p.y);
+        max_y = std::max(max_y, p.y);
+    }
+    if (body.round_begin || body.round_end) {
+        for (auto p : {d.begin, d.end}) {
+            min_x = std::min(min_x, p.x - body.radius);
+            max_x = std::max(max_x, p.x + body.radius);
+            min_y = std::min(min_y, p.y - body.radius);
+            max_y = std::max(max_y, p.y + body.radius);
+        }
+    }
+    return Rect{min_x, min_y, max_x - min_x, max_y - min_y};
+}
+
+} // namespace
+
+DuctBody make_duct_body(const Duct &d, const Duct *prev, const Duct *next, DuctJoint joint) {
+    DuctBody body;
+    const double half_width = duct_width(d) / 2.0;
+    body.radius = half_width;
+
+    v2 u{d.begin, d.end};
+    u = len2(u) > 1e-12 ? normalized(u) : v2{1.0, 0.0};
+
+    v2 begin_offset = normal(u) * half_width;
+    v2 end_offset = begin_offset;
+
+    if (prev) {
+        v2 arriving{far_endpoint(*prev, d.begin), d.begin};
+        if (joint == DuctJoint::round) {
+            body.round_begin = true;
+        } else if (len2(arriving) > 1e-12) {
+            if (auto m = mitre_offset(normalized(arriving), u, half_width)) {
+                begin_offset = *m;
+            }
+        }
+    }
+
+    if (next) {
+        v2 leaving{d.end, far_endpoint(*next, d.end)};
+        if (joint == DuctJoint::round) {
+            body.round_end = true;
+        } else if (len2(leaving) > 1e-12) {
+            if (auto m = mitre_offset(u, normalized(leaving), half_width)) {
+                end_offset = *m;
+            }
+        }
+    }
+
+    body.outline[0] = d.begin + begin_offset;
+    body.outline[1] = d.end + end_offset;
+    body.outline[2] = d.end - end_offset;
+    body.outline[3] = d.begin - begin_offset;
+    body.bbox = outline_bbox(body, d);
+    return body;
+}
+
+void DuctBodyCache::set_joint_style(DuctJoint joint) {
+    if (m_joint != joint) {
+        m_joint = joint;
+        for (auto &[id, entry] : m_entries) {
+            mark(id);
+        }
+    }
+}
+
+void DuctBodyCache::set_duct(const Duct &d) {
+    auto [it, inserted] = m_entries.try_emplace(d.id);
+    const Duct old = std::exchange(it->second.duct, d);
+    auto same = [](Point a, Point b) { return a.x == b.x && a.y == b.y; };
+    const bool same_ends = !inserted && same(old.begin, d.begin) && same(old.end, d.end);
+    if (same_ends && old.size_mm == d.size_mm) {
+        return;
+    }
+    mark(d.id);
+    if (same_ends) {
+        return;
+    }
+    if (!inserted) {
+        // Joints at the old ends change too, a duct left alone there gets a flat end.
+        detach(old.begin, d.id);
+        detach(old.end, d.id);
+    }
+    attach(d.begin, d.id);
+    attach(d.end, d.id);
+}
+
+void DuctBodyCache::remove(const std::string &id) {
+    auto it = m_entries.find(id);
+    if (it == m_entries.end()) {
+        return;
+    }
+    const Duct d = it->second.duct;
+    m_entries.erase(it);
+    detach(d.begin, id);
+    detach(d.end, id);
+}
+
+void DuctBodyCache::clear() {
+    m_entries.clear();
+    m_nodes.clear();
+    m_dirty.clear();
+}
+
+void DuctBodyCache::model_changed(const ModelChanges &changes) {
+    for (auto &c : changes.ducts) {
+        if (c.kind == ChangeKind::removed) {
+            remove(c.id());
+        } else if (c.touches(ChangedField::geometry | ChangedField::size)) {
+            set_duct(*c.after);
+        }
+    }
+}
+
+size_t DuctBodyCache::sync() {
+    size_t rebuilt = 0;
+    for (auto &id : m_dirty) {
+        auto it = m_entries.find(id);
+        if (it == m_entries.end() || !it->second.dirty) {
+            continue;
+        }
+        Entry &entry = it->second;
+        const Duct &d = entry.duct;
+        entry.body = make_duct_body(d, neighbour(d.begin, id), neighbour(d.end, id), m_joint);
+        entry.built = true;
+        entry.dirty = false;
+        ++rebuilt;
+    }
+    m_dirty.clear();
+    return rebuilt;
+}
+
+const DuctBody *DuctBodyCache::body(const std::string &id) const {
+    auto it = m_entries.find(id);
+    return it != m_entries.end() && it->second.built ? &it->second.body : nullptr;
+}
+
+DuctBodyCache::NodeKey DuctBodyCache::node_key(Point p) {
+    return NodeKey{std::llround(p.x * NODE_PRECISION), std::llround(p.y * NODE_PRECISION)};
+}
+
+void DuctBodyCache::attach(Point p, const std::string &id) {
+    mark_node(p);
+    m_nodes[node_key(p)].push_back(id);
+}
+
+void DuctBodyCache::detach(Point p, const std::string &id) {
+    auto it = m_nodes.find(node_key(p));
+    if (it == m_nodes.end()) {
+        return;
+    }
+    auto &ids = it->second;
+    if (auto found = std::find(ids.begin(), ids.end(), id); found != ids.end()) {
+        ids.erase(found);
+    }
+    if (ids.empty()) {
+        m_nodes.erase(it);
+    } else {
+        mark_node(p);
+    }
+}
+
+void DuctBodyCache::mark(const std::string &id) {
+    auto it = m_entries.find(id);
+    if (it != m_entries.end() && !it->second.dirty) {
+        it->second.dirty = true;
+        m_dirty.push_back(id);
+    }
+}
+
+void DuctBodyCache::mark_node(Point p) {
+    if (auto it = m_nodes.find(node_key(p)); it != m_nodes.end()) {
+        for (auto &id : it->second) {
+            mark(id);
+        }
+    }
+}
+
+const Duct *DuctBodyCache::neighbour(Point p, const std::string &self) const {
+    // Joints are done only between two ducts, for three and more there should be a fitting.
+    auto it = m_nodes.find(node_key(p));
+    if (it == m_nodes.end() || it->second.size() != 2) {
+        return nullptr;
+    }
+    auto &ids = it->second;
+    const std::string &other = ids[0] == self ? ids[1] : ids[0];
+    if (other == self) {
+        return nullptr;
+    }
+    auto entry = m_entries.find(other);
+    return entry != m_entries.end() ? &entry->second.duct : nullptr;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "model_changes.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class DuctJoint { mitre, round };
+
+// Solid body of a duct as it is drawn on the plan: a quad around the duct centerline.
+// Ends connected to exactly one other duct are cut along the bisector of the joint (mitre) so
+// that two legs meet without gaps or overlaps. With round joints ends stay flat and the joint
+// is covered with a disc.
+struct DuctBody {
+    // begin-left, end-left, end-right, begin-right
+    std::array<Point, 4> outline;
+    Rect bbox{0, 0, 0, 0};
+    double radius = 0.0;
+    bool round_begin = false;
+    bool round_end = false;
+};
+
+// Width of the duct body in world units (the model is kept in centimeters).
+inline double duct_width(const Duct &d) { return d.size_mm / 10.0; }
+
+// `prev` is a duct connected to the begin of `d`, `next` is connected to its end, any of them
+// can be null.
+DuctBody make_duct_body(const Duct &d, const Duct *prev, const Duct *next, DuctJoint joint);
+
+// Keeps bodies of ducts by id. Ducts are set one at a time, from the notifier or by whoever edits
+// the model in the middle of a batch, e.g. a drag. Setting a duct marks it and the ducts at its old
+// and new ends, sync() rebuilds only marked bodies, so one moved duct costs the same in any model.
+class DuctBodyCache : public IModelObserver {
+  public:
+    void set_joint_style(DuctJoint joint);
+    DuctJoint joint_style() const { return m_joint; }
+
+    // Adds the duct or replaces its previous state.
+    void set_duct(const Duct &d);
+    void remove(const std::string &id);
+    void clear();
+    // Follows geometry and size of changed ducts.
+    void model_changed(const ModelChanges &changes) override;
+
+    // Rebuilds bodies marked since the last sync, returns their number.
+    size_t sync();
+
+    // Body as of the last sync, null for ducts added since.
+    const DuctBody *body(const std::string &id) const;
+    size_t size() const { return m_entries.size(); }
+
+  private:
+    // Endpoints of connected ducts are copies of the same point, they are still quantized so
+    // that rounding noise does not break connections.
+    struct NodeKey {
+        long long x;
+        long long y;
+        bool operator==(const NodeKey &o) const { return x == o.x && y == o.y; }
+    };
+    struct NodeKeyHash {
+        size_t operator()(const NodeKey &k) const {
+            return std::hash<long long>()(k.x) ^ (std::hash<long long>()(k.y) * 31);
+        }
+    };
+    struct Entry {
+        Duct duct;
+        DuctBody body;
+        bool built = false;
+        bool dirty = false;
+    };
+
+    static NodeKey node_key(Point p);
+    void attach(Point p, const std::string &id);
+    void detach(Point p, const std::string &id);
+    void mark(const std::string &id);
+    void mark_node(Point p);
+    // The other duct at `p` when exactly two ducts meet there.
+    const Duct *neighbour(Point p, const std::string &self) const;
+
+    DuctJoint m_joint = DuctJoint::mitre;
+    std::unordered_map<std::string, Entry> m_entries;
+    // Ducts ending at a node, one with both ends there is listed twice.
+    std::unordered_map<NodeKey, std::vector<std::string>, NodeKeyHash> m_nodes;
+    std::vector<std::string> m_dirty;
+};
@@ -0,0 +1,359 @@
+#include "duct_network.hpp"
+
+#include "math.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+std::array<Point, 2> fitting_endpoints(const Fitting &f) {
+    auto world = [&f](Point local) { return Point(f.center.x + local.x, f.center.y + local.y); };
+    if (auto adapter = std::get_if<Adapter>(&f.fitting_variant)) {
+        return {world(adapter->begin), world(adapter->end)};
+    } else if (auto split = std::get_if<Split3>(&f.fitting_variant)) {
+        return {world(split->begin), world(split->end)};
+    }
+    return {f.center, f.center};
+}
+
+DuctNetwork::DuctNetwork(double tolerance) : m_tolerance(tolerance) {}
+
+void DuctNetwork::add_duct(const Duct &d) {
+    add_element(ElementRef{ElementKind::duct, d.id}, d.begin, d.end);
+}
+
+void DuctNetwork::add_fitting(const Fitting &f) {
+    auto [a, b] = fitting_endpoints(f);
+    add_element(ElementRef{ElementKind::fitting, f.id}, a, b);
+}
+
+void DuctNetwork::update_duct(const Duct &d) {
+    remove(ElementRef{ElementKind::duct, d.id});
+    add_duct(d);
+}
+
+void DuctNetwork::update_fitting(const Fitting &f) {
+    remove(ElementRef{ElementKind::fitting, f.id});
+    add_fitting(f);
+}
+
+void DuctNetwork::remove(const ElementRef &e) {
+    auto idx = find(e);
+    if (!idx) {
+        return;
+    }
+    detach_element(*idx);
+    m_element_index.erase(e);
+    m_elements[*idx] = Element{};
+    m_free_elements.push_back(*idx);
+    ++m_revision;
+    m_components_dirty = true;
+}
+
+void DuctNetwork::clear() {
+    m_nodes.clear();
+    m_free_nodes.clear();
+    m_node_grid.clear();
+    m_elements.clear();
+    m_free_elements.clear();
+    m_element_index.clear();
+    ++m_revision;
+    m_components_dirty = true;
+}
+
+void DuctNetwork::rebuild(const Model &m) {
+    clear();
+    m_elements.reserve(m.ducts.size() + m.fittings.size());
+    for (auto &d : m.ducts) {
+        add_duct(d);
+    }
+    for (auto &f : m.fittings) {
+        add_fitting(f);
+    }
+}
+
+void DuctNetwork::model_changed(const ModelChanges &changes) {
+    for (auto &c : changes.ducts) {
+        if (c.kind == ChangeKind::removed) {
+            remove(ElementRef{ElementKind::duct, c.id()});
+        } else if (c.kind == ChangeKind::added) {
+            add_duct(*c.after);
+        } else if (c.touches(ChangedField::geometry)) {
+            update_duct(*c.after);
+        }
+    }
+    for (auto &c : changes.fittings) {
+        if (c.kind == ChangeKind::removed) {
+            remove(ElementRef{ElementKind::fitting, c.id()});
+        } else if (c.kind == ChangeKind::added) {
+            add_fitting(*c.after);
+        } else if (c.touches(ChangedField::geometry)) {
+            update_fitting(*c.after);
+        }
+    }
+}
+
+bool DuctNetwork::contains(const ElementRef &e) const { return find(e).has_value(); }
+
+std::optional<std::array<DuctNetwork::NodeId, 2>>
+DuctNetwork::element_nodes(const ElementRef &e) const {
+    if (auto idx = find(e)) {
+        return m_elements[*idx].nodes;
+    }
+    return std::nullopt;
+}
+
+std::optional<DuctNetwork::NodeId> DuctNetwork::node_at(Point p) const {
+    const auto c = cell_of(p);
+    for (int64_t dx = -1; dx <= 1; ++dx) {
+        for (int64_t dy = -1; dy <= 1; ++dy) {
+            auto it = m_node_grid.find(CellKey{c.x + dx, c.y + dy});
+            if (it == m_node_grid.end()) {
+                continue;
+            }
+            for (auto n : it->second) {
+                if (math::points_distance(m_nodes[n].pos, p) <= m_tolerance) {
+                    return n;
+                }
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+Point DuctNetwork::node_position(NodeId n) const { return m_nodes[n].pos; }
+
+std::vector<ElementRef> DuctNetwork::node_elements(NodeId n) const {
+    std::vector<ElementRef> result;
+    result.reserve(m_nodes[n].elements.size());
+    for (auto e : m_nodes[n].elements) {
+        result.push_back(m_elements[e].ref);
+    }
+    return result;
+}
+
+size_t DuctNetwork::node_degree(NodeId n) const { return m_nodes[n].elements.size(); }
+
+std::vector<ElementRef> DuctNetwork::neighbours(const ElementRef &e) const {
+    std::vector<ElementRef> result;
+    auto idx = find(e);
+    if (!idx) {
+        return result;
+    }
+    std::vector<ElementIdx> seen{*idx};
+    for (auto n : m_elements[*idx].nodes) {
+        for (auto other : m_nodes[n].elements) {
+            if (std::find(seen.begin(), seen.end(), other) == seen.end()) {
+                seen.push_back(other);
+                result.push_back(m_elements[other].ref);
+            }
+        }
+    }
+    return result;
+}
+
+std::vector<ElementRef> DuctNetwork::run(const ElementRef &e) const {
+    auto start = find(e);
+    if (!start) {
+        return {};
+    }
+
+    // Walks from `from` element through its `node` while the run is not interrupted.
+    auto walk = [this, start](ElementIdx from, NodeId node) {
+        std::vector<ElementIdx> chain;
+        ElementIdx current = from;
+        while (m_nodes[node].elements.size() == 2) {
+            ElementIdx next = other_element(node, current);
+            if (next == *start || next == current) {
+                break; // closed loop
+            }
+            chain.push_back(next);
+            auto &nodes = m_elements[next].nodes;
+            node = nodes[0] == node ? nodes[1] : nodes[0];
+            current = next;
+        }
+        return chain;
+    };
+
+    auto backward = walk(*start, m_elements[*start].nodes[0]);
+    auto forward = walk(*start, m_elements[*start].nodes[1]);
+
+    std::vector<ElementRef> result;
+    result.reserve(backward.size() + forward.size() + 1);
+    for (auto it = backward.rbegin(); it != backward.rend(); ++it) {
+        result.push_back(m_elements[*it].ref);
+    }
+    result.push_back(m_elements[*start].ref);
+    for (auto idx : forward) {
+        if (std::find(backward.begin(), backward.end(), idx) != backward.end()) {
+            break;
+        }
+        result.push_back(m_elements[idx].ref);
+    }
+    return result;
+}
+
+std::vector<ElementRef> DuctNetwork::connected_component(const ElementRef &e) const {
+    std::vector<ElementRef> result;
+    auto start = find(e);
+    if (!start) {
+        return result;
+    }
+
+    std::vector<bool> visited(m_elements.size(), false);
+    std::deque<ElementIdx> queue{*start};
+    visited[*start] = true;
+    while (!queue.empty()) {
+        auto idx = queue.front();
+        queue.pop_front();
+        result.push_back(m_elements[idx].ref);
+        for (auto n : m_elements[idx].nodes) {
+            for (auto other : m_nodes[n].elements) {
+                if (!visited[other]) {
+                    visited[other] = true;
+                    queue.push_back(other);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+std::optional<size_t> DuctNetwork::component_id(const ElementRef &e) const {
+    auto idx = find(e);
+    if (!idx) {
+        return std::nullopt;
+    }
+    label_components();
+    return m_component_of[*idx];
+}
+
+size_t DuctNetwork::component_count() const {
+    label_components();
+    return m_component_count;
+}
+
+void DuctNetwork::add_element(ElementRef ref, Point a, Point b) {
+    if (find(ref)) {
+        return;
+    }
+
+    ElementIdx idx;
+    if (!m_free_elements.empty()) {
+        idx = m_free_elements.back();
+        m_free_elements.pop_back();
+    } else {
+        idx = static_cast<ElementIdx>(m_elements.size());
+        m_elements.emplace_back();
+    }
+
+    auto &element = m_elements[idx];
+    element.ref = std::move(ref);
+    element.alive = true;
+    element.nodes = {acquire_node(a), acquire_node(b)};
+    for (auto n : element.nodes) {
+        auto &elements = m_nodes[n].elements;
+        // Degenerate element with both ends in one node is attached once.
+        if (std::find(elements.begin(), elements.end(), idx) == elements.end()) {
+            elements.push_back(idx);
+        }
+    }
+    m_element_index.emplace(element.ref, idx);
+    ++m_revision;
+    m_components_dirty = true;
+}
+
+void DuctNetwork::detach_element(ElementIdx idx) {
+    for (auto n : m_elements[idx].nodes) {
+        auto &elements = m_nodes[n].elements;
+        elements.erase(std::remove(elements.begin(), elements.end(), idx), elements.end());
+        release_node_if_unused(n);
+    }
+}
+
+DuctNetwork::NodeId DuctNetwork::acquire_node(Point p) {
+    if (auto existing = node_at(p)) {
+        return *existing;
+    }
+
+    NodeId n;
+    if (!m_free_nodes.empty()) {
+        n = m_free_nodes.back();
+        m_free_nodes.pop_back();
+    } else {
+        n = static_cast<NodeId>(m_nodes.size());
+        m_nodes.emplace_back();
+    }
+    m_nodes[n].pos = p;
+    m_nodes[n].alive = true;
+    m_nodes[n].elements.clear();
+    m_node_grid[cell_of(p)].push_back(n);
+    return n;
+}
+
+void DuctNetwork::release_node_if_unused(NodeId n) {
+    auto &node = m_nodes[n];
+    if (!node.alive || !node.elements.empty()) {
+        return;
+    }
+    auto it = m_node_grid.find(cell_of(node.pos));
+    if (it != m_node_grid.end()) {
+        auto &cell = it->second;
+        cell.erase(std::remove(cell.begin(), cell.end(), n), cell.end());
+        if (cell.empty()) {
+            m_node_grid.erase(it);
+        }
+    }
+    node.alive = false;
+    m_free_nodes.push_back(n);
+}
+
+DuctNetwork::CellKey DuctNetwork::cell_of(Point p) const {
+    return CellKey{static_cast<int64_t>(std::floor(p.x / m_tolerance)),
+                   static_cast<int64_t>(std::floor(p.y / m_tolerance))};
+}
+
+std::optional<DuctNetwork::ElementIdx> DuctNetwork::find(const ElementRef &e) const {
+    auto it = m_element_index.find(e);
+    if (it == m_element_index.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+DuctNetwork::ElementIdx DuctNetwork::other_element(NodeId n, ElementIdx e) const {
+    auto &elements = m_nodes[n].elements;
+    return elements[0] == e ? elements[1] : elements[0];
+}
+
+void DuctNetwork::label_components() const {
+    if (!m_components_dirty) {
+        return;
+    }
+    constexpr size_t unlabelled = static_cast<size_t>(-1);
+    m_component_of.assign(m_elements.size(), unlabelled);
+    m_component_count = 0;
+
+    std::vector<ElementIdx> stack;
+    for (ElementIdx i = 0; i < m_elements.size(); ++i) {
+        if (!m_elements[i].alive || m_component_of[i] != unlabelled) {
+            continue;
+        }
+        const size_t label = m_component_count++;
+        m_component_of[i] = label;
+        stack.push_back(i);
+        while (!stack.empty()) {
+            auto idx = stack.back();
+            stack.pop_back();
+            for (auto n : m_elements[idx].nodes) {
+                for (auto other : m_nodes[n].elements) {
+                    if (m_component_of[other] == unlabelled) {
+                        m_component_of[other] = label;
+                        stack.push_back(other);
+                    }
+                }
+            }
+        }
+    }
+    m_components_dirty = false;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "model_changes.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class ElementKind { duct, fitting };
+
+// Refers to a duct or fitting of the model by its id.
+struct ElementRef {
+    ElementKind kind = ElementKind::duct;
+    std::string id;
+
+    bool operator==(const ElementRef &o) const { return kind == o.kind && id == o.id; }
+    bool operator!=(const ElementRef &o) const { return !(*this == o); }
+};
+
+struct ElementRefHash {
+    size_t operator()(const ElementRef &r) const {
+        return std::hash<std::string>()(r.id) ^ static_cast<size_t>(r.kind);
+    }
+};
+
+// Connection points of a fitting in world coordinates. Fitting geometry is kept relative to its
+// center.
+std::array<Point, 2> fitting_endpoints(const Fitting &f);
+
+// Connectivity graph of the duct network. Nodes are connection points, every duct and fitting is
+// an edge between two nodes. Endpoints closer than tolerance are considered connected.
+//
+// The graph is maintained incrementally: adding, updating or removing an element touches only
+// its own nodes, lookup of a node by position is done through a hash grid.
+class DuctNetwork : public IModelObserver {
+  public:
+    using NodeId = uint32_t;
+
+    explicit DuctNetwork(double tolerance = 0.5);
+
+    void add_duct(const Duct &d);
+    void add_fitting(const Fitting &f);
+    // Element moved, resized or otherwise changed, connections are recalculated.
+    void update_duct(const Duct &d);
+    void update_fitting(const Fitting &f);
+    void remove(const ElementRef &e);
+
+    void clear();
+    void rebuild(const Model &m);
+    // Follows geometry of changed ducts and fittings.
+    void model_changed(const ModelChanges &changes) override;
+
+    bool contains(const ElementRef &e) const;
+    size_t element_count() const { return m_element_index.size(); }
+
+    // Incremented on every modification, can be used to invalidate derived data.
+    uint64_t revision() const { return m_revision; }
+
+    // Both nodes of an element, nullopt if there is no such element.
+    std::optional<std::array<NodeId, 2>> element_nodes(const ElementRef &e) const;
+    std::optional<NodeId> node_at(Point p) const;
+    Point node_position(NodeId n) const;
+    std::vector<ElementRef> node_elements(NodeId n) const;
+    size_t node_degree(NodeId n) const;
+
+    // Elements sharing a node with `e`.
+    std::vector<ElementRef> neighbours(const ElementRef &e) const;
+
+    // Chain of elements containing `e` which is not interrupted by branches: continues through
+    // nodes where exactly two elements meet. Ordered from one end of the run to another.
+    std::vector<ElementRef> run(const ElementRef &e) const;
+
+    // All elements reachable from `e`.
+    std::vector<ElementRef> connected_component(const ElementRef &e) const;
+
+    // Components are labelled lazily after modifications, labels are valid until the next one.
+    std::optional<size_t> component_id(const ElementRef &e) const;
+    size_t component_count() const;
+
+  private:
+    using ElementIdx = uint32_t;
+
+    struct Node {
+        Point pos;
+        std::vector<ElementIdx> elements;
+        bool alive = false;
+    };
+
+    struct Element {
+        ElementRef ref;
+        std::array<NodeId, 2> nodes{};
+        bool alive = false;
+    };
+
+    struct CellKey {
+        int64_t x;
+        int64_t y;
+        bool operator==(const CellKey &o) const { return x == o.x && y == o.y; }
+    };
+    struct CellKeyHash {
+        size_t operator()(const CellKey &k) const {
+            return std::hash<int64_t>()(k.x) ^ (std::hash<int64_t>()(k.y) * 31);
+        }
+    };
+
+    void add_element(ElementRef ref, Point a, Point b);
+    void detach_element(ElementIdx idx);
+    NodeId acquire_node(Point p);
+    void release_node_if_unused(NodeId n);
+    CellKey cell_of(Point p) const;
+    std::optional<ElementIdx> find(const ElementRef &e) const;
+    ElementIdx other_element(NodeId n, ElementIdx e) const;
+    void label_components() const;
+
+    double m_tolerance;
+    uint64_t m_revision = 0;
+
+    std::vector<Node> m_nodes;
+    std::vector<NodeId> m_free_nodes;
+    std::unordered_map<CellKey, std::vector<NodeId>, CellKeyHash> m_node_grid;
+
+    std::vector<Element> m_elements;
+    std::vector<ElementIdx> m_free_elements;
+    std::unordered_map<ElementRef, ElementIdx, ElementRefHash> m_element_index;
+
+    mutable bool m_components_dirty = true;
+    mutable std::vector<size_t> m_component_of;
+    mutable size_t m_component_count = 0;
+};
@@ -0,0 +1,457 @@
+#include "duct_router.hpp"
+
+#include "duct_rules.hpp"
+#include "math.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <queue>
+#include <unordered_set>
+
+namespace {
+const int HEADINGS = static_cast<int>(360.0 / duct_rules::HEADING_STEP_DEGREES);
+const uint32_t NO_PARENT = static_cast<uint32_t>(-1);
+const double OBSTACLE_CELL_SIZE = 200.0;
+// Goal is reached by a single leg when it is off the leg direction by less than this.
+const double SNAP_TOLERANCE = 0.5;
+// Direct shots to the goal are tried on every this expansion, and on every one near the goal.
+const size_t SHOT_INTERVAL = 8;
+const double SHOT_ALWAYS_DISTANCE_STEPS = 8.0;
+// Kept off the clearance an end already has, so that leaving it parallel to a wall is no hit.
+const double END_CLEARANCE_SLACK = 1e-6;
+
+struct StateKey {
+    int64_t x;
+    int64_t y;
+    int heading;
+    bool operator==(const StateKey &o) const {
+        return x == o.x && y == o.y && heading == o.heading;
+    }
+};
+
+struct StateKeyHash {
+    size_t operator()(const StateKey &k) const {
+        return (std::hash<int64_t>()(k.x) ^ (std::hash<int64_t>()(k.y) * 31)) * HEADINGS +
+               k.heading;
+    }
+};
+
+Rect normalized_rect(const Rect &r) {
+    return Rect{std::min(r.x, r.x + r.width), std::min(r.y, r.y + r.height), std::fabs(r.width),
+                std::fabs(r.height)};
+}
+
+Rect inflated(const Rect &r, double margin) {
+    return Rect{r.x - margin, r.y - margin, r.width + 2 * margin, r.height + 2 * margin};
+}
+
+Rect segment_bounds(Point a, Point b) {
+    return Rect{std::min(a.x, b.x), std::min(a.y, b.y), std::fabs(b.x - a.x),
+                std::fabs(b.y - a.y)};
+}
+
+double point_segment_distance(Point p, Point a, Point b) {
+    v2 ab{a, b};
+    v2 ap{a, p};
+    const double l2 = len2(ab);
+    if (l2 == 0.0) {
+        return len(ap);
+    }
+    const double t = std::clamp(dot(ap, ab) / l2, 0.0, 1.0);
+    return len(ap - ab * t);
+}
+
+double point_rect_distance(Point p, const Rect &r) {
+    const double dx = std::max({r.x - p.x, 0.0, p.x - (r.x + r.width)});
+    const double dy = std::max({r.y - p.y, 0.0, p.y - (r.y + r.height)});
+    return std::hypot(dx, dy);
+}
+
+bool segments_intersect(Point a, Point b, Point c, Point d) {
+    const double d1 = cross2d(v2{c, d}, v2{c, a});
+    const double d2 = cross2d(v2{c, d}, v2{c, b});
+    const double d3 = cross2d(v2{a, b}, v2{a, c});
+    const double d4 = cross2d(v2{a, b}, v2{a, d});
+    return ((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) &&
+           ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0));
+}
+
+double segments_distance(Point a, Point b, Point c, Point d) {
+    if (segments_intersect(a, b, c, d)) {
+        return 0.0;
+    }
+    return std::min({point_segment_distance(a, c, d), point_segment_distance(b, c, d),
+                     point_segment_distance(c, a, b), point_segment_distance(d, a, b)});
+}
+
+// Liang-Barsky clipping of segment by the rect.
+bool segment_hits_rect(Point a, Point b, const Rect &r) {
+    const double dx = b.x - a.x;
+    const double dy = b.y - a.y;
+    double t0 = 0.0;
+    double t1 = 1.0;
+    auto clip = [&](double p, double q) {
+        if (p == 0.0) {
+            return q >= 0.0;
+        }
+        const double t = q / p;
+        if (p < 0.0) {
+            if (t > t1) {
+                return false;
+            }
+            t0 = std::max(t0, t);
+        } else {
+            if (t < t0) {
+                return false;
+            }
+            t1 = std::min(t1, t);
+        }
+        return true;
+    };
+    return clip(-dx, a.x - r.x) && clip(dx, r.x + r.width - a.x) && clip(-dy, a.y - r.y) &&
+           clip(dy, r.y + r.height - a.y);
+}
+
+bool collinear_continuation(Point a, Point b, Point c) {
+    v2 u{a, b};
+    v2 v{b, c};
+    return std::fabs(cross2d(u, v)) <= 1e-9 * len(u) * len(v) + 1e-12 && dot(u, v) > 0.0;
+}
+} // namespace
+
+DuctRouter::DuctRouter(RouterSettings settings) : m_settings(settings) {}
+
+void DuctRouter::set_obstacles(const Model &m) {
+    clear_obstacles();
+    m_obstacles.reserve(m.rects.size() + m.lines.size());
+    for (auto &r : m.rects) {
+        add_obstacle(r.rect);
+    }
+    for (auto &l : m.lines) {
+        add_obstacle(l.l);
+    }
+}
+
+void DuctRouter::add_obstacle(const Rect &r) {
+    Obstacle o;
+    o.is_rect = true;
+    o.rect = normalized_rect(r);
+    o.bbox = o.rect;
+    insert_obstacle(o);
+}
+
+void DuctRouter::add_obstacle(const Line &wall) {
+    Obstacle o;
+    o.line = wall;
+    o.bbox = segment_bounds(wall.a, wall.b);
+    insert_obstacle(o);
+}
+
+void DuctRouter::clear_obstacles() {
+    m_obstacles.clear();
+    m_obstacle_grid.clear();
+}
+
+void DuctRouter::insert_obstacle(Obstacle o) {
+    const auto idx = static_cast<uint32_t>(m_obstacles.size());
+    const auto lo = cell_of(o.bbox.upper_left_corner());
+    const auto hi = cell_of(o.bbox.bottom_right_corner());
+    for (int64_t x = lo.x; x <= hi.x; ++x) {
+        for (int64_t y = lo.y; y <= hi.y; ++y) {
+            m_obstacle_grid[CellKey{x, y}].push_back(idx);
+        }
+    }
+    m_obstacles.push_back(o);
+}
+
+bool DuctRouter::obstacle_hit(const Obstacle &o, Point a, Point b, double margin) const {
+    if (o.is_rect) {
+        return segment_hits_rect(a, b, inflated(o.rect, margin));
+    }
+    if (margin <= 0.0) {
+        // Wall through an end, the route may leave along it but not cross it.
+        return segments_intersect(a, b, o.line.a, o.line.b);
+    }
+    return segments_distance(a, b, o.line.a, o.line.b) < margin;
+}
+
+bool DuctRouter::collides(Point a, Point b, double margin) const {
+    ++m_test_stamp;
+    const Rect area = inflated(segment_bounds(a, b), margin);
+    const auto lo = cell_of(area.upper_left_corner());
+    const auto hi = cell_of(area.bottom_right_corner());
+    // Long segments cross only a thin diagonal of their bounds, so every row of cells is limited
+    // to the part the inflated segment actually passes.
+    const double dy = b.y - a.y;
+    for (int64_t y = lo.y; y <= hi.y; ++y) {
+        double x_min = area.x;
+        double x_max = area.x + area.width;
+        if (dy != 0.0) {
+            double t0 = (y * OBSTACLE_CELL_SIZE - margin - a.y) / dy;
+            double t1 = ((y + 1) * OBSTACLE_CELL_SIZE + margin - a.y) / dy;
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+            t0 = std::clamp(t0, 0.0, 1.0);
+            t1 = std::clamp(t1, 0.0, 1.0);
+            const double xa = a.x + (b.x - a.x) * t0;
+            const double xb = a.x + (b.x - a.x) * t1;
+            x_min = std::min(xa, xb) - margin;
+            x_max = std::max(xa, xb) + margin;
+        }
+        const auto row_lo = cell_of(Point(x_min, 0.0)).x;
+        const auto row_hi = cell_of(Point(x_max, 0.0)).x;
+        for (int64_t x = row_lo; x <= row_hi; ++x) {
+            auto it = m_obstacle_grid.find(CellKey{x, y});
+            if (it == m_obstacle_grid.end()) {
+                continue;
+            }
+            for (auto idx : it->second) {
+                if (m_margin_limit[idx] < 0.0 || m_tested[idx] == m_test_stamp) {
+                    continue;
+                }
+                m_tested[idx] = m_test_stamp;
+                auto &o = m_obstacles[idx];
+                if (o.bbox.intersects(area) &&
+                    obstacle_hit(o, a, b, std::min(margin, m_margin_limit[idx]))) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+DuctRouter::CellKey DuctRouter::cell_of(Point p) const {
+    return CellKey{static_cast<int64_t>(std::floor(p.x / OBSTACLE_CELL_SIZE)),
+                   static_cast<int64_t>(std::floor(p.y / OBSTACLE_CELL_SIZE))};
+}
+
+std::optional<std::vector<Point>> DuctRouter::route(const RouteEnd &start, const RouteEnd &goal,
+                                                    double duct_width) {
+    m_last_expansions = 0;
+    const double margin = duct_width / 2.0 + m_settings.clearance;
+    const double step = m_settings.step;
+    const double fitting_cost = m_settings.fitting_cost;
+
+    m_margin_limit.assign(m_obstacles.size(), margin);
+    m_tested.assign(m_obstacles.size(), 0);
+    m_test_stamp = 0;
+    for (size_t i = 0; i < m_obstacles.size(); ++i) {
+        auto &o = m_obstacles[i];
+        for (auto p : {start.pos, goal.pos}) {
+            const double d = o.is_rect ? point_rect_distance(p, o.rect)
+                                       : point_segment_distance(p, o.line.a, o.line.b);
+            if (d >= margin) {
+                continue;
+            }
+            if (o.is_rect && d <= END_CLEARANCE_SLACK) {
+                m_margin_limit[i] = -1.0;
+                break;
+            }
+            const double kept = std::max(d - END_CLEARANCE_SLACK, 0.0);
+            m_margin_limit[i] = std::min(m_margin_limit[i], kept);
+        }
+    }
+
+    // Headings are counted from direction of the start, or from direction of the goal if start is
+    // free so that the route can enter it. Two free ends are aligned with each other.
+    v2 base = start.direction   ? *start.direction
+              : goal.direction ? *goal.direction
+                               : v2{start.pos, goal.pos};
+    if (len2(base) == 0.0) {
+        base = v2{1.0, 0.0};
+    }
+    const double base_angle = std::atan2(base.y, base.x);
+    std::array<v2, HEADINGS> directions;
+    for (int k = 0; k < HEADINGS; ++k) {
+        const double angle = base_angle + k * duct_rules::HEADING_STEP_DEGREES * M_PI / 180.0;
+        directions[k] = v2{std::cos(angle), std::sin(angle)};
+    }
+
+    std::vector<int> turns;
+    for (auto alpha : duct_rules::TURN_ANGLES_DEGREES) {
+        const int n = static_cast<int>(std::lround(alpha / duct_rules::HEADING_STEP_DEGREES));
+        turns.push_back(n);
+        if (n != 0) {
+            turns.push_back(-n);
+        }
+    }
+    auto turned = [](int heading, int turn) { return (heading + turn + HEADINGS) % HEADINGS; };
+
+    // Headings in which the goal can be entered and cost of the fitting needed there.
+    std::array<std::optional<double>, HEADINGS> arrival_cost;
+    for (int k = 0; k < HEADINGS; ++k) {
+        if (!goal.direction) {
+            arrival_cost[k] = 0.0;
+            continue;
+        }
+        const double theta =
+            math::angle_between_vectors(directions[k], *goal.direction) * 180.0 / M_PI;
+        if (duct_rules::is_allowed_turn(theta)) {
+            const bool straight = theta < duct_rules::TURN_ANGLE_TOLERANCE_DEGREES ||
+                                  theta > 360.0 - duct_rules::TURN_ANGLE_TOLERANCE_DEGREES;
+            arrival_cost[k] = straight ? 0.0 : fitting_cost;
+        }
+    }
+
+    struct Node {
+        Point pos;
+        int heading = 0;
+        double cost = 0.0;
+        uint32_t parent = NO_PARENT;
+        std::optional<Point> corner; // goal nodes reached by two legs
+        bool at_goal = false;
+    };
+    std::vector<Node> nodes;
+    using Entry = std::pair<double, uint32_t>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+    std::unordered_set<StateKey, StateKeyHash> closed;
+    std::unordered_map<StateKey, double, StateKeyHash> best_cost;
+
+    auto state_of = [step](Point p, int heading) {
+        return StateKey{static_cast<int64_t>(std::floor(p.x / step)),
+                        static_cast<int64_t>(std::floor(p.y / step)), heading};
+    };
+    // Remaining length plus the fitting which is needed unless the goal is straight ahead.
+    auto heuristic = [&](Point p, int heading) {
+        const v2 w{p, goal.pos};
+        const v2 d = directions[heading];
+        const bool ahead = dot(w, d) > 0.0 && std::fabs(cross2d(d, w)) < SNAP_TOLERANCE;
+        const double turns_cost =
+            ahead && arrival_cost[heading] ? *arrival_cost[heading] : fitting_cost;
+        return len(w) + turns_cost;
+    };
+    double best_goal_cost = INFINITY;
+    auto push = [&](Node n) {
+        const double f =
+            n.at_goal ? n.cost
+                      : n.cost + m_settings.heuristic_weight * heuristic(n.pos, n.heading);
+        nodes.push_back(std::move(n));
+        open.emplace(f, static_cast<uint32_t>(nodes.size() - 1));
+    };
+
+    if (start.direction) {
+        push(Node{start.pos, 0, 0.0, NO_PARENT, std::nullopt, false});
+    } else {
+        for (int k = 0; k < HEADINGS; ++k) {
+            push(Node{start.pos, k, 0.0, NO_PARENT, std::nullopt, false});
+        }
+    }
+
+    // Tries to reach the goal from the node with one leg or with two legs and a turn between them.
+    struct Shot {
+        double cost;
+        int heading;
+        std::optional<Point> corner;
+    };
+    std::vector<Shot> shots;
+    auto try_shot = [&](const Node &node, uint32_t idx) {
+        shots.clear();
+        const v2 w{node.pos, goal.pos};
+        for (auto t1 : turns) {
+            const int k1 = turned(node.heading, t1);
+            const v2 d1 = directions[k1];
+            const double cost = node.cost + (t1 != 0 ? fitting_cost : 0.0);
+
+            const double along = dot(w, d1);
+            if (arrival_cost[k1] && along > 0.0 && std::fabs(cross2d(d1, w)) < SNAP_TOLERANCE) {
+                shots.push_back(Shot{cost + along + *arrival_cost[k1], k1, std::nullopt});
+            }
+
+            for (auto t2 : turns) {
+                const int k2 = turned(k1, t2);
+                if (t2 == 0 || !arrival_cost[k2]) {
+                    continue;
+                }
+                const v2 d2 = directions[k2];
+                const double det = cross2d(d1, d2);
+                const double a = cross2d(w, d2) / det;
+                const double b = cross2d(d1, w) / det;
+                if (a < step / 2.0 || b < step / 2.0) {
+                    continue;
+                }
+                shots.push_back(Shot{cost + a + fitting_cost + b + *arrival_cost[k2], k2,
+                                     Point(node.pos + d1 * a)});
+            }
+        }
+        std::sort(shots.begin(), shots.end(),
+                  [](const Shot &x, const Shot &y) { return x.cost < y.cost; });
+        for (auto &s : shots) {
+            if (s.cost >= best_goal_cost) {
+                return;
+            }
+            Point from = node.pos;
+            if (s.corner) {
+                if (collides(from, *s.corner, margin)) {
+                    continue;
+                }
+                from = *s.corner;
+            }
+            if (!collides(from, goal.pos, margin)) {
+                best_goal_cost = s.cost;
+                push(Node{goal.pos, s.heading, s.cost, idx, s.corner, true});
+                return;
+            }
+        }
+    };
+
+    while (!open.empty()) {
+        const uint32_t idx = open.top().second;
+        open.pop();
+        const Node node = nodes[idx];
+
+        if (node.at_goal) {
+            std::vector<Point> reversed;
+            for (uint32_t i = idx; i != NO_PARENT; i = nodes[i].parent) {
+                reversed.push_back(nodes[i].pos);
+                if (nodes[i].corner) {
+                    reversed.push_back(*nodes[i].corner);
+                }
+            }
+            std::vector<Point> path;
+            for (auto it = reversed.rbegin(); it != reversed.rend(); ++it) {
+                if (path.size() >= 2 &&
+                    collinear_continuation(path[path.size() - 2], path.back(), *it)) {
+                    path.back() = *it;
+                } else {
+                    path.push_back(*it);
+                }
+            }
+            return path;
+        }
+
+        if (!closed.insert(state_of(node.pos, node.heading)).second) {
+            continue;
+        }
+        if (++m_last_expansions > m_settings.max_expansions) {
+            break;
+        }
+
+        if (m_last_expansions % SHOT_INTERVAL == 1 ||
+            math::points_distance(node.pos, goal.pos) < SHOT_ALWAYS_DISTANCE_STEPS * step) {
+            try_shot(node, idx);
+        }
+
+        for (auto t : turns) {
+            const int k = turned(node.heading, t);
+            const Point next = node.pos + directions[k] * step;
+            const auto key = state_of(next, k);
+            if (closed.count(key)) {
+                continue;
+            }
+            const double cost = node.cost + step + (t != 0 ? fitting_cost : 0.0);
+            auto it = best_cost.find(key);
+            if (it != best_cost.end() && it->second <= cost) {
+                continue;
+            }
+            if (collides(node.pos, next, margin)) {
+                continue;
+            }
+            best_cost[key] = cost;
+            push(Node{next, k, cost, idx, std::nullopt, false});
+        }
+    }
+    return std::nullopt;
+}
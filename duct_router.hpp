@@ -0,0 +1,95 @@
+#pragma once
+
+#include "types.hpp"
+#include "v2.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// Start or goal of a route.
+struct RouteEnd {
+    Point pos;
+    // Direction of travel through this end: for the start it is direction of the duct the route
+    // continues, for the goal direction of the duct the route runs into. Unset for free ends.
+    std::optional<v2> direction;
+};
+
+struct RouterSettings {
+    double step = 25.0;          // world units, length of one search move
+    double clearance = 10.0;     // kept between duct surface and obstacles
+    double fitting_cost = 150.0; // every turn costs as much as this length of straight duct
+    // Above 1 search prefers states closer to the goal: routes may get up to this times more
+    // expensive than optimal but are found much faster.
+    double heuristic_weight = 1.5;
+    size_t max_expansions = 100'000;
+};
+
+// Finds duct runs between two points which turn only by angles allowed by duct_rules and keep
+// clear of rects and walls.
+//
+// Search is A* over (position, heading) states: headings are multiples of 15 degrees from the
+// start direction, every move is a turn allowed for a duct followed by one step straight ahead.
+// Visited states are merged per grid cell and heading. From every expanded state the goal is
+// also tried directly with one or two legs, which is what lands the route exactly on the goal.
+// Cost is duct length plus fitting_cost per turn.
+class DuctRouter {
+  public:
+    explicit DuctRouter(RouterSettings settings = {});
+
+    // Rects and lines of the model become obstacles.
+    void set_obstacles(const Model &m);
+    void add_obstacle(const Rect &r);
+    void add_obstacle(const Line &wall);
+    void clear_obstacles();
+
+    // Polyline from start to goal including both of them, nullopt if there is no route or search
+    // gave up. Routes can start and end right at walls: an obstacle closer to start or goal than
+    // required clearance only has to be kept as far as the end already is from it, and a rect
+    // containing an end is not an obstacle at all.
+    std::optional<std::vector<Point>> route(const RouteEnd &start, const RouteEnd &goal,
+                                            double duct_width);
+
+    const RouterSettings &settings() const { return m_settings; }
+    size_t last_expansions() const { return m_last_expansions; }
+
+  private:
+    struct Obstacle {
+        bool is_rect = false;
+        Rect rect{0, 0, 0, 0};
+        Line line;
+        Rect bbox{0, 0, 0, 0};
+    };
+
+    struct CellKey {
+        int64_t x;
+        int64_t y;
+        bool operator==(const CellKey &o) const { return x == o.x && y == o.y; }
+    };
+    struct CellKeyHash {
+        size_t operator()(const CellKey &k) const {
+            return std::hash<int64_t>()(k.x) ^ (std::hash<int64_t>()(k.y) * 31);
+        }
+    };
+
+    void insert_obstacle(Obstacle o);
+    bool obstacle_hit(const Obstacle &o, Point a, Point b, double margin) const;
+    // Whether segment comes closer than margin to any obstacle which is not ignored.
+    bool collides(Point a, Point b, double margin) const;
+    CellKey cell_of(Point p) const;
+
+    RouterSettings m_settings;
+
+    std::vector<Obstacle> m_obstacles;
+    std::unordered_map<CellKey, std::vector<uint32_t>, CellKeyHash> m_obstacle_grid;
+
+    // Per query state of obstacles: clearance they are kept at, below the required one for those
+    // near start or goal and negative for ignored ones, and stamp of last query which tested them,
+    // so that obstacles spanning several cells are tested once.
+    std::vector<double> m_margin_limit;
+    mutable std::vector<uint32_t> m_tested;
+    mutable uint32_t m_test_stamp = 0;
+
+    size_t m_last_expansions = 0;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+
+// Rules which duct geometry must follow to be buildable from catalogue parts.
+namespace duct_rules {
+
+// Adjacent legs of a run can meet only at angles for which there are fittings (0 means straight
+// continuation): https://vents-shop.com.ua/povitrovodi-uk/fasonni-virobi-uk
+inline constexpr std::array<double, 4> TURN_ANGLES_DEGREES = {0.0, 45.0, 60.0, 90.0};
+inline constexpr double TURN_ANGLE_TOLERANCE_DEGREES = 3.0;
+
+// Every sequence of allowed turns changes direction by a multiple of this.
+inline constexpr double HEADING_STEP_DEGREES = 15.0;
+
+// `theta` is angle between directions of adjacent legs in degrees, [0, 360).
+inline bool is_allowed_turn(double theta) {
+    for (auto alpha : TURN_ANGLES_DEGREES) {
+        if (std::fabs(theta - alpha) < TURN_ANGLE_TOLERANCE_DEGREES ||
+            std::fabs(theta - (360.0 - alpha)) < TURN_ANGLE_TOLERANCE_DEGREES) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace duct_rules
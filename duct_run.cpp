@@ -0,0 +1,55 @@
+#include "duct_run.hpp"
+
+#include "duct_rules.hpp"
+#include "math.hpp"
+#include "snap_engine.hpp"
+
+#include <cmath>
+#include <limits>
+
+namespace {
+// Directions of next leg of a duct run, relative to the previous one.
+const DirectionTable LegDirections;
+} // namespace
+
+bool can_continue_duct_run(const std::vector<Point> &points, Point x) {
+    if (points.size() < 2) {
+        return true;
+    }
+    const v2 u{points[points.size() - 2], points.back()};
+    const v2 v{points.back(), x};
+    return duct_rules::is_allowed_turn(math::angle_between_vectors(u, v) / M_PI * 180.0);
+}
+
+std::pmr::vector<Point> duct_run_continuations(const std::vector<Point> &points, double length,
+                                               std::pmr::memory_resource *memory) {
+    std::pmr::vector<Point> result(memory);
+    if (points.size() < 2) {
+        return result;
+    }
+
+    const v2 u{points[points.size() - 2], points.back()};
+    result.reserve(DirectionTable::SIZE);
+    for (auto d : LegDirections.rotated(normalized(u) * length)) {
+        result.push_back(v2(points.back()) + d);
+    }
+    return result;
+}
+
+Point snap_to_duct_run_continuation(const std::vector<Point> &points, Point x, double length) {
+    if (points.size() < 2) {
+        return x;
+    }
+    const v2 u{points[points.size() - 2], points.back()};
+    Point closest = x;
+    double min_dist = std::numeric_limits<double>::infinity();
+    for (auto leg : LegDirections.rotated(normalized(u) * length)) {
+        const Point p = math::closest_point_to_line(points.back(), v2(points.back()) + leg, x);
+        const double d = len2(v2(x, p));
+        if (d < min_dist) {
+            min_dist = d;
+            closest = p;
+        }
+    }
+    return closest;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <memory_resource>
+#include <vector>
+
+// Rules for drawing a duct run leg by leg, `points` are the run drawn so far. Legs may only turn
+// by duct_rules angles, so until the run has two points any next point goes.
+
+// Whether the run may continue from its last point to `x`.
+bool can_continue_duct_run(const std::vector<Point> &points, Point x);
+
+// Ends of `length` long legs from the last point in every allowed direction.
+std::pmr::vector<Point>
+duct_run_continuations(const std::vector<Point> &points, double length,
+                       std::pmr::memory_resource *memory = std::pmr::get_default_resource());
+
+// `x` moved onto the closest leg of duct_run_continuations, allocates nothing.
+Point snap_to_duct_run_continuation(const std::vector<Point> &points, Point x, double length);
@@ -0,0 +1,223 @@
+#include "duct_sizing.hpp"
+
+#include "math.hpp"
+
+#include <cmath>
+#include <deque>
+#include <unordered_map>
+
+namespace {
+const double SECONDS_PER_HOUR = 3600.0;
+
+double world_to_m(double x) { return x / 100.0; }
+double circle_area(double d) { return M_PI * d * d / 4.0; }
+
+// Duct or fitting on the way of air, in the tree spanning the network from its sources.
+struct Section {
+    ElementRef ref;
+    const Duct *duct = nullptr; // null for fittings
+    double flow_m3s = 0.0;
+    DuctNetwork::NodeId upstream = 0;
+    DuctNetwork::NodeId downstream = 0;
+    std::vector<uint32_t> children;
+};
+
+class Sizer {
+  public:
+    Sizer(const std::vector<Section> &sections, const SizingSettings &settings,
+          const AirflowSettings &air, std::vector<SizedDuct> &result, JobSystem *jobs,
+          const Job *job)
+        : m_sections(sections), m_settings(settings), m_air(air), m_result(result), m_jobs(jobs),
+          m_job(job) {}
+
+    void size(const std::vector<uint32_t> &roots) { size_all(roots, 0.0); }
+
+  private:
+    // Sizes section `i` and everything below it. A run is followed on this thread, branches of a
+    // fork become tasks.
+    void size_from(uint32_t i, double upstream_velocity) {
+        while (true) {
+            if (m_job) {
+                m_job->throw_if_cancelled();
+            }
+            auto &section = m_sections[i];
+            double velocity = upstream_velocity;
+            if (section.duct && section.flow_m3s > 0.0) {
+                velocity = size_duct(i, upstream_velocity);
+            }
+            if (section.children.size() != 1) {
+                size_all(section.children, velocity);
+                return;
+            }
+            i = section.children.front();
+            upstream_velocity = velocity;
+        }
+    }
+
+    void size_all(const std::vector<uint32_t> &sections, double upstream_velocity) {
+        if (m_jobs && sections.size() > 1) {
+            m_jobs->parallel_for(sections.size(), [&](size_t k) {
+                size_from(sections[k], upstream_velocity);
+            });
+            return;
+        }
+        for (auto i : sections) {
+            size_from(i, upstream_velocity);
+        }
+    }
+
+    // Returns velocity in the duct with its new size.
+    double size_duct(uint32_t i, double upstream_velocity) {
+        auto &section = m_sections[i];
+        const double length_m = world_to_m(math::points_distance(section.duct->begin,
+                                                                 section.duct->end));
+        auto &sized = m_result[i];
+        for (size_t k = 0; k < m_settings.sizes_mm.size(); ++k) {
+            const unsigned size_mm = m_settings.sizes_mm[k];
+            const double d = size_mm / 1000.0;
+            const double velocity = section.flow_m3s / circle_area(d);
+            const double friction = friction_factor(velocity, d, m_air) / d *
+                                    m_air.air_density * velocity * velocity / 2.0;
+
+            const bool largest = k + 1 == m_settings.sizes_mm.size();
+            if (!largest && !fits(velocity, friction, length_m, upstream_velocity)) {
+                continue;
+            }
+            sized.proposed_mm = size_mm;
+            sized.velocity_ms = velocity;
+            sized.friction_pa_m = friction;
+            return velocity;
+        }
+        return upstream_velocity;
+    }
+
+    bool fits(double velocity, double friction_pa_m, double length_m,
+              double upstream_velocity) const {
+        if (velocity > m_settings.max_velocity_ms) {
+            return false;
+        }
+        switch (m_settings.method) {
+        case SizingMethod::velocity:
+            return true;
+        case SizingMethod::equal_friction:
+            return friction_pa_m <= m_settings.friction_rate_pa_m;
+        case SizingMethod::static_regain: {
+            if (upstream_velocity <= 0.0) {
+                return true; // section leaving the source is sized by velocity
+            }
+            const double regain = m_settings.regain_coefficient * m_air.air_density / 2.0 *
+                                  (upstream_velocity * upstream_velocity - velocity * velocity);
+            return regain >= friction_pa_m * length_m;
+        }
+        }
+        return true;
+    }
+
+    const std::vector<Section> &m_sections;
+    const SizingSettings &m_settings;
+    const AirflowSettings &m_air;
+    std::vector<SizedDuct> &m_result; // by section, every task writes its own sections only
+    JobSystem *m_jobs;
+    const Job *m_job;
+};
+} // namespace
+
+std::vector<unsigned> duct_sizes(const Catalogue &c) {
+    std::vector<unsigned> sizes;
+    for (auto &r : c.parts(PartType::duct)) {
+        if (sizes.empty() || sizes.back() != r.d1_mm) {
+            sizes.push_back(r.d1_mm);
+        }
+    }
+    return sizes;
+}
+
+std::vector<SizedDuct> propose_duct_sizes(const Model &m, const DuctNetwork &network,
+                                          const AirflowSolver &airflow,
+                                          const SizingSettings &settings, JobSystem *jobs,
+                                          const Job *job) {
+    if (settings.sizes_mm.empty()) {
+        return {};
+    }
+
+    std::vector<Section> sections;
+    auto add_section = [&](ElementRef ref, const Duct *duct) {
+        auto nodes = network.element_nodes(ref);
+        auto flow = airflow.flow(ref);
+        if (!nodes || !flow) {
+            return;
+        }
+        Section s;
+        s.ref = std::move(ref);
+        s.duct = duct;
+        s.flow_m3s = std::fabs(flow->flow_m3s);
+        s.upstream = flow->flow_m3s >= 0.0 ? (*nodes)[0] : (*nodes)[1];
+        s.downstream = flow->flow_m3s >= 0.0 ? (*nodes)[1] : (*nodes)[0];
+        sections.push_back(std::move(s));
+    };
+    for (auto &d : m.ducts) {
+        add_section(ElementRef{ElementKind::duct, d.id}, &d);
+    }
+    for (auto &f : m.fittings) {
+        add_section(ElementRef{ElementKind::fitting, f.id}, nullptr);
+    }
+
+    std::unordered_map<ElementRef, uint32_t, ElementRefHash> index;
+    std::unordered_map<DuctNetwork::NodeId, size_t> feeding; // sections flowing into a node
+    for (uint32_t i = 0; i < sections.size(); ++i) {
+        index.emplace(sections[i].ref, i);
+        ++feeding[sections[i].downstream];
+    }
+
+    // Tree over sections from sources, loops are cut where a section was already reached.
+    std::vector<uint32_t> roots;
+    std::vector<bool> reached(sections.size(), false);
+    auto grow_from = [&](uint32_t root) {
+        roots.push_back(root);
+        reached[root] = true;
+        std::deque<uint32_t> queue{root};
+        while (!queue.empty()) {
+            const auto i = queue.front();
+            queue.pop_front();
+            const auto node = sections[i].downstream;
+            for (auto &ref : network.node_elements(node)) {
+                auto it = index.find(ref);
+                if (it == index.end() || reached[it->second] ||
+                    sections[it->second].upstream != node) {
+                    continue;
+                }
+                reached[it->second] = true;
+                sections[i].children.push_back(it->second);
+                queue.push_back(it->second);
+            }
+        }
+    };
+    for (uint32_t i = 0; i < sections.size(); ++i) {
+        if (!reached[i] && feeding.find(sections[i].upstream) == feeding.end()) {
+            grow_from(i);
+        }
+    }
+    for (uint32_t i = 0; i < sections.size(); ++i) {
+        if (!reached[i]) {
+            grow_from(i);
+        }
+    }
+
+    std::vector<SizedDuct> by_section(sections.size());
+    for (uint32_t i = 0; i < sections.size(); ++i) {
+        if (auto duct = sections[i].duct) {
+            by_section[i].id = duct->id;
+            by_section[i].current_mm = duct->size_mm;
+            by_section[i].flow_m3h = sections[i].flow_m3s * SECONDS_PER_HOUR;
+        }
+    }
+    Sizer(sections, settings, airflow.settings(), by_section, jobs, job).size(roots);
+
+    std::vector<SizedDuct> result;
+    for (auto &sized : by_section) {
+        if (sized.proposed_mm != 0) {
+            result.push_back(std::move(sized));
+        }
+    }
+    return result;
+}
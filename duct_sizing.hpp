@@ -0,0 +1,51 @@
+#pragma once
+
+#include "airflow_solver.hpp"
+#include "catalogue.hpp"
+#include "duct_network.hpp"
+#include "job_system.hpp"
+#include "types.hpp"
+
+#include <string>
+#include <vector>
+
+enum class SizingMethod {
+    equal_friction, // same pressure loss per metre everywhere
+    velocity,       // every duct at most at the velocity limit
+    static_regain,  // velocity drop past every branch recovers friction loss of next section
+};
+
+struct SizingSettings {
+    SizingMethod method = SizingMethod::equal_friction;
+    double friction_rate_pa_m = 1.0;
+    double max_velocity_ms = 5.0;
+    double regain_coefficient = 0.75; // part of velocity pressure drop turned into static pressure
+
+    // Diameters to choose from, ascending.
+    std::vector<unsigned> sizes_mm = {80,  100, 125, 160, 200, 250, 315,
+                                      400, 500, 630, 800, 1000, 1250};
+};
+
+// Duct sizes sold in the catalogue, ascending.
+std::vector<unsigned> duct_sizes(const Catalogue &c);
+
+struct SizedDuct {
+    std::string id;
+    unsigned current_mm = 0;
+    unsigned proposed_mm = 0;
+    double flow_m3h = 0.0;
+    double velocity_ms = 0.0; // with proposed size
+    double friction_pa_m = 0.0;
+};
+
+// Picks a standard diameter for every duct carrying air, from flows found by `airflow`, which must
+// be solved. Fittings keep their sizes.
+//
+// Ducts are walked downstream from sources. Every branch below a fork depends only on the
+// velocity of the section feeding the fork, so with `jobs` given branches are sized as its tasks,
+// otherwise one after another. Sizing stops with JobCancelled between sections once `job` is
+// cancelled.
+std::vector<SizedDuct> propose_duct_sizes(const Model &m, const DuctNetwork &network,
+                                          const AirflowSolver &airflow,
+                                          const SizingSettings &settings,
+                                          JobSystem *jobs = nullptr, const Job *job = nullptr);
@@ -0,0 +1,348 @@
+#include "endpoint_index.hpp"
+
+#include "duct_network.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+namespace {
+// Waiting and dead endpoints tolerated before rebuild however small the tree is.
+const size_t MIN_PENDING = 16;
+// Room for closest() to search without the heap.
+const size_t CLOSEST_STACK_BYTES = 512;
+
+double coord(Point p, int axis) { return axis == 0 ? p.x : p.y; }
+
+double distance2(Point a, Point b) {
+    const double dx = a.x - b.x;
+    const double dy = a.y - b.y;
+    return dx * dx + dy * dy;
+}
+
+unsigned mask_of(EndpointOwner owner) { return 1u << static_cast<int>(owner); }
+
+template <typename FindLine>
+size_t connect_ends(Model &m, size_t line, EndpointIndex &index, double tolerance,
+                    ModelNotifier *changes, FindLine &&find_line) {
+    size_t connected = 0;
+    for (int end = 0; end < 2; ++end) {
+        LineObj &l = m.lines[line];
+        Point &pos = end == 0 ? l.l.a : l.l.b;
+        auto &ref = end == 0 ? l.endpoint_a_ref : l.endpoint_b_ref;
+        ref.reset();
+
+        const auto hits = index.within(pos, tolerance, EndpointMask::point | EndpointMask::line);
+        auto point = std::find_if(hits.begin(), hits.end(), [](const Endpoint &e) {
+            return e.owner == EndpointOwner::point;
+        });
+        if (point != hits.end()) {
+            ref = point->id;
+            pos = point->pos;
+            ++connected;
+            continue;
+        }
+        for (auto &hit : hits) {
+            if (hit.id == l.id) {
+                continue;
+            }
+            auto other_idx = find_line(hit.id);
+            if (!other_idx) {
+                continue;
+            }
+            LineObj &other = m.lines[*other_idx];
+            auto &other_ref = hit.end == 0 ? other.endpoint_a_ref : other.endpoint_b_ref;
+            if (!other_ref) {
+                const LineObj before = other;
+                other_ref = other.id + (hit.end == 0 ? "__A" : "__B");
+                m.points.emplace_back(hit.pos, *other_ref);
+                index.set_point(m.points.back());
+                if (changes) {
+                    changes->added(m.points.back());
+                    changes->modified(before, other);
+                }
+            }
+            ref = *other_ref;
+            pos = hit.pos;
+            ++connected;
+            break;
+        }
+    }
+    index.set_line(m.lines[line]);
+    return connected;
+}
+} // namespace
+
+void EndpointIndex::set_point(const PointObj &p) {
+    set_element(Key{EndpointOwner::point, p.id}, {p.pt});
+}
+
+void EndpointIndex::set_line(const LineObj &l) {
+    set_element(Key{EndpointOwner::line, l.id}, {l.l.a, l.l.b});
+}
+
+void EndpointIndex::set_duct(const Duct &d) {
+    set_element(Key{EndpointOwner::duct, d.id}, {d.begin, d.end});
+}
+
+void EndpointIndex::set_fitting(const Fitting &f) {
+    auto [a, b] = fitting_endpoints(f);
+    set_element(Key{EndpointOwner::fitting, f.id}, {a, b});
+}
+
+void EndpointIndex::remove(EndpointOwner owner, const std::string &id) {
+    set_element(Key{owner, id}, {});
+}
+
+void EndpointIndex::clear() {
+    m_entries.clear();
+    m_tree.clear();
+    m_pending.clear();
+    m_free.clear();
+    m_dead = 0;
+    m_by_element.clear();
+}
+
+void EndpointIndex::rebuild(const Model &m) {
+    clear();
+    auto add = [this](EndpointOwner owner, const std::string &id, Point a, Point b) {
+        auto &element = m_by_element[Key{owner, id}];
+        element.push_back(static_cast<uint32_t>(m_entries.size()));
+        m_entries.push_back(Entry{Endpoint{owner, id, 0, a, b}});
+        if (owner != EndpointOwner::point) {
+            element.push_back(static_cast<uint32_t>(m_entries.size()));
+            m_entries.push_back(Entry{Endpoint{owner, id, 1, b, a}});
+        }
+    };
+    for (auto &p : m.points) {
+        add(EndpointOwner::point, p.id, p.pt, p.pt);
+    }
+    for (auto &l : m.lines) {
+        add(EndpointOwner::line, l.id, l.l.a, l.l.b);
+    }
+    for (auto &d : m.ducts) {
+        add(EndpointOwner::duct, d.id, d.begin, d.end);
+    }
+    for (auto &f : m.fittings) {
+        auto [a, b] = fitting_endpoints(f);
+        add(EndpointOwner::fitting, f.id, a, b);
+    }
+    build();
+}
+
+void EndpointIndex::model_changed(const ModelChanges &changes) {
+    auto follow = [this](auto &list, EndpointOwner owner, auto set) {
+        for (auto &c : list) {
+            if (c.kind == ChangeKind::removed) {
+                remove(owner, c.id());
+            } else if (c.touches(ChangedField::geometry)) {
+                (this->*set)(*c.after);
+            }
+        }
+    };
+    follow(changes.points, EndpointOwner::point, &EndpointIndex::set_point);
+    follow(changes.lines, EndpointOwner::line, &EndpointIndex::set_line);
+    follow(changes.ducts, EndpointOwner::duct, &EndpointIndex::set_duct);
+    follow(changes.fittings, EndpointOwner::fitting, &EndpointIndex::set_fitting);
+}
+
+std::pmr::vector<Endpoint> EndpointIndex::within(Point p, double radius, unsigned mask,
+                                                  std::pmr::memory_resource *memory) const {
+    return search(p, radius, std::numeric_limits<size_t>::max(), mask, memory);
+}
+
+std::pmr::vector<Endpoint> EndpointIndex::nearest(Point p, size_t k, unsigned mask,
+                                                   std::pmr::memory_resource *memory) const {
+    return search(p, std::numeric_limits<double>::infinity(), k, mask, memory);
+}
+
+std::optional<Endpoint> EndpointIndex::closest(Point p, double radius, unsigned mask) const {
+    // Search of one needs two candidates and one result at most, they fit on the stack.
+    std::array<std::byte, CLOSEST_STACK_BYTES> buffer;
+    std::pmr::monotonic_buffer_resource stack(buffer.data(), buffer.size());
+    auto found = search(p, radius, 1, mask, &stack);
+    if (found.empty()) {
+        return std::nullopt;
+    }
+    return std::move(found.front());
+}
+
+void EndpointIndex::set_element(Key key, std::vector<Point> ends) {
+    auto it = m_by_element.find(key);
+    if (it != m_by_element.end()) {
+        for (auto idx : it->second) {
+            auto &entry = m_entries[idx];
+            if (entry.in_tree) {
+                // The tree still leads here, the slot waits for the next build.
+                entry.alive = false;
+                ++m_dead;
+            } else {
+                m_pending.erase(std::find(m_pending.begin(), m_pending.end(), idx));
+                entry = Entry{};
+                entry.alive = false;
+                m_free.push_back(idx);
+            }
+        }
+        if (ends.empty()) {
+            m_by_element.erase(it);
+            return;
+        }
+        it->second.clear();
+    } else if (ends.empty()) {
+        return;
+    } else {
+        it = m_by_element.emplace(key, std::vector<uint32_t>{}).first;
+    }
+
+    for (size_t end = 0; end < ends.size(); ++end) {
+        uint32_t idx;
+        if (!m_free.empty()) {
+            idx = m_free.back();
+            m_free.pop_back();
+        } else {
+            idx = static_cast<uint32_t>(m_entries.size());
+            m_entries.emplace_back();
+        }
+        m_entries[idx] = Entry{Endpoint{key.owner, key.id, static_cast<int>(end), ends[end],
+                                        ends[ends.size() - 1 - end]},
+                               true, false};
+        m_pending.push_back(idx);
+        it->second.push_back(idx);
+    }
+
+    const auto limit = std::max(MIN_PENDING, static_cast<size_t>(std::sqrt(m_tree.size())));
+    if (m_pending.size() + m_dead > limit) {
+        build();
+    }
+}
+
+void EndpointIndex::build() {
+    // Dead and free slots are dropped, ids of entries change.
+    std::vector<Entry> entries;
+    entries.reserve(m_entries.size() - m_dead - m_free.size());
+    for (auto &entry : m_entries) {
+        if (entry.alive) {
+            entries.push_back(std::move(entry));
+            entries.back().in_tree = true;
+        }
+    }
+    m_entries = std::move(entries);
+    m_pending.clear();
+    m_free.clear();
+    m_dead = 0;
+    m_by_element.clear();
+    m_tree.resize(m_entries.size());
+    for (uint32_t i = 0; i < m_entries.size(); ++i) {
+        auto &e = m_entries[i].e;
+        m_by_element[Key{e.owner, e.id}].push_back(i);
+        m_tree[i] = i;
+    }
+
+    auto split = [this](auto &self, size_t lo, size_t hi, int axis) -> void {
+        if (hi - lo <= 1) {
+            return;
+        }
+        const size_t mid = lo + (hi - lo) / 2;
+        std::nth_element(m_tree.begin() + lo, m_tree.begin() + mid, m_tree.begin() + hi,
+                         [&](uint32_t a, uint32_t b) {
+                             return coord(m_entries[a].e.pos, axis) <
+                                    coord(m_entries[b].e.pos, axis);
+                         });
+        self(self, lo, mid, 1 - axis);
+        self(self, mid + 1, hi, 1 - axis);
+    };
+    split(split, 0, m_tree.size(), 0);
+    ++m_builds;
+}
+
+std::pmr::vector<Endpoint> EndpointIndex::search(Point p, double radius, size_t k, unsigned mask,
+                                                  std::pmr::memory_resource *memory) const {
+    std::pmr::vector<Endpoint> result(memory);
+    if (k == 0 || radius < 0.0) {
+        return result;
+    }
+    // Max-heap of the best so far, the radius shrinks to the k-th best once there are k.
+    std::pmr::vector<Candidate> heap(memory);
+    double r2 = radius * radius;
+    search_tree(0, m_tree.size(), 0, p, r2, k, mask, heap);
+    for (auto idx : m_pending) {
+        consider(idx, p, r2, k, mask, heap);
+    }
+    std::sort_heap(heap.begin(), heap.end());
+    result.reserve(heap.size());
+    for (auto &c : heap) {
+        result.push_back(m_entries[c.idx].e);
+    }
+    return result;
+}
+
+void EndpointIndex::search_tree(size_t lo, size_t hi, int axis, Point p, double &r2, size_t k,
+                                unsigned mask, std::pmr::vector<Candidate> &heap) const {
+    if (lo >= hi) {
+        return;
+    }
+    const size_t mid = lo + (hi - lo) / 2;
+    const uint32_t idx = m_tree[mid];
+    consider(idx, p, r2, k, mask, heap);
+
+    const double diff = coord(p, axis) - coord(m_entries[idx].e.pos, axis);
+    if (diff < 0.0) {
+        search_tree(lo, mid, 1 - axis, p, r2, k, mask, heap);
+        if (diff * diff <= r2) {
+            search_tree(mid + 1, hi, 1 - axis, p, r2, k, mask, heap);
+        }
+    } else {
+        search_tree(mid + 1, hi, 1 - axis, p, r2, k, mask, heap);
+        if (diff * diff <= r2) {
+            search_tree(lo, mid, 1 - axis, p, r2, k, mask, heap);
+        }
+    }
+}
+
+void EndpointIndex::consider(uint32_t idx, Point p, double &r2, size_t k, unsigned mask,
+                             std::pmr::vector<Candidate> &heap) const {
+    auto &entry = m_entries[idx];
+    if (!entry.alive || !(mask & mask_of(entry.e.owner))) {
+        return;
+    }
+    const double d2 = distance2(entry.e.pos, p);
+    if (d2 > r2) {
+        return;
+    }
+    heap.push_back(Candidate{d2, idx});
+    std::push_heap(heap.begin(), heap.end());
+    if (heap.size() > k) {
+        std::pop_heap(heap.begin(), heap.end());
+        heap.pop_back();
+    }
+    if (heap.size() == k) {
+        r2 = heap.front().d2;
+    }
+}
+
+size_t connect_line_endpoints(Model &m, size_t line, EndpointIndex &index, double tolerance,
+                              ModelNotifier *changes) {
+    return connect_ends(m, line, index, tolerance, changes, [&m](const std::string &id) {
+        auto it = std::find_if(m.lines.begin(), m.lines.end(),
+                               [&id](const LineObj &l) { return l.id == id; });
+        return it == m.lines.end() ? std::nullopt
+                                   : std::optional<size_t>(std::distance(m.lines.begin(), it));
+    });
+}
+
+size_t connect_all_line_endpoints(Model &m, EndpointIndex &index, double tolerance) {
+    std::unordered_map<std::string, size_t> lines;
+    for (size_t i = 0; i < m.lines.size(); ++i) {
+        lines.emplace(m.lines[i].id, i);
+    }
+    auto find_line = [&lines](const std::string &id) {
+        auto it = lines.find(id);
+        return it == lines.end() ? std::nullopt : std::optional<size_t>(it->second);
+    };
+    size_t connected = 0;
+    for (size_t i = 0; i < m.lines.size(); ++i) {
+        connected += connect_ends(m, i, index, tolerance, nullptr, find_line);
+    }
+    return connected;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "model_changes.hpp"
+#include "types.hpp"
+
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class EndpointOwner { point, line, duct, fitting };
+
+// Which owners a query looks at.
+namespace EndpointMask {
+enum {
+    point = 1 << static_cast<int>(EndpointOwner::point),
+    line = 1 << static_cast<int>(EndpointOwner::line),
+    duct = 1 << static_cast<int>(EndpointOwner::duct),
+    fitting = 1 << static_cast<int>(EndpointOwner::fitting),
+    all = point | line | duct | fitting,
+};
+}
+
+struct Endpoint {
+    EndpointOwner owner = EndpointOwner::point;
+    std::string id;
+    int end = 0; // 0 for a line's a, a duct's or fitting's begin and for points, 1 for the other
+    Point pos;
+    Point other; // the opposite end, direction out of the element is from it to `pos`
+};
+
+// Endpoints of points, lines, ducts and fittings in a 2-d tree, for finding what is attached at a
+// place and what an end being drawn should connect to.
+//
+// The tree is built balanced over all endpoints at once. Endpoints set afterwards wait in a small
+// list scanned on every query, replaced ones are only marked dead in the tree; once either grows
+// past the square root of the tree size the tree is rebuilt. Setting the same element again, as a
+// drag does on every mouse move, replaces its waiting endpoints and keeps the list short.
+class EndpointIndex : public IModelObserver {
+  public:
+    // Adds element's endpoints or replaces the previous ones.
+    void set_point(const PointObj &p);
+    void set_line(const LineObj &l);
+    void set_duct(const Duct &d);
+    void set_fitting(const Fitting &f);
+    void remove(EndpointOwner owner, const std::string &id);
+
+    void clear();
+    // For loading a model, edits should use methods above.
+    void rebuild(const Model &m);
+    // Follows geometry of changed points, lines, ducts and fittings.
+    void model_changed(const ModelChanges &changes) override;
+
+    // Endpoints within `radius` from `p`, closest first. Results and search state are allocated
+    // from `memory`, e.g. a frame arena for queries made on every mouse move.
+    std::pmr::vector<Endpoint>
+    within(Point p, double radius, unsigned mask = EndpointMask::all,
+           std::pmr::memory_resource *memory = std::pmr::get_default_resource()) const;
+    // Up to `k` endpoints closest to `p`, closest first.
+    std::pmr::vector<Endpoint>
+    nearest(Point p, size_t k, unsigned mask = EndpointMask::all,
+            std::pmr::memory_resource *memory = std::pmr::get_default_resource()) const;
+    // Allocates nothing.
+    std::optional<Endpoint> closest(Point p, double radius,
+                                    unsigned mask = EndpointMask::all) const;
+
+    size_t size() const { return m_entries.size() - m_dead - m_free.size(); }
+    // Times the tree was built since construction, tells whether updates stay incremental.
+    size_t build_count() const { return m_builds; }
+
+  private:
+    struct Key {
+        EndpointOwner owner;
+        std::string id;
+        bool operator==(const Key &o) const { return owner == o.owner && id == o.id; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            return std::hash<std::string>()(k.id) ^ (static_cast<size_t>(k.owner) * 0x9e3779b9);
+        }
+    };
+    struct Entry {
+        Endpoint e;
+        bool alive = true;
+        bool in_tree = false;
+    };
+    struct Candidate {
+        double d2;
+        uint32_t idx;
+        bool operator<(const Candidate &o) const { return d2 < o.d2; }
+    };
+
+    void set_element(Key key, std::vector<Point> ends);
+    void build();
+    // Closest first, at most `k` within `radius`.
+    std::pmr::vector<Endpoint> search(Point p, double radius, size_t k, unsigned mask,
+                                      std::pmr::memory_resource *memory) const;
+    void search_tree(size_t lo, size_t hi, int axis, Point p, double &r2, size_t k, unsigned mask,
+                     std::pmr::vector<Candidate> &heap) const;
+    void consider(uint32_t idx, Point p, double &r2, size_t k, unsigned mask,
+                  std::pmr::vector<Candidate> &heap) const;
+
+    std::vector<Entry> m_entries;
+    // Entries of the tree, median of every range splits it across x and y in turn.
+    std::vector<uint32_t> m_tree;
+    std::vector<uint32_t> m_pending; // added since the tree was built
+    std::vector<uint32_t> m_free;    // slots of replaced pending entries
+    size_t m_dead = 0;               // replaced entries still in the tree
+    size_t m_builds = 0;
+    std::unordered_map<Key, std::vector<uint32_t>, KeyHash> m_by_element;
+};
+
+// Refers line ends to the points they touch, what LineObj::endpoint_a_ref and endpoint_b_ref are
+// for. An end within `tolerance` of a point moves onto it; an end meeting another line's end gets
+// a point shared by both, created at the other end if it has none. Ends touching nothing lose
+// their ref. The line is updated in `index`. Returns number of ends connected.
+//
+// `changes` hears about created points and other lines which got them, telling it about the line
+// itself is up to the caller.
+size_t connect_line_endpoints(Model &m, size_t line, EndpointIndex &index, double tolerance,
+                              ModelNotifier *changes = nullptr);
+// Same for every line, e.g. after import. `index` has to hold the model's endpoints.
+size_t connect_all_line_endpoints(Model &m, EndpointIndex &index, double tolerance);
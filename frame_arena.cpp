@@ -0,0 +1,25 @@
+#include "frame_arena.hpp"
+
+FrameArena::FrameArena(size_t initial_bytes) : m_buffer(initial_bytes) {
+    m_resource.emplace(m_buffer.data(), m_buffer.size(), &m_heap);
+}
+
+void FrameArena::reset() {
+    // Heap blocks go back before the buffer may be replaced.
+    m_resource.reset();
+    if (m_heap.allocated() > 0) {
+        m_buffer.resize(m_buffer.size() + m_heap.allocated());
+        ++m_grows;
+    }
+    m_heap.reset_count();
+    m_resource.emplace(m_buffer.data(), m_buffer.size(), &m_heap);
+}
+
+void *FrameArena::HeapResource::do_allocate(size_t bytes, size_t alignment) {
+    m_allocated += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void FrameArena::HeapResource::do_deallocate(void *p, size_t bytes, size_t alignment) {
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <optional>
+#include <vector>
+
+// Memory for data living no longer than one frame: geometry mapped for hit tests, polygons handed
+// to the painter, label text.
+//
+// Allocations bump a pointer through one buffer and are never freed one by one, reset() drops all
+// of them at once. A frame needing more than the buffer holds takes the rest from the heap, and
+// the next reset grows the buffer to what that frame used, so frames like it allocate nothing.
+class FrameArena {
+  public:
+    explicit FrameArena(size_t initial_bytes = 64 * 1024);
+
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    std::pmr::memory_resource *resource() { return &*m_resource; }
+
+    // Everything allocated since last reset becomes invalid.
+    void reset();
+
+    size_t capacity() const { return m_buffer.size(); }
+    // Bytes the current frame took from the heap since it ran out of the buffer.
+    size_t overflow_bytes() const { return m_heap.allocated(); }
+    // Times the buffer had to grow, tells whether frames settled.
+    size_t grow_count() const { return m_grows; }
+
+  private:
+    // Heap behind the buffer, counting what frames take from it.
+    class HeapResource : public std::pmr::memory_resource {
+      public:
+        size_t allocated() const { return m_allocated; }
+        void reset_count() { m_allocated = 0; }
+
+      private:
+        void *do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+            return this == &other;
+        }
+
+        size_t m_allocated = 0;
+    };
+
+    std::vector<std::byte> m_buffer;
+    HeapResource m_heap;
+    std::optional<std::pmr::monotonic_buffer_resource> m_resource;
+    size_t m_grows = 0;
+};
+
+template <class T> using FrameVector = std::pmr::vector<T>;
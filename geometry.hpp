@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+// Geometry kernel templated on scalar type. It knows nothing about Qt or the model, so hot loops
+// can run on float or integer (fixed point) coordinates where precision allows, and the kernel
+// can be built and benchmarked on its own. v2 (v2.hpp) is its double instantiation.
+//
+// Products of integer coordinates are computed in a wider type, see wide_t: int32 coordinates in
+// hundredths of a millimetre cover +-21 km without a cross product overflowing.
+namespace geom {
+
+template <typename T> struct wide {
+    using type = T;
+};
+template <> struct wide<int16_t> {
+    using type = int32_t;
+};
+template <> struct wide<int32_t> {
+    using type = int64_t;
+};
+template <typename T> using wide_t = typename wide<T>::type;
+
+// Type of lengths and parameters along segments: floating types stay, integers become double.
+template <typename T> using real_t = std::conditional_t<std::is_floating_point_v<T>, T, double>;
+
+template <typename T> struct vec2 {
+    T x{};
+    T y{};
+
+    constexpr vec2() = default;
+    constexpr vec2(T x, T y) : x(x), y(y) {}
+    // From `a` to `b`.
+    constexpr vec2(vec2 a, vec2 b) : x(b.x - a.x), y(b.y - a.y) {}
+
+    template <typename U> constexpr vec2<U> cast() const {
+        return vec2<U>(static_cast<U>(x), static_cast<U>(y));
+    }
+
+    constexpr bool operator==(vec2 o) const { return x == o.x && y == o.y; }
+    constexpr bool operator!=(vec2 o) const { return !(*this == o); }
+
+    constexpr vec2 &operator+=(vec2 o) {
+        x += o.x;
+        y += o.y;
+        return *this;
+    }
+    constexpr vec2 &operator-=(vec2 o) {
+        x -= o.x;
+        y -= o.y;
+        return *this;
+    }
+    constexpr vec2 &operator*=(T s) {
+        x *= s;
+        y *= s;
+        return *this;
+    }
+};
+
+// Coordinates narrower than int are promoted in arithmetic, results are cast back.
+template <typename T> constexpr vec2<T> operator+(vec2<T> a, vec2<T> b) {
+    return {static_cast<T>(a.x + b.x), static_cast<T>(a.y + b.y)};
+}
+template <typename T> constexpr vec2<T> operator-(vec2<T> a, vec2<T> b) {
+    return {static_cast<T>(a.x - b.x), static_cast<T>(a.y - b.y)};
+}
+template <typename T> constexpr vec2<T> operator-(vec2<T> v) {
+    return {static_cast<T>(-v.x), static_cast<T>(-v.y)};
+}
+template <typename T> constexpr vec2<T> operator*(vec2<T> v, T s) {
+    return {static_cast<T>(v.x * s), static_cast<T>(v.y * s)};
+}
+template <typename T> constexpr vec2<T> operator*(T s, vec2<T> v) { return v * s; }
+template <typename T> constexpr vec2<T> operator/(vec2<T> v, T s) {
+    return {static_cast<T>(v.x / s), static_cast<T>(v.y / s)};
+}
+
+template <typename T> constexpr wide_t<T> dot(vec2<T> a, vec2<T> b) {
+    return wide_t<T>(a.x) * b.x + wide_t<T>(a.y) * b.y;
+}
+// Scalar cross product, determinant of [a; b]. Positive when `b` turns left from `a` with y up.
+template <typename T> constexpr wide_t<T> cross(vec2<T> a, vec2<T> b) {
+    return wide_t<T>(a.x) * b.y - wide_t<T>(a.y) * b.x;
+}
+template <typename T> constexpr wide_t<T> len2(vec2<T> v) { return dot(v, v); }
+template <typename T> real_t<T> len(vec2<T> v) {
+    return std::sqrt(static_cast<real_t<T>>(len2(v)));
+}
+// Rotated by 90 degrees counterclockwise with y up.
+template <typename T> constexpr vec2<T> normal(vec2<T> v) { return {static_cast<T>(-v.y), v.x}; }
+
+template <typename T> vec2<T> normalized(vec2<T> v) {
+    static_assert(std::is_floating_point_v<T>, "integer vectors cannot be normalized");
+    return v / len(v);
+}
+
+template <typename T> constexpr vec2<T> lerp(vec2<T> a, vec2<T> b, real_t<T> t) {
+    return {static_cast<T>(a.x + (b.x - a.x) * t), static_cast<T>(a.y + (b.y - a.y) * t)};
+}
+
+// Projection of `v` on `u`.
+template <typename T> constexpr vec2<T> projection(vec2<T> v, vec2<T> u) {
+    static_assert(std::is_floating_point_v<T>, "projection needs division");
+    return u * (dot(v, u) / len2(u));
+}
+
+template <typename T> struct segment {
+    vec2<T> a;
+    vec2<T> b;
+
+    constexpr vec2<T> direction() const { return vec2<T>(a, b); }
+    constexpr bool degenerate() const { return a == b; }
+};
+
+// Parameter along `s` of the point closest to `p`, 0 at `a` and 1 at `b`.
+template <typename T> constexpr real_t<T> closest_parameter(const segment<T> &s, vec2<T> p) {
+    const auto d = s.direction();
+    const auto l2 = len2(d);
+    if (l2 == 0) {
+        return 0;
+    }
+    const auto t = static_cast<real_t<T>>(dot(vec2<T>(s.a, p), d)) / static_cast<real_t<T>>(l2);
+    return std::clamp(t, real_t<T>(0), real_t<T>(1));
+}
+
+template <typename T> constexpr vec2<T> closest_point(const segment<T> &s, vec2<T> p) {
+    return lerp(s.a, s.b, closest_parameter(s, p));
+}
+
+// Parameters along both segments where they cross, none for parallel ones.
+template <typename T>
+constexpr std::optional<std::pair<real_t<T>, real_t<T>>> crossing(const segment<T> &s,
+                                                                  const segment<T> &o) {
+    using R = real_t<T>;
+    const auto r = s.direction();
+    const auto q = o.direction();
+    const auto den = static_cast<R>(cross(r, q));
+    if ((den < 0 ? -den : den) < R(1e-12)) {
+        return std::nullopt;
+    }
+    const vec2<T> qp(s.a, o.a);
+    const R t = static_cast<R>(cross(qp, q)) / den;
+    const R u = static_cast<R>(cross(qp, r)) / den;
+    if (t < 0 || t > 1 || u < 0 || u > 1) {
+        return std::nullopt;
+    }
+    return std::make_pair(t, u);
+}
+
+// Axis aligned, x and y is the corner with smallest coordinates.
+template <typename T> struct rect {
+    T x{};
+    T y{};
+    T width{};
+    T height{};
+
+    static constexpr rect from_points(vec2<T> p, vec2<T> q) {
+        return {std::min(p.x, q.x), std::min(p.y, q.y),
+                static_cast<T>(p.x > q.x ? p.x - q.x : q.x - p.x),
+                static_cast<T>(p.y > q.y ? p.y - q.y : q.y - p.y)};
+    }
+    // Contains nothing, united with anything gives that thing.
+    static constexpr rect empty() {
+        return {std::numeric_limits<T>::max(), std::numeric_limits<T>::max(), T{}, T{}};
+    }
+
+    constexpr T right() const { return x + width; }
+    constexpr T bottom() const { return y + height; }
+    constexpr bool is_empty() const { return x == std::numeric_limits<T>::max(); }
+
+    // Edges count as inside.
+    constexpr bool contains(vec2<T> p) const {
+        return x <= p.x && p.x <= right() && y <= p.y && p.y <= bottom();
+    }
+    constexpr bool intersects(const rect &o) const {
+        return x <= o.right() && o.x <= right() && y <= o.bottom() && o.y <= bottom();
+    }
+    constexpr rect united(vec2<T> p) const {
+        if (is_empty()) {
+            return {p.x, p.y, T{}, T{}};
+        }
+        const T x0 = std::min(x, p.x), y0 = std::min(y, p.y);
+        return {x0, y0, static_cast<T>(std::max(right(), p.x) - x0),
+                static_cast<T>(std::max(bottom(), p.y) - y0)};
+    }
+    constexpr rect grown(T margin) const {
+        return {static_cast<T>(x - margin), static_cast<T>(y - margin),
+                static_cast<T>(width + 2 * margin), static_cast<T>(height + 2 * margin)};
+    }
+};
+
+template <typename T> struct affine {
+    T m11 = 1, m12 = 0;
+    T m21 = 0, m22 = 1;
+    T dx = 0, dy = 0;
+
+    constexpr vec2<T> map(vec2<T> p) const {
+        return {static_cast<T>(m11 * p.x + m21 * p.y + dx),
+                static_cast<T>(m12 * p.x + m22 * p.y + dy)};
+    }
+};
+
+// Batch variants over plain arrays, so that callers keep points wherever they are and loops stay
+// free of calls the compiler cannot vectorise.
+
+template <typename T> constexpr rect<T> bounds(const vec2<T> *points, size_t n) {
+    if (n == 0) {
+        return rect<T>::empty();
+    }
+    T x0 = points[0].x, x1 = x0, y0 = points[0].y, y1 = y0;
+    for (size_t i = 1; i < n; ++i) {
+        x0 = std::min(x0, points[i].x);
+        x1 = std::max(x1, points[i].x);
+        y0 = std::min(y0, points[i].y);
+        y1 = std::max(y1, points[i].y);
+    }
+    return {x0, y0, static_cast<T>(x1 - x0), static_cast<T>(y1 - y0)};
+}
+
+template <typename T> constexpr void translate(vec2<T> *points, size_t n, vec2<T> d) {
+    for (size_t i = 0; i < n; ++i) {
+        points[i].x += d.x;
+        points[i].y += d.y;
+    }
+}
+
+// `in` and `out` may be the same array.
+template <typename T>
+constexpr void transform(const affine<T> &m, const vec2<T> *in, vec2<T> *out, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = m.map(in[i]);
+    }
+}
+
+// Smallest and largest dot product of the points with `axis`, for separating axis tests.
+template <typename T>
+constexpr std::pair<wide_t<T>, wide_t<T>> project(const vec2<T> *points, size_t n, vec2<T> axis) {
+    auto lo = std::numeric_limits<wide_t<T>>::max();
+    auto hi = std::numeric_limits<wide_t<T>>::lowest();
+    for (size_t i = 0; i < n; ++i) {
+        const auto t = dot(points[i], axis);
+        lo = std::min(lo, t);
+        hi = std::max(hi, t);
+    }
+    return {lo, hi};
+}
+
+// Index of the point closest to `p`, n when there are none.
+template <typename T> constexpr size_t closest(const vec2<T> *points, size_t n, vec2<T> p) {
+    size_t best = n;
+    auto best_d2 = std::numeric_limits<wide_t<T>>::max();
+    for (size_t i = 0; i < n; ++i) {
+        const auto d2 = len2(vec2<T>(p, points[i]));
+        if (d2 < best_d2) {
+            best_d2 = d2;
+            best = i;
+        }
+    }
+    return best;
+}
+
+} // namespace geom
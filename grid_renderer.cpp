@@ -0,0 +1,165 @@
+#include "grid_renderer.hpp"
+
+#include <QBrush>
+#include <QPainter>
+#include <QTransform>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+const auto BackgroundColor = QColor(235, 235, 235);
+const auto MinorLineColor = QColor(226, 226, 226);
+const auto MajorLineColor = QColor(208, 208, 208);
+const auto RulerColor = QColor(215, 215, 215);
+const auto RulerTickColor = QColor(100, 100, 100);
+
+// Grid switches to coarser or finer step so that minor lines are never closer than this.
+const double MIN_MINOR_STEP_PIXELS = 6.0;
+const int SUBDIVISIONS = 10;
+
+// Texture brush which maps one tile exactly onto one major grid cell. Tile is rendered with
+// rounded size so brush transform compensates the fraction and keeps the grid aligned with the
+// world for any offset.
+QBrush tile_brush(const QPixmap &tile, double cell_w, double cell_h, QPointF origin) {
+    QBrush brush(tile);
+    QTransform t;
+    t.translate(origin.x(), origin.y());
+    t.scale(cell_w / tile.width(), cell_h / tile.height());
+    brush.setTransform(t);
+    return brush;
+}
+
+void draw_tick(QPainter &p, QPointF a, QPointF b) { p.drawLine(a, b); }
+
+} // namespace
+
+GridRenderer::GridRenderer(int ruler_width) : m_ruler_width(ruler_width) {}
+
+void GridRenderer::ensure_tiles(double scale) {
+    if (scale == m_tiles_scale && !m_grid_tile.isNull()) {
+        return;
+    }
+    m_tiles_scale = scale;
+
+    m_minor_step = 1.0;
+    while (m_minor_step * scale < MIN_MINOR_STEP_PIXELS) {
+        m_minor_step *= SUBDIVISIONS;
+    }
+    while (m_minor_step * scale >= MIN_MINOR_STEP_PIXELS * SUBDIVISIONS) {
+        m_minor_step /= SUBDIVISIONS;
+    }
+    m_major_step = m_minor_step * SUBDIVISIONS;
+
+    const int cell = std::max(1, static_cast<int>(std::lround(m_major_step * scale)));
+    const double minor_px = static_cast<double>(cell) / SUBDIVISIONS;
+    const int rw = m_ruler_width;
+
+    // Grid cell: minor lines inside and major lines along top and left edges, neighbour tiles
+    // close the cell.
+    m_grid_tile = QPixmap(cell, cell);
+    m_grid_tile.fill(BackgroundColor);
+    {
+        QPainter p(&m_grid_tile);
+        p.setPen(MinorLineColor);
+        for (int i = 1; i < SUBDIVISIONS; ++i) {
+            const double pos = std::floor(i * minor_px) + 0.5;
+            draw_tick(p, QPointF(pos, 0), QPointF(pos, cell));
+            draw_tick(p, QPointF(0, pos), QPointF(cell, pos));
+        }
+        p.setPen(MajorLineColor);
+        draw_tick(p, QPointF(0.5, 0), QPointF(0.5, cell));
+        draw_tick(p, QPointF(0, 0.5), QPointF(cell, 0.5));
+    }
+
+    // One period of rulers, ticks grow from the edge facing the canvas.
+    auto tick_length = [rw](int i) {
+        return i == 0 ? rw : (i == SUBDIVISIONS / 2 ? rw / 2 : rw / 4);
+    };
+
+    m_horizontal_ruler_tile = QPixmap(cell, rw);
+    m_horizontal_ruler_tile.fill(RulerColor);
+    {
+        QPainter p(&m_horizontal_ruler_tile);
+        p.setPen(RulerTickColor);
+        for (int i = 0; i < SUBDIVISIONS; ++i) {
+            const double x = std::floor(i * minor_px) + 0.5;
+            draw_tick(p, QPointF(x, rw), QPointF(x, rw - tick_length(i)));
+        }
+        draw_tick(p, QPointF(0, rw - 0.5), QPointF(cell, rw - 0.5));
+    }
+
+    m_vertical_ruler_tile = QPixmap(rw, cell);
+    m_vertical_ruler_tile.fill(RulerColor);
+    {
+        QPainter p(&m_vertical_ruler_tile);
+        p.setPen(RulerTickColor);
+        for (int i = 0; i < SUBDIVISIONS; ++i) {
+            const double y = std::floor(i * minor_px) + 0.5;
+            draw_tick(p, QPointF(rw, y), QPointF(rw - tick_length(i), y));
+        }
+        draw_tick(p, QPointF(rw - 0.5, 0), QPointF(rw - 0.5, cell));
+    }
+}
+
+void GridRenderer::render_grid(QPainter &painter, const QRect &rect, double scale,
+                               QPointF origin) {
+    if (scale <= 0.0) {
+        painter.fillRect(rect, BackgroundColor);
+        return;
+    }
+    ensure_tiles(scale);
+    const double cell = m_major_step * scale;
+    painter.fillRect(rect, tile_brush(m_grid_tile, cell, cell, origin));
+}
+
+void GridRenderer::render_rulers(QPainter &painter, const QSize &size, double scale,
+                                 QPointF origin, bool all_edges) {
+    if (scale <= 0.0) {
+        return;
+    }
+    ensure_tiles(scale);
+
+    const double cell = m_major_step * scale;
+    const int w = size.width();
+    const int h = size.height();
+    const int rw = m_ruler_width;
+
+    painter.fillRect(QRect(0, 0, w, rw),
+                     tile_brush(m_horizontal_ruler_tile, cell, rw, QPointF(origin.x(), 0)));
+    painter.fillRect(QRect(0, 0, rw, h),
+                     tile_brush(m_vertical_ruler_tile, rw, cell, QPointF(0, origin.y())));
+    if (all_edges) {
+        painter.fillRect(QRect(0, h - rw, w, rw), tile_brush(m_horizontal_ruler_tile, cell, rw,
+                                                             QPointF(origin.x(), h - rw)));
+        painter.fillRect(QRect(w - rw, 0, rw, h), tile_brush(m_vertical_ruler_tile, rw, cell,
+                                                             QPointF(w - rw, origin.y())));
+    }
+    painter.fillRect(QRect(0, 0, rw, rw), RulerColor);
+
+    // Labels are the only per-frame work, there is just a handful of major ticks on screen.
+    QFont font = painter.font();
+    font.setPixelSize(std::max(6, rw / 2));
+    painter.setFont(font);
+    painter.setPen(RulerTickColor);
+
+    const double text_baseline = rw / 2.0;
+    for (auto k = static_cast<long long>(std::ceil((rw - origin.x()) / cell));; ++k) {
+        const double x = origin.x() + k * cell;
+        if (x >= w) {
+            break;
+        }
+        painter.drawText(QPointF(x + 2, text_baseline), QString::number(k * m_major_step));
+    }
+    for (auto k = static_cast<long long>(std::ceil((rw - origin.y()) / cell));; ++k) {
+        const double y = origin.y() + k * cell;
+        if (y >= h) {
+            break;
+        }
+        painter.save();
+        painter.translate(text_baseline, y - 2);
+        painter.rotate(-90.0);
+        painter.drawText(QPointF(0, 0), QString::number(k * m_major_step));
+        painter.restore();
+    }
+}
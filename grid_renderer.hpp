@@ -0,0 +1,39 @@
+#pragma once
+
+#include <QPixmap>
+
+class QPainter;
+class QRect;
+class QSize;
+class QPointF;
+
+// Renders metric grid and ruler ticks. One cell of the grid and one period of each ruler are
+// pre-rendered into small pixmaps once per zoom level, every frame just fills with them as a
+// texture, so cost of the grid does not depend on its density.
+//
+// All rendering is done in screen space. `scale` is pixels per world unit and `origin` is where
+// world (0, 0) currently is on screen.
+class GridRenderer {
+  public:
+    explicit GridRenderer(int ruler_width);
+
+    void render_grid(QPainter &painter, const QRect &rect, double scale, QPointF origin);
+
+    // Rulers along top and left edges. With `all_edges` right and bottom edges get one too.
+    void render_rulers(QPainter &painter, const QSize &size, double scale, QPointF origin,
+                       bool all_edges);
+
+  private:
+    void ensure_tiles(double scale);
+
+    int m_ruler_width;
+    double m_tiles_scale = 0.0;
+
+    // World units between adjacent minor and major lines for current zoom level.
+    double m_minor_step = 1.0;
+    double m_major_step = 10.0;
+
+    QPixmap m_grid_tile;
+    QPixmap m_horizontal_ruler_tile;
+    QPixmap m_vertical_ruler_tile;
+};
@@ -0,0 +1,268 @@
+#include "intersection_index.hpp"
+
+#include "v2.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace {
+// Crossings this close to segment ends are at the end.
+const double END_EPSILON = 1e-9;
+
+geom::segment<double> segment(const Line &l) { return {v2(l.a), v2(l.b)}; }
+
+bool at_end(double t) { return t < END_EPSILON || t > 1.0 - END_EPSILON; }
+
+Point point_at(const Line &l, double t) { return l.a + v2{l.a, l.b} * t; }
+} // namespace
+
+IntersectionIndex::IntersectionIndex(double cell_size) : m_cell_size(cell_size) {}
+
+void IntersectionIndex::set_line(const LineObj &l) {
+    set_element(IntersectionRef{IntersectionElement::line, l.id}, {l.l});
+}
+
+void IntersectionIndex::set_rect(const RectObj &r) {
+    set_element(IntersectionRef{IntersectionElement::rect, r.id},
+                {r.rect.top_line(), r.rect.right_line(), r.rect.bottom_line(), r.rect.left_line()});
+}
+
+void IntersectionIndex::set_guide(const GuideObj &g) {
+    set_element(IntersectionRef{IntersectionElement::guide, g.id}, {g.line});
+}
+
+void IntersectionIndex::set_duct(const Duct &d) {
+    set_element(IntersectionRef{IntersectionElement::duct, d.id}, {Line(d.begin, d.end)});
+}
+
+void IntersectionIndex::remove(const IntersectionRef &ref) {
+    auto it = m_index.find(ref);
+    if (it == m_index.end()) {
+        return;
+    }
+    const auto idx = it->second;
+    unlink(idx);
+    if (ref.kind == IntersectionElement::guide) {
+        m_guides.erase(std::find(m_guides.begin(), m_guides.end(), idx));
+    }
+    m_elements[idx] = Element{};
+    m_free.push_back(idx);
+    m_index.erase(it);
+}
+
+void IntersectionIndex::clear() {
+    m_elements.clear();
+    m_free.clear();
+    m_guides.clear();
+    m_index.clear();
+    m_grid.clear();
+    m_crossings.clear();
+    m_intersection_count = 0;
+    m_stamps.clear();
+    m_stamp = 0;
+    m_intersection_list.clear();
+    m_intersection_list_dirty = false;
+}
+
+void IntersectionIndex::rebuild(const Model &m) {
+    clear();
+    for (auto &l : m.lines) {
+        set_line(l);
+    }
+    for (auto &r : m.rects) {
+        set_rect(r);
+    }
+    for (auto &g : m.guides) {
+        set_guide(g);
+    }
+    for (auto &d : m.ducts) {
+        set_duct(d);
+    }
+}
+
+void IntersectionIndex::model_changed(const ModelChanges &changes) {
+    auto follow = [this](auto &list, IntersectionElement kind, auto set) {
+        for (auto &c : list) {
+            if (c.kind == ChangeKind::removed) {
+                remove(IntersectionRef{kind, c.id()});
+            } else if (c.touches(ChangedField::geometry)) {
+                (this->*set)(*c.after);
+            }
+        }
+    };
+    follow(changes.lines, IntersectionElement::line, &IntersectionIndex::set_line);
+    follow(changes.rects, IntersectionElement::rect, &IntersectionIndex::set_rect);
+    follow(changes.guides, IntersectionElement::guide, &IntersectionIndex::set_guide);
+    follow(changes.ducts, IntersectionElement::duct, &IntersectionIndex::set_duct);
+}
+
+const std::vector<Intersection> &IntersectionIndex::intersections() const {
+    if (m_intersection_list_dirty) {
+        m_intersection_list.clear();
+        m_intersection_list.reserve(m_intersection_count);
+        for (auto &[key, points] : m_crossings) {
+            const auto a = static_cast<uint32_t>(key >> 32);
+            const auto b = static_cast<uint32_t>(key & 0xffffffff);
+            for (auto p : points) {
+                m_intersection_list.push_back(
+                    Intersection{m_elements[a].ref, m_elements[b].ref, p});
+            }
+        }
+        m_intersection_list_dirty = false;
+    }
+    return m_intersection_list;
+}
+
+std::vector<Intersection> IntersectionIndex::intersections_of(const IntersectionRef &ref) const {
+    std::vector<Intersection> result;
+    auto it = m_index.find(ref);
+    if (it == m_index.end()) {
+        return result;
+    }
+    auto &e = m_elements[it->second];
+    for (auto partner : e.partners) {
+        for (auto p : m_crossings.at(pair_key(it->second, partner))) {
+            result.push_back(Intersection{e.ref, m_elements[partner].ref, p});
+        }
+    }
+    return result;
+}
+
+void IntersectionIndex::set_element(IntersectionRef ref, std::vector<Line> segments) {
+    const bool guide = ref.kind == IntersectionElement::guide;
+    uint32_t idx;
+    if (auto it = m_index.find(ref); it != m_index.end()) {
+        idx = it->second;
+        unlink(idx);
+    } else {
+        if (!m_free.empty()) {
+            idx = m_free.back();
+            m_free.pop_back();
+        } else {
+            idx = static_cast<uint32_t>(m_elements.size());
+            m_elements.emplace_back();
+            m_stamps.push_back(0);
+        }
+        m_index.emplace(ref, idx);
+        if (guide) {
+            m_guides.push_back(idx);
+        }
+    }
+
+    auto &e = m_elements[idx];
+    e.ref = std::move(ref);
+    e.segments = std::move(segments);
+
+    m_last_narrow_tests = 0;
+    ++m_stamp;
+    m_stamps[idx] = m_stamp;
+    for (auto g : m_guides) {
+        if (std::exchange(m_stamps[g], m_stamp) != m_stamp) {
+            test_pair(idx, g);
+        }
+    }
+    if (guide) {
+        // Not in the grid, it would cover every cell it spans.
+        for (uint32_t other = 0; other < m_elements.size(); ++other) {
+            if (!m_elements[other].segments.empty() &&
+                std::exchange(m_stamps[other], m_stamp) != m_stamp) {
+                test_pair(idx, other);
+            }
+        }
+        return;
+    }
+
+    // Only this element is tested, against whatever shares a cell with it.
+    e.cells = cells_of(e.segments);
+    for (auto &key : e.cells) {
+        auto &cell = m_grid[key];
+        for (auto other : cell) {
+            if (std::exchange(m_stamps[other], m_stamp) != m_stamp) {
+                test_pair(idx, other);
+            }
+        }
+        cell.push_back(idx);
+    }
+}
+
+void IntersectionIndex::test_pair(uint32_t a, uint32_t b) {
+    std::vector<Point> points;
+    for (auto &sa : m_elements[a].segments) {
+        for (auto &sb : m_elements[b].segments) {
+            ++m_last_narrow_tests;
+            auto params = geom::crossing(segment(sa), segment(sb));
+            if (params && !(at_end(params->first) && at_end(params->second))) {
+                points.push_back(point_at(sa, params->first));
+            }
+        }
+    }
+    if (points.empty()) {
+        return;
+    }
+    m_intersection_count += points.size();
+    m_crossings.emplace(pair_key(a, b), std::move(points));
+    m_elements[a].partners.push_back(b);
+    m_elements[b].partners.push_back(a);
+    m_intersection_list_dirty = true;
+}
+
+void IntersectionIndex::unlink(uint32_t idx) {
+    auto &e = m_elements[idx];
+    for (auto &key : e.cells) {
+        auto it = m_grid.find(key);
+        auto &cell = it->second;
+        cell.erase(std::find(cell.begin(), cell.end(), idx));
+        if (cell.empty()) {
+            m_grid.erase(it);
+        }
+    }
+    e.cells.clear();
+
+    for (auto partner : e.partners) {
+        auto it = m_crossings.find(pair_key(idx, partner));
+        m_intersection_count -= it->second.size();
+        m_crossings.erase(it);
+        auto &back = m_elements[partner].partners;
+        back.erase(std::find(back.begin(), back.end(), idx));
+        m_intersection_list_dirty = true;
+    }
+    e.partners.clear();
+}
+
+std::vector<IntersectionIndex::CellKey>
+IntersectionIndex::cells_of(const std::vector<Line> &segments) const {
+    auto cell_x = [&](double x) { return static_cast<int64_t>(std::floor(x / m_cell_size)); };
+    std::vector<CellKey> cells;
+    for (auto &l : segments) {
+        // Row by row, only cells the segment passes, a long diagonal wall takes a few cells per
+        // row instead of its whole bounding box.
+        const auto y0 = cell_x(std::min(l.a.y, l.b.y));
+        const auto y1 = cell_x(std::max(l.a.y, l.b.y));
+        const double dy = l.b.y - l.a.y;
+        for (int64_t y = y0; y <= y1; ++y) {
+            double x0 = std::min(l.a.x, l.b.x);
+            double x1 = std::max(l.a.x, l.b.x);
+            if (dy != 0.0) {
+                x0 = point_at(l, std::clamp((y * m_cell_size - l.a.y) / dy, 0.0, 1.0)).x;
+                x1 = point_at(l, std::clamp(((y + 1) * m_cell_size - l.a.y) / dy, 0.0, 1.0)).x;
+                if (x0 > x1) {
+                    std::swap(x0, x1);
+                }
+            }
+            for (int64_t x = cell_x(x0); x <= cell_x(x1); ++x) {
+                cells.push_back(CellKey{x, y});
+            }
+        }
+    }
+    std::sort(cells.begin(), cells.end());
+    cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+    return cells;
+}
+
+uint64_t IntersectionIndex::pair_key(uint32_t a, uint32_t b) {
+    if (a > b) {
+        std::swap(a, b);
+    }
+    return (static_cast<uint64_t>(a) << 32) | b;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "model_changes.hpp"
+#include "types.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class IntersectionElement { line, rect, guide, duct };
+
+struct IntersectionRef {
+    IntersectionElement kind = IntersectionElement::line;
+    std::string id;
+
+    bool operator==(const IntersectionRef &o) const { return kind == o.kind && id == o.id; }
+    bool operator!=(const IntersectionRef &o) const { return !(*this == o); }
+};
+
+struct IntersectionRefHash {
+    size_t operator()(const IntersectionRef &r) const {
+        return std::hash<std::string>()(r.id) ^ (static_cast<size_t>(r.kind) * 0x9e3779b9);
+    }
+};
+
+struct Intersection {
+    IntersectionRef a;
+    IntersectionRef b;
+    Point point;
+};
+
+// Keeps every crossing between underlay lines, rect edges, guides and duct centrelines, for
+// snapping and for splitting walls where something crosses them.
+//
+// Segments are registered in the cells of a uniform grid they pass through. Setting an element
+// tests it alone against what shares a cell with it, other crossings stay as they are, so a drag
+// costs the same in a large model as in a small one. Guides span the whole view and are few, they
+// are kept aside and tested against everything.
+//
+// Ends meeting ends are joints, not crossings, but an end touching the middle of another segment
+// is one, that is where a wall would be split.
+class IntersectionIndex : public IModelObserver {
+  public:
+    explicit IntersectionIndex(double cell_size = 100.0);
+
+    // Adds element or replaces its previous geometry.
+    void set_line(const LineObj &l);
+    void set_rect(const RectObj &r);
+    void set_guide(const GuideObj &g);
+    void set_duct(const Duct &d);
+    void remove(const IntersectionRef &ref);
+
+    void clear();
+    // For loading a model, edits should use methods above.
+    void rebuild(const Model &m);
+    // Follows geometry of changed lines, rects, guides and ducts.
+    void model_changed(const ModelChanges &changes) override;
+
+    const std::vector<Intersection> &intersections() const;
+    size_t intersection_count() const { return m_intersection_count; }
+    // Crossings on one element, the element is always `a`.
+    std::vector<Intersection> intersections_of(const IntersectionRef &ref) const;
+
+    // Pairs of segments passed to exact test by the last set_* call.
+    size_t last_narrow_tests() const { return m_last_narrow_tests; }
+
+  private:
+    struct CellKey {
+        int64_t x;
+        int64_t y;
+        bool operator==(const CellKey &o) const { return x == o.x && y == o.y; }
+        bool operator<(const CellKey &o) const { return x < o.x || (x == o.x && y < o.y); }
+    };
+    struct CellKeyHash {
+        size_t operator()(const CellKey &k) const {
+            return std::hash<int64_t>()(k.x) ^ (std::hash<int64_t>()(k.y) * 31);
+        }
+    };
+    struct Element {
+        IntersectionRef ref;
+        std::vector<Line> segments;
+        std::vector<CellKey> cells; // none for guides
+        std::vector<uint32_t> partners;
+    };
+
+    void set_element(IntersectionRef ref, std::vector<Line> segments);
+    void test_pair(uint32_t a, uint32_t b);
+    void unlink(uint32_t idx);
+    // Cells the segments pass through, each once.
+    std::vector<CellKey> cells_of(const std::vector<Line> &segments) const;
+    static uint64_t pair_key(uint32_t a, uint32_t b);
+
+    double m_cell_size;
+    std::vector<Element> m_elements;
+    std::vector<uint32_t> m_free;
+    std::vector<uint32_t> m_guides;
+    std::unordered_map<IntersectionRef, uint32_t, IntersectionRefHash> m_index;
+    std::unordered_map<CellKey, std::vector<uint32_t>, CellKeyHash> m_grid;
+    // Crossing points by pair, a rect edge pair or a line across a rect gives more than one.
+    std::unordered_map<uint64_t, std::vector<Point>> m_crossings;
+    size_t m_intersection_count = 0;
+
+    // Candidates are met in every cell they share, stamps let each be tested once.
+    std::vector<uint32_t> m_stamps;
+    uint32_t m_stamp = 0;
+    size_t m_last_narrow_tests = 0;
+
+    mutable std::vector<Intersection> m_intersection_list;
+    mutable bool m_intersection_list_dirty = false;
+};
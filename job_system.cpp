@@ -0,0 +1,192 @@
+#include "job_system.hpp"
+
+#include <algorithm>
+
+namespace {
+// Worker the current thread is, so that tasks spawned by tasks stay local.
+thread_local const JobSystem *t_system = nullptr;
+thread_local size_t t_worker = 0;
+} // namespace
+
+JobSystem::JobSystem(size_t threads) {
+    if (threads == 0) {
+        const size_t cores = std::thread::hardware_concurrency();
+        threads = cores > 1 ? cores - 1 : 1;
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        m_threads.emplace_back([this, i] { worker_loop(i); });
+    }
+}
+
+JobSystem::~JobSystem() {
+    cancel_all();
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_stop = true;
+    }
+    m_sleep.notify_all();
+    for (auto &t : m_threads) {
+        t.join();
+    }
+}
+
+void JobSystem::spawn(std::function<void()> task) {
+    const size_t index = t_system == this ? t_worker : m_next_worker++ % m_workers.size();
+    {
+        auto &w = *m_workers[index];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.tasks.push_front(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        ++m_queued;
+    }
+    m_sleep.notify_one();
+}
+
+void JobSystem::parallel_for(size_t n, const std::function<void(size_t)> &f) {
+    if (n == 0) {
+        return;
+    }
+    struct Batch {
+        std::atomic<size_t> remaining;
+        std::mutex mutex;
+        std::condition_variable all_done;
+        std::exception_ptr error;
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->remaining = n;
+    for (size_t i = 0; i < n; ++i) {
+        spawn([batch, &f, i] {
+            try {
+                f(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                batch->error = std::current_exception();
+            }
+            if (--batch->remaining == 0) {
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                batch->all_done.notify_all();
+            }
+        });
+    }
+
+    if (t_system == this) {
+        // Blocking here could leave every worker waiting on work queued behind it.
+        while (batch->remaining > 0) {
+            if (!run_one(t_worker)) {
+                std::this_thread::yield();
+            }
+        }
+    } else {
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->all_done.wait(lock, [&] { return batch->remaining == 0; });
+    }
+    if (batch->error) {
+        std::rethrow_exception(batch->error);
+    }
+}
+
+void JobSystem::set_wakeup(std::function<void()> wakeup) {
+    std::lock_guard<std::mutex> lock(m_jobs_mutex);
+    m_wakeup = std::move(wakeup);
+}
+
+size_t JobSystem::deliver() {
+    std::vector<Completion> completions;
+    {
+        std::lock_guard<std::mutex> lock(m_jobs_mutex);
+        completions.swap(m_completions);
+        for (auto &c : completions) {
+            m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), c.job));
+        }
+    }
+    for (auto &c : completions) {
+        // Cancelled after its work returned, the result is dropped all the same.
+        if (c.state == JobState::finished && c.job->cancelled()) {
+            c.state = JobState::cancelled;
+        }
+        c.job->m_state.store(c.state);
+        if (c.state == JobState::finished) {
+            c.job->set_progress(1.0);
+            c.callback();
+        }
+        if (m_observer) {
+            m_observer->job_done(*c.job);
+        }
+    }
+    return completions.size();
+}
+
+std::vector<JobHandle> JobSystem::active() const {
+    std::lock_guard<std::mutex> lock(m_jobs_mutex);
+    return m_jobs;
+}
+
+void JobSystem::cancel_all() {
+    std::lock_guard<std::mutex> lock(m_jobs_mutex);
+    for (auto &job : m_jobs) {
+        job->cancel();
+    }
+}
+
+void JobSystem::worker_loop(size_t index) {
+    t_system = this;
+    t_worker = index;
+    while (true) {
+        if (run_one(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_sleep.wait(lock, [this] { return m_stop || m_queued > 0; });
+        if (m_stop) {
+            return;
+        }
+    }
+}
+
+bool JobSystem::run_one(size_t index) {
+    std::function<void()> task;
+    // Own queue first, newest task first, its data is likely still in cache.
+    for (size_t k = 0; k < m_workers.size() && !task; ++k) {
+        auto &w = *m_workers[(index + k) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (w.tasks.empty()) {
+            continue;
+        }
+        if (k == 0) {
+            task = std::move(w.tasks.front());
+            w.tasks.pop_front();
+        } else {
+            // Stolen from the other end, oldest tasks tend to be the largest.
+            task = std::move(w.tasks.back());
+            w.tasks.pop_back();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    --m_queued;
+    task();
+    return true;
+}
+
+void JobSystem::add_job(const JobHandle &job) {
+    std::lock_guard<std::mutex> lock(m_jobs_mutex);
+    m_jobs.push_back(job);
+}
+
+void JobSystem::finish(const JobHandle &job, JobState state, std::function<void()> completion) {
+    std::function<void()> wakeup;
+    {
+        std::lock_guard<std::mutex> lock(m_jobs_mutex);
+        m_completions.push_back(Completion{job, state, std::move(completion)});
+        wakeup = m_wakeup;
+    }
+    if (wakeup) {
+        wakeup();
+    }
+}
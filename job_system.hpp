@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+enum class JobState { queued, running, finished, cancelled, failed };
+
+// Thrown by Job::throw_if_cancelled, the scheduler takes it as the job giving up.
+struct JobCancelled : std::exception {
+    const char *what() const noexcept override { return "job cancelled"; }
+};
+
+// Long operation run by JobSystem. Work sees it to report progress and to notice cancellation,
+// whoever started it keeps a handle to watch or cancel it.
+class Job {
+  public:
+    explicit Job(std::string name) : m_name(std::move(name)) {}
+
+    const std::string &name() const { return m_name; }
+    // Jobs become done when delivered, see JobSystem::deliver.
+    JobState state() const { return m_state.load(); }
+    bool done() const { return m_state.load() > JobState::running; }
+    // Fraction done, [0, 1].
+    double progress() const { return m_progress.load(); }
+    void set_progress(double fraction) { m_progress.store(fraction); }
+
+    // Work is expected to check from time to time and stop early, its result is dropped anyway.
+    void cancel() { m_cancelled.store(true); }
+    bool cancelled() const { return m_cancelled.load(); }
+    void throw_if_cancelled() const {
+        if (cancelled()) {
+            throw JobCancelled{};
+        }
+    }
+
+    // What the work threw, for failed jobs. Valid once the job is done.
+    const std::string &error() const { return m_error; }
+
+  private:
+    friend class JobSystem;
+
+    std::string m_name;
+    std::atomic<JobState> m_state{JobState::queued};
+    std::atomic<double> m_progress{0.0};
+    std::atomic<bool> m_cancelled{false};
+    std::string m_error;
+};
+
+using JobHandle = std::shared_ptr<Job>;
+
+// Told about jobs as they are delivered, on the thread calling JobSystem::deliver.
+class IJobObserver {
+  public:
+    virtual ~IJobObserver() = default;
+    virtual void job_done(const Job &job) = 0;
+};
+
+// Runs long operations off the GUI thread: imports, exports, solvers.
+//
+// Every worker has its own queue. Tasks spawned by a running task go to the front of its worker's
+// queue and are taken from there first, while workers which ran out of tasks steal from the back
+// of the others', so work split by a job spreads over idle cores without a shared queue.
+//
+// Results come back through deliver(), which calls completion callbacks on the thread calling it.
+// The GUI calls it from its event loop whenever the wakeup callback asks for it, so completions
+// run where the model can be touched.
+class JobSystem {
+  public:
+    // Zero threads means one less than there are cores, at least one.
+    explicit JobSystem(size_t threads = 0);
+    // Cancels jobs and waits for running tasks, completions not delivered yet are dropped.
+    ~JobSystem();
+
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    // Runs `work(Job &)` on a worker. Once it returns, `done` gets its result on the delivering
+    // thread, unless the job was cancelled meanwhile or threw.
+    template <typename Work, typename Done>
+    JobHandle run(std::string name, Work work, Done done);
+
+    // Queues a task, from a task it goes to the running worker's own queue.
+    void spawn(std::function<void()> task);
+    // Calls `f(i)` for every i in [0, n) on workers and returns when all calls did. A worker
+    // calling it runs tasks meanwhile instead of blocking.
+    void parallel_for(size_t n, const std::function<void(size_t)> &f);
+
+    // Called from workers when there is something to deliver, with no lock held.
+    void set_wakeup(std::function<void()> wakeup);
+    void set_observer(IJobObserver *observer) { m_observer = observer; }
+    // Calls completions of finished jobs, returns number of jobs delivered.
+    size_t deliver();
+
+    // Jobs started and not delivered yet.
+    std::vector<JobHandle> active() const;
+    void cancel_all();
+    size_t thread_count() const { return m_threads.size(); }
+
+  private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+    struct Completion {
+        JobHandle job;
+        JobState state;
+        std::function<void()> callback;
+    };
+
+    void worker_loop(size_t index);
+    bool run_one(size_t index);
+    void add_job(const JobHandle &job);
+    // Queues delivery of the job in `state`, `completion` may be empty.
+    void finish(const JobHandle &job, JobState state, std::function<void()> completion);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    std::atomic<size_t> m_next_worker{0};
+
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_sleep;
+    std::atomic<size_t> m_queued{0};
+    bool m_stop = false;
+
+    mutable std::mutex m_jobs_mutex;
+    std::vector<JobHandle> m_jobs;
+    std::vector<Completion> m_completions;
+    std::function<void()> m_wakeup;
+    IJobObserver *m_observer = nullptr;
+};
+
+template <typename Work, typename Done>
+JobHandle JobSystem::run(std::string name, Work work, Done done) {
+    using Result = std::invoke_result_t<Work &, Job &>;
+    auto job = std::make_shared<Job>(std::move(name));
+    add_job(job);
+    // Work and result are moved once, tasks and completions only share them.
+    auto shared_work = std::make_shared<Work>(std::move(work));
+    auto shared_done = std::make_shared<Done>(std::move(done));
+    spawn([this, job, shared_work, shared_done] {
+        if (job->cancelled()) {
+            finish(job, JobState::cancelled, {});
+            return;
+        }
+        job->m_state.store(JobState::running);
+        try {
+            if constexpr (std::is_void_v<Result>) {
+                (*shared_work)(*job);
+                job->throw_if_cancelled();
+                finish(job, JobState::finished, [shared_done] { (*shared_done)(); });
+            } else {
+                auto result = std::make_shared<Result>((*shared_work)(*job));
+                job->throw_if_cancelled();
+                finish(job, JobState::finished,
+                       [shared_done, result] { (*shared_done)(std::move(*result)); });
+            }
+        } catch (const JobCancelled &) {
+            finish(job, JobState::cancelled, {});
+        } catch (const std::exception &e) {
+            job->m_error = e.what();
+            finish(job, JobState::failed, {});
+        } catch (...) {
+            job->m_error = "unknown error";
+            finish(job, JobState::failed, {});
+        }
+    });
+    return job;
+}
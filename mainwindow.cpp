@@ -2,18 +2,57 @@
 #include "./ui_mainwindow.h"
 
 #include "canvas_widget.hpp"
+#include "catalogue_file.hpp"
 #include "layers_window.hpp"
+#include "mesh_export.hpp"
 #include "toolbox.hpp"
 
 #include <QDebug>
+#include <QFileDialog>
+#include <QFileInfo>
 #include <QHBoxLayout>
+#include <QMenuBar>
+#include <QMessageBox>
 #include <QMouseEvent>
 #include <QPaintEvent>
 #include <QPainter>
 #include <QPushButton>
 #include <QSpacerItem>
+#include <QStatusBar>
 #include <QVBoxLayout>
 
+#include <algorithm>
+#include <fstream>
+
+namespace {
+const int JOB_PROGRESS_INTERVAL_MS = 100;
+
+// Forwards meshes to the file writer, reporting progress and giving up when the job is cancelled.
+class JobMeshSink : public IMeshSink {
+  public:
+    JobMeshSink(IMeshSink &sink, Job &job, size_t elements)
+        : m_sink(sink), m_job(job), m_elements(elements) {}
+
+    void begin_group(const std::string &name) override { m_sink.begin_group(name); }
+    void add_mesh(const std::string &name, const MeshVertex *vertices, size_t vertex_count,
+                  const uint32_t *indices, size_t index_count) override {
+        m_job.throw_if_cancelled();
+        m_sink.add_mesh(name, vertices, vertex_count, indices, index_count);
+        if (m_elements > 0) {
+            m_job.set_progress(std::min(1.0, static_cast<double>(++m_added) / m_elements));
+        }
+    }
+    void end_group() override { m_sink.end_group(); }
+    bool finish() override { return m_sink.finish(); }
+
+  private:
+    IMeshSink &m_sink;
+    Job &m_job;
+    size_t m_elements;
+    size_t m_added = 0;
+};
+} // namespace
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent), ui(new Ui::MainWindow), m_canvas_widget(new CanvasWidget{this}),
       m_toolbox(new ToolBox{this}) {
@@ -33,9 +72,138 @@ MainWindow::MainWindow(QWidget *parent)
     auto *horizontal_layout = new QHBoxLayout(centralWidget());
     horizontal_layout->setContentsMargins(0, 0, 0, 0);
     horizontal_layout->addWidget(m_canvas_widget);
+
+    auto *file_menu = menuBar()->addMenu("File");
+    file_menu->addAction("Open catalogue...", this, &MainWindow::open_catalogue);
+    file_menu->addAction("Export bill of materials...", this,
+                         &MainWindow::export_bill_of_materials);
+    file_menu->addAction("Export 3D model...", this, &MainWindow::export_3d_model);
+
+    auto *edit_menu = menuBar()->addMenu("Edit");
+    edit_menu->addAction("Undo", m_canvas_widget, &CanvasWidget::undo)
+        ->setShortcut(QKeySequence::Undo);
+    edit_menu->addAction("Redo", m_canvas_widget, &CanvasWidget::redo)
+        ->setShortcut(QKeySequence::Redo);
+    edit_menu->addSeparator();
+    edit_menu->addAction("Cancel background jobs", this,
+                         [this] { m_canvas_widget->jobs().cancel_all(); });
+
+    auto *ducts_menu = menuBar()->addMenu("Ducts");
+    ducts_menu->addAction("Size by equal friction...", this,
+                          [this] { size_ducts(SizingMethod::equal_friction); });
+    ducts_menu->addAction("Size by velocity...", this,
+                          [this] { size_ducts(SizingMethod::velocity); });
+    ducts_menu->addAction("Size by static regain...", this,
+                          [this] { size_ducts(SizingMethod::static_regain); });
+
+    m_canvas_widget->jobs().set_observer(this);
+    connect(&m_job_progress_timer, &QTimer::timeout, this, &MainWindow::show_job_progress);
+    m_job_progress_timer.start(JOB_PROGRESS_INTERVAL_MS);
+}
+
+MainWindow::~MainWindow() { m_canvas_widget->jobs().set_observer(nullptr); }
+
+void MainWindow::job_done(const Job &job) {
+    if (job.state() == JobState::failed) {
+        QMessageBox::warning(this, QString::fromStdString(job.name()),
+                             QString::fromStdString(job.error()));
+    }
 }
 
-MainWindow::~MainWindow() = default;
+void MainWindow::show_job_progress() {
+    QStringList running;
+    for (auto &job : m_canvas_widget->jobs().active()) {
+        running << QString("%1 %2%")
+                       .arg(QString::fromStdString(job->name()))
+                       .arg(static_cast<int>(job->progress() * 100));
+    }
+    if (running.isEmpty()) {
+        statusBar()->clearMessage();
+    } else {
+        statusBar()->showMessage(running.join(", "));
+    }
+}
 
 void MainWindow::resizeEvent(QResizeEvent *event) { m_toolbox->move(width() - 100, 30); }
 
+void MainWindow::export_bill_of_materials() {
+    auto path = QFileDialog::getSaveFileName(this, "Export bill of materials", "bom.csv",
+                                             "CSV files (*.csv)");
+    if (path.isEmpty()) {
+        return;
+    }
+    std::ofstream out(path.toStdString());
+    m_canvas_widget->bill_of_materials().write_csv(out);
+    if (!out) {
+        QMessageBox::warning(this, "Export bill of materials", "Failed to write " + path);
+    }
+}
+
+void MainWindow::export_3d_model() {
+    auto path = QFileDialog::getSaveFileName(this, "Export 3D model", "ducts.gltf",
+                                             "glTF (*.gltf);;Wavefront OBJ (*.obj)");
+    if (path.isEmpty()) {
+        return;
+    }
+    // Written from a copy, the model can be edited while the export runs.
+    auto model = std::make_shared<Model>(m_canvas_widget->model());
+    const bool obj = path.endsWith(".obj");
+    // glTF geometry goes next to the JSON part, referenced by file name only.
+    const QString bin_path = path.left(path.lastIndexOf('.')) + ".bin";
+    auto work = [model, obj, path = path.toStdString(), bin_path = bin_path.toStdString(),
+                 bin_uri = QFileInfo(bin_path).fileName().toStdString()](Job &job) {
+        // Only one floor is drawn for now.
+        const std::vector<FloorModel> floors{FloorModel{model.get(), 0.0, "floor 0"}};
+        const size_t elements = model->ducts.size() + model->fittings.size();
+        if (obj) {
+            std::ofstream out(path);
+            ObjWriter writer(out);
+            JobMeshSink sink(writer, job, elements);
+            return generate_meshes(floors, MeshSettings{}, sink);
+        }
+        std::ofstream json(path);
+        std::ofstream bin(bin_path, std::ios::binary);
+        GltfWriter writer(json, bin, bin_uri);
+        JobMeshSink sink(writer, job, elements);
+        return generate_meshes(floors, MeshSettings{}, sink);
+    };
+    m_canvas_widget->jobs().run("Export 3D model", std::move(work), [this, path](bool written) {
+        if (!written) {
+            QMessageBox::warning(this, "Export 3D model", "Failed to write " + path);
+        }
+    });
+}
+
+void MainWindow::open_catalogue() {
+    auto path = QFileDialog::getOpenFileName(this, "Open catalogue", {}, "Catalogues (*.pcat)");
+    if (path.isEmpty()) {
+        return;
+    }
+    auto catalogue = load_catalogue(path);
+    if (!catalogue) {
+        QMessageBox::warning(this, "Open catalogue", "Not a valid catalogue: " + path);
+        return;
+    }
+    m_canvas_widget->set_catalogue(std::move(*catalogue));
+}
+
+void MainWindow::size_ducts(SizingMethod method) {
+    if (m_sizing_job && !m_sizing_job->done()) {
+        return;
+    }
+    m_sizing_job = m_canvas_widget->preview_duct_sizes(method, [this](size_t changes) {
+        if (changes == 0) {
+            QMessageBox::information(this, "Size ducts",
+                                     "All ducts already have proposed sizes.");
+            return;
+        }
+        // Proposed sizes stay drawn on the canvas while the question is shown.
+        const auto answer =
+            QMessageBox::question(this, "Size ducts", QString("Resize %1 ducts?").arg(changes));
+        if (answer == QMessageBox::Yes) {
+            m_canvas_widget->apply_duct_sizes();
+        } else {
+            m_canvas_widget->discard_duct_sizes();
+        }
+    });
+}
@@ -1,7 +1,11 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include "duct_sizing.hpp"
+#include "job_system.hpp"
+
 #include <QMainWindow>
+#include <QTimer>
 #include <memory>
 
 QT_BEGIN_NAMESPACE
@@ -18,7 +22,7 @@ class LayersWindow;
 
 
 
-class MainWindow : public QMainWindow {
+class MainWindow : public QMainWindow, public IJobObserver {
     Q_OBJECT
 
   public:
@@ -28,9 +32,22 @@ class MainWindow : public QMainWindow {
   protected:
     void resizeEvent(QResizeEvent *event);
 
+  public: // IJobObserver
+    void job_done(const Job &job) override;
+
+  private slots:
+    void export_bill_of_materials();
+    void export_3d_model();
+    void open_catalogue();
+    void size_ducts(SizingMethod method);
+    // Names and progress of running jobs in the status bar.
+    void show_job_progress();
+
   private:
     std::unique_ptr<Ui::MainWindow> ui;
     CanvasWidget *m_canvas_widget{};
     ToolBox *m_toolbox{};
+    QTimer m_job_progress_timer;
+    JobHandle m_sizing_job;
 };
 #endif // MAINWINDOW_H
@@ -1,8 +1,11 @@
-#pragma
+#pragma once
 
 #include "types.hpp"
 #include "v2.hpp"
 
+#include <algorithm>
+#include <array>
+
 namespace math {
 
 inline double points_distance(Point a, Point b) { return len(v2{a, b}); }
@@ -19,7 +22,7 @@ inline Point closest_point_to_line(Point a, Point b, Point c) {
     return R;
 }
 
-int wrap_index(size_t index, size_t n) { return ((index % n) + n) % n; }
+inline int wrap_index(size_t index, size_t n) { return ((index % n) + n) % n; }
 
 inline bool rect_point_hit_test(std::array<Point, 4> rect, Point p) {
     for (size_t i = 1; i < 5; ++i) {
@@ -0,0 +1,313 @@
+#include "mesh_export.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+static_assert(sizeof(MeshVertex) == 6 * sizeof(float));
+
+namespace {
+const unsigned GLTF_FLOAT = 5126;
+const unsigned GLTF_UNSIGNED_INT = 5125;
+const unsigned GLTF_ARRAY_BUFFER = 34962;
+const unsigned GLTF_ELEMENT_ARRAY_BUFFER = 34963;
+
+struct Vec3 {
+    double x, y, z;
+};
+
+Vec3 operator+(Vec3 a, Vec3 b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+Vec3 operator-(Vec3 a, Vec3 b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+Vec3 operator*(Vec3 a, double s) { return {a.x * s, a.y * s, a.z * s}; }
+double length(Vec3 a) { return std::sqrt(a.x * a.x + a.y * a.y + a.z * a.z); }
+
+// Plan point in world centimetres at given height in metres.
+Vec3 to_3d(Point p, double y) { return {p.x / 100.0, y, p.y / 100.0}; }
+
+MeshVertex vertex(Vec3 p, Vec3 n) {
+    return MeshVertex{{static_cast<float>(p.x), static_cast<float>(p.y), static_cast<float>(p.z)},
+                      {static_cast<float>(n.x), static_cast<float>(n.y), static_cast<float>(n.z)}};
+}
+
+// Capped frustum around horizontal axis `a`-`b`, radius going from `ra` to `rb`.
+void add_frustum(Vec3 a, Vec3 b, double ra, double rb, const MeshSettings &settings,
+                 std::vector<MeshVertex> &vertices, std::vector<uint32_t> &indices) {
+    const double l = length(b - a);
+    if (l == 0.0 || std::max(ra, rb) <= 0.0) {
+        return;
+    }
+    const Vec3 dir = (b - a) * (1.0 / l);
+    const Vec3 up{0.0, 1.0, 0.0};
+    const Vec3 side{-dir.z, 0.0, dir.x};
+
+    const int wanted = static_cast<int>(std::ceil(2.0 * M_PI * std::max(ra, rb) /
+                                                  settings.max_side_m));
+    const auto n =
+        static_cast<uint32_t>(std::clamp(wanted, settings.min_sides, settings.max_sides));
+    const double slope = (rb - ra) / l;
+
+    auto base = static_cast<uint32_t>(vertices.size());
+    for (uint32_t k = 0; k < n; ++k) {
+        const double theta = 2.0 * M_PI * k / n;
+        const Vec3 radial = up * std::cos(theta) + side * std::sin(theta);
+        const Vec3 normal = radial - dir * slope;
+        const Vec3 unit_normal = normal * (1.0 / length(normal));
+        vertices.push_back(vertex(a + radial * ra, unit_normal));
+        vertices.push_back(vertex(b + radial * rb, unit_normal));
+    }
+    for (uint32_t k = 0; k < n; ++k) {
+        const uint32_t a0 = base + 2 * k;
+        const uint32_t b0 = a0 + 1;
+        const uint32_t a1 = base + 2 * ((k + 1) % n);
+        const uint32_t b1 = a1 + 1;
+        indices.insert(indices.end(), {a0, a1, b0, a1, b1, b0});
+    }
+
+    // Caps, with own vertices so that edges stay sharp.
+    auto add_cap = [&](Vec3 center, double radius, bool at_end) {
+        if (radius <= 0.0) {
+            return;
+        }
+        base = static_cast<uint32_t>(vertices.size());
+        const Vec3 normal = at_end ? dir : dir * -1.0;
+        vertices.push_back(vertex(center, normal));
+        for (uint32_t k = 0; k < n; ++k) {
+            const double theta = 2.0 * M_PI * k / n;
+            const Vec3 radial = up * std::cos(theta) + side * std::sin(theta);
+            vertices.push_back(vertex(center + radial * radius, normal));
+        }
+        for (uint32_t k = 0; k < n; ++k) {
+            const uint32_t r0 = base + 1 + k;
+            const uint32_t r1 = base + 1 + (k + 1) % n;
+            if (at_end) {
+                indices.insert(indices.end(), {base, r0, r1});
+            } else {
+                indices.insert(indices.end(), {base, r1, r0});
+            }
+        }
+    };
+    add_cap(a, ra, false);
+    add_cap(b, rb, true);
+}
+
+std::string json_escaped(const std::string &s) {
+    std::string result;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            result.push_back('\\');
+        }
+        result.push_back(c);
+    }
+    return result;
+}
+} // namespace
+
+bool generate_meshes(const std::vector<FloorModel> &floors, const MeshSettings &settings,
+                     IMeshSink &sink) {
+    // Reused for every element, never holds more than one.
+    std::vector<MeshVertex> vertices;
+    std::vector<uint32_t> indices;
+    auto add_element = [&](const std::string &name) {
+        if (!vertices.empty()) {
+            sink.add_mesh(name, vertices.data(), vertices.size(), indices.data(), indices.size());
+        }
+        vertices.clear();
+        indices.clear();
+    };
+
+    for (auto &floor : floors) {
+        const double y = floor.elevation_m + settings.duct_elevation_m;
+        sink.begin_group(floor.name);
+        for (auto &d : floor.model->ducts) {
+            const double r = d.size_mm / 2000.0;
+            add_frustum(to_3d(d.begin, y), to_3d(d.end, y), r, r, settings, vertices, indices);
+            add_element("duct_" + d.id);
+        }
+        for (auto &f : floor.model->fittings) {
+            // Split has no body of its own yet.
+            if (auto adapter = std::get_if<Adapter>(&f.fitting_variant)) {
+                const Point begin(f.center.x + adapter->begin.x, f.center.y + adapter->begin.y);
+                const Point end(f.center.x + adapter->end.x, f.center.y + adapter->end.y);
+                add_frustum(to_3d(begin, y), to_3d(end, y), adapter->begin_d / 200.0,
+                            adapter->end_d / 200.0, settings, vertices, indices);
+                add_element("fitting_" + f.id);
+            }
+        }
+        sink.end_group();
+    }
+    return sink.finish();
+}
+
+ObjWriter::ObjWriter(std::ostream &os) : m_os(os) { m_os << "# pipd\n"; }
+
+void ObjWriter::begin_group(const std::string &name) { m_os << "g " << name << "\n"; }
+
+void ObjWriter::add_mesh(const std::string &name, const MeshVertex *vertices,
+                         size_t vertex_count, const uint32_t *indices, size_t index_count) {
+    // Formatted by hand, stream formatting of floats dominates export time otherwise.
+    char line[128];
+    m_os << "o " << name << "\n";
+    for (size_t i = 0; i < vertex_count; ++i) {
+        auto &p = vertices[i].position;
+        int n = std::snprintf(line, sizeof(line), "v %.4f %.4f %.4f\n", p[0], p[1], p[2]);
+        m_os.write(line, n);
+    }
+    for (size_t i = 0; i < vertex_count; ++i) {
+        auto &v = vertices[i].normal;
+        int n = std::snprintf(line, sizeof(line), "vn %.4f %.4f %.4f\n", v[0], v[1], v[2]);
+        m_os.write(line, n);
+    }
+    // OBJ indices are global and one based.
+    const size_t base = m_vertices_written + 1;
+    for (size_t i = 0; i + 2 < index_count; i += 3) {
+        const size_t a = base + indices[i];
+        const size_t b = base + indices[i + 1];
+        const size_t c = base + indices[i + 2];
+        int n = std::snprintf(line, sizeof(line), "f %zu//%zu %zu//%zu %zu//%zu\n", a, a, b, b, c,
+                              c);
+        m_os.write(line, n);
+    }
+    m_vertices_written += vertex_count;
+}
+
+bool ObjWriter::finish() {
+    m_os.flush();
+    return static_cast<bool>(m_os);
+}
+
+GltfWriter::GltfWriter(std::ostream &json, std::ostream &bin, std::string bin_uri)
+    : m_json(json), m_bin(bin), m_bin_uri(std::move(bin_uri)) {}
+
+void GltfWriter::begin_group(const std::string &name) { m_groups.push_back(Group{name, {}}); }
+
+void GltfWriter::add_mesh(const std::string &, const MeshVertex *vertices, size_t vertex_count,
+                          const uint32_t *indices, size_t index_count) {
+    if (m_groups.empty()) {
+        begin_group({});
+    }
+    if (m_chunk_open &&
+        m_groups.back().chunks.back().vertex_count + vertex_count > CHUNK_VERTICES) {
+        close_chunk();
+    }
+    if (!m_chunk_open) {
+        Chunk chunk;
+        chunk.vertex_offset = m_bin_size;
+        chunk.min.fill(std::numeric_limits<float>::max());
+        chunk.max.fill(std::numeric_limits<float>::lowest());
+        m_groups.back().chunks.push_back(chunk);
+        m_chunk_open = true;
+    }
+
+    auto &chunk = m_groups.back().chunks.back();
+    const auto base = static_cast<uint32_t>(chunk.vertex_count);
+    for (size_t i = 0; i < index_count; ++i) {
+        m_chunk_indices.push_back(base + indices[i]);
+    }
+    for (size_t i = 0; i < vertex_count; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            chunk.min[k] = std::min(chunk.min[k], vertices[i].position[k]);
+            chunk.max[k] = std::max(chunk.max[k], vertices[i].position[k]);
+        }
+    }
+    const size_t bytes = vertex_count * sizeof(MeshVertex);
+    m_bin.write(reinterpret_cast<const char *>(vertices), static_cast<std::streamsize>(bytes));
+    m_bin_size += bytes;
+    chunk.vertex_count += vertex_count;
+}
+
+void GltfWriter::end_group() {
+    if (m_chunk_open) {
+        close_chunk();
+    }
+}
+
+void GltfWriter::close_chunk() {
+    auto &chunk = m_groups.back().chunks.back();
+    chunk.index_offset = m_bin_size;
+    chunk.index_count = m_chunk_indices.size();
+    const size_t bytes = m_chunk_indices.size() * sizeof(uint32_t);
+    m_bin.write(reinterpret_cast<const char *>(m_chunk_indices.data()),
+                static_cast<std::streamsize>(bytes));
+    m_bin_size += bytes;
+    m_chunk_indices.clear();
+    m_chunk_open = false;
+}
+
+bool GltfWriter::finish() {
+    end_group();
+
+    std::string nodes, meshes, views, accessors;
+    size_t mesh_count = 0;
+    size_t accessor_count = 0;
+    char buf[512];
+    auto append = [](std::string &list, const char *item) {
+        if (!list.empty()) {
+            list.push_back(',');
+        }
+        list.append(item);
+    };
+
+    for (auto &group : m_groups) {
+        if (group.chunks.empty()) {
+            continue;
+        }
+        std::string primitives;
+        for (auto &c : group.chunks) {
+            const size_t vertex_view = accessor_count / 3 * 2;
+            std::snprintf(buf, sizeof(buf),
+                          "{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,"
+                          "\"byteStride\":%zu,\"target\":%u}",
+                          c.vertex_offset, c.vertex_count * sizeof(MeshVertex), sizeof(MeshVertex),
+                          GLTF_ARRAY_BUFFER);
+            append(views, buf);
+            std::snprintf(buf, sizeof(buf),
+                          "{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"target\":%u}",
+                          c.index_offset, c.index_count * sizeof(uint32_t),
+                          GLTF_ELEMENT_ARRAY_BUFFER);
+            append(views, buf);
+
+            std::snprintf(buf, sizeof(buf),
+                          "{\"bufferView\":%zu,\"componentType\":%u,\"count\":%zu,"
+                          "\"type\":\"VEC3\",\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]}",
+                          vertex_view, GLTF_FLOAT, c.vertex_count, c.min[0], c.min[1], c.min[2],
+                          c.max[0], c.max[1], c.max[2]);
+            append(accessors, buf);
+            std::snprintf(buf, sizeof(buf),
+                          "{\"bufferView\":%zu,\"byteOffset\":12,\"componentType\":%u,"
+                          "\"count\":%zu,\"type\":\"VEC3\"}",
+                          vertex_view, GLTF_FLOAT, c.vertex_count);
+            append(accessors, buf);
+            std::snprintf(buf, sizeof(buf),
+                          "{\"bufferView\":%zu,\"componentType\":%u,\"count\":%zu,"
+                          "\"type\":\"SCALAR\"}",
+                          vertex_view + 1, GLTF_UNSIGNED_INT, c.index_count);
+            append(accessors, buf);
+
+            std::snprintf(buf, sizeof(buf),
+                          "{\"attributes\":{\"POSITION\":%zu,\"NORMAL\":%zu},\"indices\":%zu}",
+                          accessor_count, accessor_count + 1, accessor_count + 2);
+            append(primitives, buf);
+            accessor_count += 3;
+        }
+        const std::string name = json_escaped(group.name);
+        append(meshes, ("{\"name\":\"" + name + "\",\"primitives\":[" + primitives + "]}").c_str());
+        std::snprintf(buf, sizeof(buf), "{\"mesh\":%zu,", mesh_count++);
+        append(nodes, (buf + ("\"name\":\"" + name + "\"}")).c_str());
+    }
+
+    std::string scene_nodes;
+    for (size_t i = 0; i < mesh_count; ++i) {
+        append(scene_nodes, std::to_string(i).c_str());
+    }
+
+    m_json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"pipd\"},"
+           << "\"scene\":0,\"scenes\":[{\"nodes\":[" << scene_nodes << "]}],"
+           << "\"nodes\":[" << nodes << "],\"meshes\":[" << meshes << "],"
+           << "\"buffers\":[{\"uri\":\"" << json_escaped(m_bin_uri)
+           << "\",\"byteLength\":" << m_bin_size << "}],"
+           << "\"bufferViews\":[" << views << "],\"accessors\":[" << accessors << "]}\n";
+    m_json.flush();
+    m_bin.flush();
+    return static_cast<bool>(m_json) && static_cast<bool>(m_bin);
+}
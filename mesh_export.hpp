@@ -0,0 +1,109 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Exported coordinates are metres, Y up. Plan x goes to X and plan y goes to Z, so that the model
+// seen from above looks the same as on the canvas.
+struct MeshVertex {
+    float position[3];
+    float normal[3];
+};
+
+struct MeshSettings {
+    double duct_elevation_m = 2.7; // duct axis above floor level
+    // Round sections get as many sides as needed to keep each side shorter than this, so
+    // small ducts stay light and large ones stay round.
+    double max_side_m = 0.05;
+    int min_sides = 8;
+    int max_sides = 48;
+};
+
+// One plan of the building.
+struct FloorModel {
+    const Model *model = nullptr;
+    double elevation_m = 0.0;
+    std::string name;
+};
+
+// Receives meshes one element at a time, nothing is kept by the generator between elements.
+class IMeshSink {
+  public:
+    virtual ~IMeshSink() = default;
+
+    virtual void begin_group(const std::string &name) = 0;
+    // Indices are triangles relative to `vertices`.
+    virtual void add_mesh(const std::string &name, const MeshVertex *vertices,
+                          size_t vertex_count, const uint32_t *indices, size_t index_count) = 0;
+    virtual void end_group() = 0;
+    // Returns false when writing failed.
+    virtual bool finish() = 0;
+};
+
+// Ducts become capped cylinders and adapters capped cones, one group per floor. Returns what
+// sink's finish() returned.
+bool generate_meshes(const std::vector<FloorModel> &floors, const MeshSettings &settings,
+                     IMeshSink &sink);
+
+// Wavefront OBJ, every element is a separate object.
+class ObjWriter : public IMeshSink {
+  public:
+    explicit ObjWriter(std::ostream &os);
+
+    void begin_group(const std::string &name) override;
+    void add_mesh(const std::string &name, const MeshVertex *vertices, size_t vertex_count,
+                  const uint32_t *indices, size_t index_count) override;
+    void end_group() override {}
+    bool finish() override;
+
+  private:
+    std::ostream &m_os;
+    size_t m_vertices_written = 0;
+};
+
+// glTF 2.0 with geometry in a separate binary file referenced by `bin_uri`.
+//
+// Vertices go to the binary stream as they come. Elements of a floor are merged into primitives
+// of at most CHUNK_VERTICES vertices, only indices of the current chunk are held back until it
+// is closed. The JSON part only describes chunks, it is written by finish().
+class GltfWriter : public IMeshSink {
+  public:
+    static constexpr size_t CHUNK_VERTICES = 1 << 16;
+
+    GltfWriter(std::ostream &json, std::ostream &bin, std::string bin_uri);
+
+    void begin_group(const std::string &name) override;
+    void add_mesh(const std::string &name, const MeshVertex *vertices, size_t vertex_count,
+                  const uint32_t *indices, size_t index_count) override;
+    void end_group() override;
+    bool finish() override;
+
+  private:
+    struct Chunk {
+        size_t vertex_offset = 0; // bytes in binary stream
+        size_t vertex_count = 0;
+        size_t index_offset = 0;
+        size_t index_count = 0;
+        std::array<float, 3> min;
+        std::array<float, 3> max;
+    };
+    struct Group {
+        std::string name;
+        std::vector<Chunk> chunks;
+    };
+
+    void close_chunk();
+
+    std::ostream &m_json;
+    std::ostream &m_bin;
+    std::string m_bin_uri;
+    size_t m_bin_size = 0;
+    std::vector<Group> m_groups;
+    bool m_chunk_open = false;
+    std::vector<uint32_t> m_chunk_indices;
+};
@@ -0,0 +1,113 @@
+#include "model_changes.hpp"
+
+#include <algorithm>
+
+namespace {
+bool same(Point a, Point b) { return a.x == b.x && a.y == b.y; }
+bool same(Line a, Line b) { return same(a.a, b.a) && same(a.b, b.b); }
+bool same(const Rect &a, const Rect &b) {
+    return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height;
+}
+
+unsigned flags_field(unsigned before, unsigned after) {
+    return before != after ? unsigned(ChangedField::other) : 0u;
+}
+
+template <class T> void take(std::vector<ElementChange<T>> &to, std::vector<ElementChange<T>> &from,
+                             std::unordered_map<std::string, size_t> &index) {
+    to = std::move(from);
+    from.clear();
+    index.clear();
+}
+} // namespace
+
+unsigned changed_fields(const PointObj &before, const PointObj &after) {
+    return same(before.pt, after.pt) ? 0u : unsigned(ChangedField::geometry);
+}
+
+unsigned changed_fields(const LineObj &before, const LineObj &after) {
+    // Shadow and flags are editor state of a move in progress.
+    unsigned fields = same(before.l, after.l) ? 0u : unsigned(ChangedField::geometry);
+    if (before.endpoint_a_ref != after.endpoint_a_ref ||
+        before.endpoint_b_ref != after.endpoint_b_ref) {
+        fields |= ChangedField::links;
+    }
+    return fields;
+}
+
+unsigned changed_fields(const GuideObj &before, const GuideObj &after) {
+    return same(before.line, after.line) ? 0u : unsigned(ChangedField::geometry);
+}
+
+unsigned changed_fields(const RectObj &before, const RectObj &after) {
+    return same(before.rect, after.rect) ? 0u : unsigned(ChangedField::geometry);
+}
+
+unsigned changed_fields(const Duct &before, const Duct &after) {
+    unsigned fields = flags_field(before.flags, after.flags);
+    if (!same(before.begin, after.begin) || !same(before.end, after.end)) {
+        fields |= ChangedField::geometry;
+    }
+    if (before.size_mm != after.size_mm) {
+        fields |= ChangedField::size;
+    }
+    return fields;
+}
+
+unsigned changed_fields(const Fitting &before, const Fitting &after) {
+    unsigned fields = flags_field(before.flags, after.flags);
+    if (before.fitting_variant.index() != after.fitting_variant.index()) {
+        return fields | ChangedField::geometry | ChangedField::size;
+    }
+    if (!same(before.center, after.center)) {
+        fields |= ChangedField::geometry;
+    }
+    if (auto *a = std::get_if<Adapter>(&before.fitting_variant)) {
+        auto &b = std::get<Adapter>(after.fitting_variant);
+        if (!same(a->begin, b.begin) || !same(a->end, b.end)) {
+            fields |= ChangedField::geometry;
+        }
+        if (a->begin_d != b.begin_d || a->end_d != b.end_d) {
+            fields |= ChangedField::size;
+        }
+    } else {
+        auto &a_split = std::get<Split3>(before.fitting_variant);
+        auto &b_split = std::get<Split3>(after.fitting_variant);
+        if (!same(a_split.begin, b_split.begin) || !same(a_split.end, b_split.end)) {
+            fields |= ChangedField::geometry;
+        }
+    }
+    return fields;
+}
+
+void ModelNotifier::subscribe(IModelObserver *observer) { m_observers.push_back(observer); }
+
+void ModelNotifier::unsubscribe(IModelObserver *observer) {
+    m_observers.erase(std::remove(m_observers.begin(), m_observers.end(), observer),
+                      m_observers.end());
+}
+
+void ModelNotifier::end() {
+    if (m_depth == 0 || --m_depth > 0) {
+        return;
+    }
+    deliver();
+}
+
+void ModelNotifier::deliver() {
+    ModelChanges changes;
+    auto &[points, lines, guides, rects, ducts, fittings] = m_pending;
+    take(changes.points, points.changes, points.by_id);
+    take(changes.lines, lines.changes, lines.by_id);
+    take(changes.guides, guides.changes, guides.by_id);
+    take(changes.rects, rects.changes, rects.by_id);
+    take(changes.ducts, ducts.changes, ducts.by_id);
+    take(changes.fittings, fittings.changes, fittings.by_id);
+    if (changes.empty()) {
+        return;
+    }
+    ++m_deliveries;
+    for (auto *observer : m_observers) {
+        observer->model_changed(changes);
+    }
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <optional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+enum class ChangeKind { added, removed, modified };
+
+// Which parts of an element a modification touched.
+namespace ChangedField {
+enum : unsigned {
+    geometry = 1 << 0, // position or shape
+    size = 1 << 1,     // duct size, fitting diameters
+    links = 1 << 2,    // line endpoint refs
+    other = 1 << 3,    // flags and the like
+    all = geometry | size | links | other,
+};
+}
+
+unsigned changed_fields(const PointObj &before, const PointObj &after);
+unsigned changed_fields(const LineObj &before, const LineObj &after);
+unsigned changed_fields(const GuideObj &before, const GuideObj &after);
+unsigned changed_fields(const RectObj &before, const RectObj &after);
+unsigned changed_fields(const Duct &before, const Duct &after);
+unsigned changed_fields(const Fitting &before, const Fitting &after);
+
+template <class T> struct ElementChange {
+    ChangeKind kind = ChangeKind::modified;
+    unsigned fields = ChangedField::all; // all of them for added and removed elements
+    std::optional<T> before;             // as observers knew it, empty when added
+    std::optional<T> after;              // empty when removed
+
+    const std::string &id() const { return after ? after->id : before->id; }
+    bool touches(unsigned mask) const { return fields & mask; }
+};
+
+// Everything which changed in one batch, at most one change per element.
+struct ModelChanges {
+    std::vector<ElementChange<PointObj>> points;
+    std::vector<ElementChange<LineObj>> lines;
+    std::vector<ElementChange<GuideObj>> guides;
+    std::vector<ElementChange<RectObj>> rects;
+    std::vector<ElementChange<Duct>> ducts;
+    std::vector<ElementChange<Fitting>> fittings;
+
+    bool empty() const {
+        return points.empty() && lines.empty() && guides.empty() && rects.empty() &&
+               ducts.empty() && fittings.empty();
+    }
+};
+
+class IModelObserver {
+  public:
+    virtual ~IModelObserver() = default;
+    virtual void model_changed(const ModelChanges &changes) = 0;
+};
+
+// Whoever edits the model tells the notifier what it did, indices, caches, totals and solvers
+// observing it follow only the elements which changed.
+//
+// Edits made between begin() and end() form a batch, e.g. one undo step, and observers hear about
+// them once the outermost batch ends. Changes of one element within a batch are folded: added and
+// then modified is still added, modified many times keeps the first state before and the last
+// after, added and then removed is nothing at all. Outside of a batch every edit is delivered
+// right away.
+class ModelNotifier {
+  public:
+    // Observers are told in the order they subscribed.
+    void subscribe(IModelObserver *observer);
+    void unsubscribe(IModelObserver *observer);
+
+    template <class T> void added(const T &e) {
+        record(ElementChange<T>{ChangeKind::added, ChangedField::all, std::nullopt, e});
+    }
+    template <class T> void removed(const T &e) {
+        record(ElementChange<T>{ChangeKind::removed, ChangedField::all, e, std::nullopt});
+    }
+    template <class T> void modified(const T &before, const T &after) {
+        const unsigned fields = changed_fields(before, after);
+        record(ElementChange<T>{ChangeKind::modified, fields, before, after});
+    }
+
+    void begin() { ++m_depth; }
+    void end();
+    bool in_batch() const { return m_depth > 0; }
+
+    // Batches delivered so far, tells whether edits were batched.
+    size_t delivery_count() const { return m_deliveries; }
+
+  private:
+    template <class T> struct Pending {
+        std::vector<ElementChange<T>> changes;
+        std::unordered_map<std::string, size_t> by_id;
+    };
+
+    template <class T> void record(ElementChange<T> change);
+    void deliver();
+
+    std::vector<IModelObserver *> m_observers;
+    std::tuple<Pending<PointObj>, Pending<LineObj>, Pending<GuideObj>, Pending<RectObj>,
+               Pending<Duct>, Pending<Fitting>>
+        m_pending;
+    int m_depth = 0;
+    size_t m_deliveries = 0;
+};
+
+// Batch lasting for a scope.
+class ModelBatch {
+  public:
+    explicit ModelBatch(ModelNotifier &notifier) : m_notifier(notifier) { m_notifier.begin(); }
+    ~ModelBatch() { m_notifier.end(); }
+
+    ModelBatch(const ModelBatch &) = delete;
+    ModelBatch &operator=(const ModelBatch &) = delete;
+
+  private:
+    ModelNotifier &m_notifier;
+};
+
+template <class T> void ModelNotifier::record(ElementChange<T> change) {
+    auto &pending = std::get<Pending<T>>(m_pending);
+    const std::string id = change.id();
+    auto it = pending.by_id.find(id);
+    if (it == pending.by_id.end()) {
+        pending.by_id.emplace(id, pending.changes.size());
+        pending.changes.push_back(std::move(change));
+    } else {
+        auto &known = pending.changes[it->second];
+        known.after = std::move(change.after);
+        if (known.kind == ChangeKind::added && !known.after) {
+            // Never seen by observers, nothing to tell. Last change takes the free place.
+            const size_t idx = it->second;
+            pending.by_id.erase(it);
+            if (idx + 1 != pending.changes.size()) {
+                pending.changes[idx] = std::move(pending.changes.back());
+                pending.by_id[pending.changes[idx].id()] = idx;
+            }
+            pending.changes.pop_back();
+        } else if (known.kind != ChangeKind::added) {
+            known.kind = known.after ? ChangeKind::modified : ChangeKind::removed;
+            known.fields = known.after ? changed_fields(*known.before, *known.after)
+                                       : unsigned(ChangedField::all);
+        }
+    }
+    if (m_depth == 0) {
+        deliver();
+    }
+}
@@ -0,0 +1,306 @@
+#include "polygon_offset.hpp"
+
+#include "duct_body.hpp"
+#include "v2.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Sine of the turn below which two legs are taken as straight or reversed.
+const double PARALLEL_EPSILON = 1e-9;
+// Points closer than this are the same point.
+const double SAME_POINT_EPSILON = 1e-9;
+
+v2 right_normal(v2 u) { return v2{u.y, -u.x}; }
+
+v2 rotated(v2 v, double c, double s) { return v2{v.x * c - v.y * s, v.x * s + v.y * c}; }
+
+// Angle between points of an arc of `radius` keeping its chords within `tolerance` of it.
+double arc_step(double tolerance, double radius) {
+    // Chord at angle a deviates from the arc by r * (1 - cos(a / 2)).
+    const double ratio = std::min(tolerance / std::max(radius, 1e-12), 1.0);
+    return std::max(2.0 * std::acos(1.0 - ratio), 1e-3);
+}
+
+std::vector<Point> without_repeats(const std::vector<Point> &points, bool closed) {
+    std::vector<Point> result;
+    result.reserve(points.size());
+    for (auto p : points) {
+        if (result.empty() || len(v2{result.back(), p}) > SAME_POINT_EPSILON) {
+            result.push_back(p);
+        }
+    }
+    while (closed && result.size() > 1 && len(v2{result.back(), result.front()}) <=
+                                              SAME_POINT_EPSILON) {
+        result.pop_back();
+    }
+    return result;
+}
+
+double signed_area(const std::vector<Point> &ring) {
+    double area = 0.0;
+    for (size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++) {
+        area += (ring[j].x - ring[i].x) * (ring[j].y + ring[i].y);
+    }
+    return area / 2.0;
+}
+
+// Offsets closed sequence of at least two distinct points to the right of travel by `d`.
+// `open` tells that the sequence is a polyline walked there and back, its reversals are ends.
+class Offsetter {
+  public:
+    Offsetter(const OffsetSettings &settings, double d, bool open)
+        : m_settings(settings), m_d(d), m_ad(std::fabs(d)), m_sd(d < 0.0 ? -1.0 : 1.0),
+          m_open(open), m_arc_step(arc_step(settings.arc_tolerance, m_ad)) {}
+
+    std::vector<Point> offset(const std::vector<Point> &pts) {
+        const size_t n = pts.size();
+        std::vector<v2> dirs(n);
+        std::vector<double> lengths(n);
+        for (size_t i = 0; i < n; ++i) {
+            const v2 e{pts[i], pts[(i + 1) % n]};
+            lengths[i] = len(e);
+            dirs[i] = e / lengths[i];
+        }
+
+        m_out.clear();
+        m_out.reserve(n * 2);
+        std::vector<size_t> first(n), last(n); // points made for each vertex
+        for (size_t i = 0; i < n; ++i) {
+            first[i] = m_out.size();
+            add_vertex(pts[i], dirs[(i + n - 1) % n], dirs[i], lengths[(i + n - 1) % n],
+                       lengths[i]);
+            last[i] = m_out.size() - 1;
+        }
+
+        // Edges which come out pointing back were shorter than what inner corners cut off.
+        m_reversed_edges = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (dot(v2{m_out[last[i]], m_out[first[(i + 1) % n]]}, dirs[i]) < 0.0) {
+                ++m_reversed_edges;
+            }
+        }
+        return std::move(m_out);
+    }
+
+    size_t reversed_edges() const { return m_reversed_edges; }
+
+  private:
+    void add_vertex(Point p, v2 u1, v2 u2, double length1, double length2) {
+        const v2 n1 = right_normal(u1);
+        const v2 n2 = right_normal(u2);
+        const double sin_a = cross2d(u1, u2);
+        const double cos_a = dot(u1, u2);
+
+        const bool parallel = std::fabs(sin_a) < PARALLEL_EPSILON;
+        if (parallel && cos_a > 0.0) {
+            m_out.push_back(p + n2 * m_d);
+            return;
+        }
+        if (!parallel && sin_a * m_d < 0.0) {
+            // Inner corner, offset edges cross at this far from the corner along the legs.
+            const double cut = m_ad * std::fabs(sin_a) / (1.0 + cos_a);
+            if (cut <= std::min(length1, length2)) {
+                m_out.push_back(p + (n1 + n2) * (m_d / (1.0 + cos_a)));
+            } else {
+                m_out.push_back(p + n1 * m_d);
+                m_out.push_back(p);
+                m_out.push_back(p + n2 * m_d);
+            }
+            return;
+        }
+        add_join(p, u1, u2, sin_a, cos_a, parallel);
+    }
+
+    void add_join(Point p, v2 u1, v2 u2, double sin_a, double cos_a, bool reversal) {
+        const v2 n1 = right_normal(u1);
+        const v2 n2 = right_normal(u2);
+        const OffsetJoin join = reversal && m_open ? m_settings.ends : m_settings.join;
+        switch (join) {
+        case OffsetJoin::mitre:
+            if (reversal && m_open) {
+                // Flat end.
+                m_out.push_back(p + n1 * m_d);
+                m_out.push_back(p + n2 * m_d);
+            } else if (!reversal &&
+                       std::sqrt(2.0 / (1.0 + cos_a)) <= std::max(m_settings.mitre_limit, 1.0)) {
+                m_out.push_back(p + (n1 + n2) * (m_d / (1.0 + cos_a)));
+            } else {
+                add_cut(p, u1, u2, reversal, m_ad * std::max(m_settings.mitre_limit, 1.0));
+            }
+            break;
+        case OffsetJoin::square:
+            add_cut(p, u1, u2, reversal, m_ad);
+            break;
+        case OffsetJoin::round: {
+            const double angle = reversal ? M_PI : std::atan2(std::fabs(sin_a), cos_a);
+            const int steps = std::max(1, static_cast<int>(std::ceil(angle / m_arc_step)));
+            const double step = angle / steps * m_sd;
+            const double c = std::cos(step);
+            const double s = std::sin(step);
+            v2 r = n1 * m_d;
+            m_out.push_back(p + r);
+            for (int k = 1; k < steps; ++k) {
+                r = rotated(r, c, s);
+                m_out.push_back(p + r);
+            }
+            m_out.push_back(p + n2 * m_d);
+            break;
+        }
+        }
+    }
+
+    // Corner cut square to the bisector at `distance` from the corner.
+    void add_cut(Point p, v2 u1, v2 u2, bool reversal, double distance) {
+        const v2 n1 = right_normal(u1);
+        const v2 n2 = right_normal(u2);
+        const v2 b = reversal ? u1 : normalized(n1 + n2) * m_sd;
+        for (auto [n, u] : {std::make_pair(n1, u1), std::make_pair(n2, u2)}) {
+            const double t = (distance - m_d * dot(n, b)) / dot(u, b);
+            m_out.push_back(p + n * m_d + u * t);
+        }
+    }
+
+    const OffsetSettings &m_settings;
+    double m_d;
+    double m_ad;
+    double m_sd;
+    bool m_open;
+    double m_arc_step;
+    std::vector<Point> m_out;
+    size_t m_reversed_edges = 0;
+};
+
+Outline single_ring(std::vector<Point> ring) {
+    Outline o;
+    o.outer = std::move(ring);
+    return o;
+}
+} // namespace
+
+std::vector<Point> offset_ring(const std::vector<Point> &ring, double distance,
+                               const OffsetSettings &settings) {
+    auto pts = without_repeats(ring, true);
+    if (pts.size() < 3) {
+        return {};
+    }
+    if (distance == 0.0) {
+        return pts;
+    }
+    // Area is on the left, away from it is to the right of travel.
+    Offsetter offsetter(settings, distance, false);
+    auto result = offsetter.offset(pts);
+    // Shrunk past nothing: the ring turned inside out, or every edge did, e.g. a square.
+    if ((signed_area(result) > 0.0) != (signed_area(pts) > 0.0) ||
+        offsetter.reversed_edges() == pts.size()) {
+        return {};
+    }
+    return result;
+}
+
+std::vector<Point> offset_polyline(const std::vector<Point> &path, double distance,
+                                   const OffsetSettings &settings) {
+    auto pts = without_repeats(path, false);
+    const double d = std::fabs(distance);
+    if (pts.empty() || d == 0.0) {
+        return {};
+    }
+    if (pts.size() == 1) {
+        // Both ends at one point.
+        const Point p = pts.front();
+        switch (settings.ends) {
+        case OffsetJoin::mitre:
+            return {};
+        case OffsetJoin::square:
+            return {p + v2{-d, -d}, p + v2{d, -d}, p + v2{d, d}, p + v2{-d, d}};
+        case OffsetJoin::round: {
+            const double step = arc_step(settings.arc_tolerance, d);
+            const int steps = std::max(4, static_cast<int>(std::ceil(2.0 * M_PI / step)));
+            std::vector<Point> circle;
+            for (int k = 0; k < steps; ++k) {
+                const double a = 2.0 * M_PI * k / steps;
+                circle.push_back(p + v2{d * std::cos(a), d * std::sin(a)});
+            }
+            return circle;
+        }
+        }
+    }
+    // There and back, reversals at both ends become end caps.
+    std::vector<Point> there_and_back(pts.begin(), pts.end());
+    there_and_back.insert(there_and_back.end(), std::next(pts.rbegin()), std::prev(pts.rend()));
+    return Offsetter(settings, d, true).offset(there_and_back);
+}
+
+Outline offset_outline(const Outline &outline, double distance, const OffsetSettings &settings) {
+    Outline result;
+    result.outer = offset_ring(outline.outer, distance, settings);
+    if (result.outer.empty()) {
+        return result;
+    }
+    for (auto &hole : outline.holes) {
+        if (auto ring = offset_ring(hole, distance, settings); !ring.empty()) {
+            result.holes.push_back(std::move(ring));
+        }
+    }
+    return result;
+}
+
+const Outline &OffsetCache::wall_body(const LineObj &l, double thickness) {
+    return get(l.id, Key{l.l.a.x, l.l.a.y, l.l.b.x, l.l.b.y, thickness}, [&] {
+        OffsetSettings s;
+        s.join = OffsetJoin::mitre;
+        s.ends = OffsetJoin::square;
+        return single_ring(offset_polyline({l.l.a, l.l.b}, thickness / 2.0, s));
+    });
+}
+
+const Outline &OffsetCache::wall_body(const RectObj &r, double thickness) {
+    const Rect &g = r.rect;
+    return get(r.id, Key{g.x, g.y, g.width, g.height, thickness}, [&] {
+        OffsetSettings s;
+        s.join = OffsetJoin::mitre;
+        // Counterclockwise with y up for any sign of width and height.
+        std::vector<Point> ring{g.upper_left_corner(), g.upper_right_corner(),
+                                g.bottom_right_corner(), g.bottom_left_corner()};
+        if (signed_area(ring) < 0.0) {
+            std::reverse(ring.begin(), ring.end());
+        }
+        Outline o;
+        o.outer = offset_ring(ring, thickness / 2.0, s);
+        if (auto inner = offset_ring(ring, -thickness / 2.0, s); !inner.empty()) {
+            std::reverse(inner.begin(), inner.end());
+            o.holes.push_back(std::move(inner));
+        }
+        return o;
+    });
+}
+
+const Outline &OffsetCache::clearance_zone(const Duct &d, double clearance) {
+    const double radius = duct_width(d) / 2.0 + clearance;
+    return get(d.id, Key{d.begin.x, d.begin.y, d.end.x, d.end.y, radius}, [&] {
+        OffsetSettings s;
+        s.join = OffsetJoin::round;
+        s.ends = OffsetJoin::round;
+        return single_ring(offset_polyline({d.begin, d.end}, radius, s));
+    });
+}
+
+void OffsetCache::remove(const std::string &id) { m_entries.erase(id); }
+
+void OffsetCache::clear() {
+    m_entries.clear();
+    m_rebuilt = 0;
+}
+
+template <typename F>
+const Outline &OffsetCache::get(const std::string &id, const Key &key, F &&make) {
+    auto [it, inserted] = m_entries.try_emplace(id);
+    auto &e = it->second;
+    if (inserted || e.key != key) {
+        e.key = key;
+        e.outline = make();
+        ++m_rebuilt;
+    }
+    return e.outline;
+}
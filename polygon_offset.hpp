@@ -0,0 +1,70 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// How offset edges are connected where they move apart: on the outside of a polygon corner and
+// around the ends of an open polyline. At ends mitre means a flat end at the last point.
+enum class OffsetJoin { mitre, round, square };
+
+struct OffsetSettings {
+    OffsetJoin join = OffsetJoin::mitre;
+    OffsetJoin ends = OffsetJoin::square; // open polylines only
+    // Mitres longer than this times the distance are squared off, so sharp corners do not spike.
+    double mitre_limit = 2.0;
+    // Round joins keep within this distance of the true arc, world units.
+    double arc_tolerance = 0.5;
+};
+
+// Ring moved by `distance` away from the area it bounds, negative distance moves it into the
+// area. Rings are oriented as in Outline, so the same call grows an outer ring and its holes.
+//
+// Where legs are shorter than the distance an inner corner cannot be cut at the crossing of the
+// offset edges; the outline then goes through the corner itself and makes a small loop, which
+// does not show when filled with non-zero winding. Repeated points are dropped first.
+std::vector<Point> offset_ring(const std::vector<Point> &ring, double distance,
+                               const OffsetSettings &settings);
+
+// Area within `distance` of an open polyline, e.g. a wall body from its centreline. A single
+// point gives a disc or a square, unless ends are flat.
+std::vector<Point> offset_polyline(const std::vector<Point> &path, double distance,
+                                   const OffsetSettings &settings);
+
+// Outer ring and holes moved away from the area, see offset_ring.
+Outline offset_outline(const Outline &outline, double distance, const OffsetSettings &settings);
+
+// Wall bodies and duct clearance zones by element id. Like DuctBodyCache an outline is rebuilt
+// only when the geometry it comes from changed since it was asked for last time, so during a drag
+// only the dragged elements cost anything.
+class OffsetCache {
+  public:
+    // Line walls are centrelines, ends are squared so that walls meeting at a corner close it.
+    const Outline &wall_body(const LineObj &l, double thickness);
+    // Rect walls are centred on its edges, the room inside is a hole.
+    const Outline &wall_body(const RectObj &r, double thickness);
+    // Space to keep free around a duct, `clearance` from its surface, round at the ends.
+    const Outline &clearance_zone(const Duct &d, double clearance);
+
+    void remove(const std::string &id);
+    void clear();
+
+    // Outlines rebuilt since construction or clear(), tells how much the cache saves.
+    size_t rebuilt_count() const { return m_rebuilt; }
+
+  private:
+    // Everything an outline depends on.
+    using Key = std::array<double, 5>;
+    struct Entry {
+        Key key;
+        Outline outline;
+    };
+
+    template <typename F> const Outline &get(const std::string &id, const Key &key, F &&make);
+
+    std::unordered_map<std::string, Entry> m_entries;
+    size_t m_rebuilt = 0;
+};
@@ -0,0 +1,438 @@
+#include "rect_union.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+struct Interval {
+    double lo;
+    double hi;
+};
+
+// Side of a rect across the sweep direction, `at` is where it is along the sweep.
+struct SweepEdge {
+    double at;
+    Interval span;
+    bool opening; // rect is on the far side of it
+};
+
+// How many rects cover each piece between neighbouring coordinates.
+class CoverageTree {
+  public:
+    explicit CoverageTree(std::vector<double> coords)
+        : m_coords(std::move(coords)), m_size(m_coords.empty() ? 0 : m_coords.size() - 1),
+          m_nodes(4 * std::max<size_t>(m_size, 1)) {}
+
+    void add(Interval i, int delta) { update(1, 0, m_size, index(i.lo), index(i.hi), delta); }
+
+    // Appends parts of `i` not covered by any rect, in order and joined where they touch.
+    void uncovered(Interval i, std::vector<Interval> &out) const {
+        collect(1, 0, m_size, index(i.lo), index(i.hi), out);
+    }
+
+  private:
+    struct Node {
+        int count = 0;     // rects covering the whole node
+        bool full = false; // every piece below is covered
+        bool empty = true; // no piece below is covered
+    };
+
+    size_t index(double c) const {
+        return std::lower_bound(m_coords.begin(), m_coords.end(), c) - m_coords.begin();
+    }
+
+    void update(size_t n, size_t lo, size_t hi, size_t a, size_t b, int delta) {
+        if (b <= lo || hi <= a) {
+            return;
+        }
+        if (a <= lo && hi <= b) {
+            m_nodes[n].count += delta;
+        } else {
+            const size_t mid = (lo + hi) / 2;
+            update(2 * n, lo, mid, a, b, delta);
+            update(2 * n + 1, mid, hi, a, b, delta);
+        }
+        auto &node = m_nodes[n];
+        const bool leaf = hi - lo == 1;
+        node.full = node.count > 0 || (!leaf && m_nodes[2 * n].full && m_nodes[2 * n + 1].full);
+        node.empty =
+            node.count == 0 && (leaf || (m_nodes[2 * n].empty && m_nodes[2 * n + 1].empty));
+    }
+
+    void collect(size_t n, size_t lo, size_t hi, size_t a, size_t b,
+                 std::vector<Interval> &out) const {
+        if (b <= lo || hi <= a || m_nodes[n].full) {
+            return;
+        }
+        if (m_nodes[n].empty) {
+            const Interval piece{m_coords[std::max(lo, a)], m_coords[std::min(hi, b)]};
+            if (!out.empty() && out.back().hi == piece.lo) {
+                out.back().hi = piece.hi;
+            } else {
+                out.push_back(piece);
+            }
+            return;
+        }
+        const size_t mid = (lo + hi) / 2;
+        collect(2 * n, lo, mid, a, b, out);
+        collect(2 * n + 1, mid, hi, a, b, out);
+    }
+
+    std::vector<double> m_coords;
+    size_t m_size;
+    std::vector<Node> m_nodes;
+};
+
+// Sorts and joins intervals which overlap or touch.
+void merge(std::vector<Interval> &v) {
+    std::sort(v.begin(), v.end(), [](auto &a, auto &b) { return a.lo < b.lo; });
+    size_t last = 0;
+    for (size_t i = 1; i < v.size(); ++i) {
+        if (v[i].lo <= v[last].hi) {
+            v[last].hi = std::max(v[last].hi, v[i].hi);
+        } else {
+            v[++last] = v[i];
+        }
+    }
+    v.resize(v.empty() ? 0 : last + 1);
+}
+
+// Appends `from` without `cut`, both sorted and disjoint.
+void subtract(const std::vector<Interval> &from, const std::vector<Interval> &cut,
+              std::vector<Interval> &out) {
+    size_t k = 0;
+    for (auto i : from) {
+        while (k < cut.size() && cut[k].hi <= i.lo) {
+            ++k;
+        }
+        double lo = i.lo;
+        for (size_t j = k; j < cut.size() && cut[j].lo < i.hi; ++j) {
+            if (cut[j].lo > lo) {
+                out.push_back({lo, cut[j].lo});
+            }
+            lo = std::max(lo, cut[j].hi);
+        }
+        if (lo < i.hi) {
+            out.push_back({lo, i.hi});
+        }
+    }
+}
+
+// Parts of rect sides where coverage changes from one side to the other, that is the boundary
+// of the union across the sweep. They keep `opening` of the sides they are part of.
+std::vector<SweepEdge> sweep(std::vector<SweepEdge> edges) {
+    std::vector<double> coords;
+    coords.reserve(edges.size());
+    for (auto &e : edges) {
+        if (e.opening) {
+            coords.push_back(e.span.lo);
+            coords.push_back(e.span.hi);
+        }
+    }
+    std::sort(coords.begin(), coords.end());
+    coords.erase(std::unique(coords.begin(), coords.end()), coords.end());
+    CoverageTree tree(std::move(coords));
+
+    std::sort(edges.begin(), edges.end(), [](auto &a, auto &b) { return a.at < b.at; });
+
+    std::vector<SweepEdge> boundary;
+    std::vector<Interval> opening, closing, found, pieces;
+    for (size_t i = 0; i < edges.size();) {
+        const double at = edges[i].at;
+        opening.clear();
+        closing.clear();
+        size_t end = i;
+        for (; end < edges.size() && edges[end].at == at; ++end) {
+            if (edges[end].opening) {
+                opening.push_back(edges[end].span);
+            } else {
+                closing.push_back(edges[end].span);
+                tree.add(edges[end].span, -1);
+            }
+        }
+        merge(opening);
+        merge(closing);
+
+        // Tree now has only rects going across `at`. Boundary is where none of them covers
+        // and rects end on one side only.
+        auto add_boundary = [&](const std::vector<Interval> &sides,
+                                const std::vector<Interval> &other, bool is_opening) {
+            found.clear();
+            for (auto s : sides) {
+                tree.uncovered(s, found);
+            }
+            pieces.clear();
+            subtract(found, other, pieces);
+            for (auto piece : pieces) {
+                boundary.push_back(SweepEdge{at, piece, is_opening});
+            }
+        };
+        add_boundary(opening, closing, true);
+        add_boundary(closing, opening, false);
+
+        for (; i < end; ++i) {
+            if (edges[i].opening) {
+                tree.add(edges[i].span, +1);
+            }
+        }
+    }
+    return boundary;
+}
+
+struct Segment {
+    Point from;
+    Point to;
+};
+
+using PointKey = std::pair<double, double>;
+
+struct PointKeyHash {
+    size_t operator()(const PointKey &k) const {
+        return std::hash<double>()(k.first) * 31 ^ std::hash<double>()(k.second);
+    }
+};
+
+// At most two edges start at a vertex, two when pieces touch at a corner.
+struct Starts {
+    std::array<uint32_t, 2> edges;
+    uint8_t count = 0;
+};
+
+const uint32_t NO_EDGE = std::numeric_limits<uint32_t>::max();
+
+int sign(double v) { return (v > 0.0) - (v < 0.0); }
+
+double signed_area(const std::vector<Point> &ring) {
+    double area = 0.0;
+    for (size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++) {
+        area += (ring[j].x - ring[i].x) * (ring[j].y + ring[i].y);
+    }
+    return area / 2.0;
+}
+
+// Tells for points which vertical edge is the nearest one to the left. Edges are added in
+// order of x, a later one hides earlier ones across its span.
+class LeftEdgeTree {
+  public:
+    explicit LeftEdgeTree(std::vector<double> coords)
+        : m_coords(std::move(coords)), m_size(m_coords.empty() ? 0 : m_coords.size() - 1),
+          m_nodes(4 * std::max<size_t>(m_size, 1), NO_EDGE) {}
+
+    // `order` must grow with every call.
+    void add(Interval span, uint32_t order) {
+        assign(1, 0, m_size, index(span.lo), index(span.hi), order);
+    }
+
+    // Order of the nearest edge across the piece between `lo` and the next coordinate above it.
+    uint32_t nearest(double lo) const {
+        size_t n = 1, begin = 0, end = m_size;
+        const size_t leaf = index(lo);
+        uint32_t found = NO_EDGE;
+        while (true) {
+            if (m_nodes[n] != NO_EDGE && (found == NO_EDGE || m_nodes[n] > found)) {
+                found = m_nodes[n];
+            }
+            if (end - begin <= 1) {
+                return found;
+            }
+            const size_t mid = (begin + end) / 2;
+            if (leaf < mid) {
+                n = 2 * n;
+                end = mid;
+            } else {
+                n = 2 * n + 1;
+                begin = mid;
+            }
+        }
+    }
+
+  private:
+    size_t index(double c) const {
+        return std::lower_bound(m_coords.begin(), m_coords.end(), c) - m_coords.begin();
+    }
+
+    void assign(size_t n, size_t lo, size_t hi, size_t a, size_t b, uint32_t order) {
+        if (b <= lo || hi <= a) {
+            return;
+        }
+        if (a <= lo && hi <= b) {
+            m_nodes[n] = order;
+            return;
+        }
+        const size_t mid = (lo + hi) / 2;
+        assign(2 * n, lo, mid, a, b, order);
+        assign(2 * n + 1, mid, hi, a, b, order);
+    }
+
+    std::vector<double> m_coords;
+    size_t m_size;
+    std::vector<uint32_t> m_nodes;
+};
+
+uint32_t find_root(std::vector<uint32_t> &parent, uint32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+} // namespace
+
+std::vector<Outline> rect_union(const std::vector<Rect> &rects) {
+    std::vector<SweepEdge> across_x, across_y;
+    across_x.reserve(rects.size() * 2);
+    across_y.reserve(rects.size() * 2);
+    for (auto r : rects) {
+        if (r.width < 0.0) {
+            r.x += r.width;
+            r.width = -r.width;
+        }
+        if (r.height < 0.0) {
+            r.y += r.height;
+            r.height = -r.height;
+        }
+        if (!(r.width > 0.0 && r.height > 0.0) || !std::isfinite(r.x + r.y + r.width + r.height)) {
+            continue;
+        }
+        across_x.push_back({r.x, {r.y, r.y + r.height}, true});
+        across_x.push_back({r.x + r.width, {r.y, r.y + r.height}, false});
+        across_y.push_back({r.y, {r.x, r.x + r.width}, true});
+        across_y.push_back({r.y + r.height, {r.x, r.x + r.width}, false});
+    }
+
+    // Directed so that the area is on the left with y up.
+    std::vector<Segment> segments;
+    for (auto &e : sweep(std::move(across_x))) {
+        const Point lo(e.at, e.span.lo), hi(e.at, e.span.hi);
+        segments.push_back(e.opening ? Segment{hi, lo} : Segment{lo, hi});
+    }
+    const size_t vertical_count = segments.size();
+    for (auto &e : sweep(std::move(across_y))) {
+        const Point lo(e.span.lo, e.at), hi(e.span.hi, e.at);
+        segments.push_back(e.opening ? Segment{lo, hi} : Segment{hi, lo});
+    }
+
+    // Rings alternate vertical and horizontal edges, each one continues at an edge of the other
+    // kind starting where it ends.
+    std::unordered_map<PointKey, Starts, PointKeyHash> vertical_starts, horizontal_starts;
+    for (uint32_t i = 0; i < segments.size(); ++i) {
+        auto &starts = i < vertical_count ? vertical_starts : horizontal_starts;
+        auto &s = starts[{segments[i].from.x, segments[i].from.y}];
+        if (s.count < s.edges.size()) {
+            s.edges[s.count++] = i;
+        }
+    }
+    // Where two edges could follow, turning left keeps pieces touching at a corner apart.
+    auto next = [&](uint32_t i) {
+        auto &seg = segments[i];
+        auto &starts = i < vertical_count ? horizontal_starts : vertical_starts;
+        auto it = starts.find({seg.to.x, seg.to.y});
+        if (it == starts.end() || it->second.count == 0) {
+            return NO_EDGE;
+        }
+        const int left_x = -sign(seg.to.y - seg.from.y);
+        const int left_y = sign(seg.to.x - seg.from.x);
+        for (uint8_t k = 0; k < it->second.count; ++k) {
+            auto &candidate = segments[it->second.edges[k]];
+            if (sign(candidate.to.x - candidate.from.x) == left_x &&
+                sign(candidate.to.y - candidate.from.y) == left_y) {
+                return it->second.edges[k];
+            }
+        }
+        return it->second.edges[0];
+    };
+
+    std::vector<std::vector<Point>> rings;
+    std::vector<uint32_t> ring_of(segments.size(), NO_EDGE);
+    std::vector<uint32_t> up_edges; // any vertical edge going up, by ring
+    std::vector<uint32_t> ring_edges;
+    for (uint32_t start = 0; start < vertical_count; ++start) {
+        if (ring_of[start] != NO_EDGE) {
+            continue;
+        }
+        std::vector<Point> ring;
+        ring_edges.clear();
+        uint32_t i = start;
+        do {
+            ring_edges.push_back(i);
+            ring_of[i] = static_cast<uint32_t>(rings.size());
+            ring.push_back(segments[i].from);
+            i = next(i);
+        } while (i != start && i != NO_EDGE && ring_of[i] == NO_EDGE);
+        if (i != start || ring.size() < 4) {
+            continue; // cannot happen, all vertices are exact input coordinates
+        }
+        auto up = std::find_if(ring_edges.begin(), ring_edges.end(), [&](uint32_t e) {
+            return e < vertical_count && segments[e].to.y > segments[e].from.y;
+        });
+        up_edges.push_back(*up);
+        rings.push_back(std::move(ring));
+    }
+
+    // A hole belongs to the piece on the left of its edges going up. Ray from such an edge to the
+    // left stays inside that piece until it meets another ring of it, the outer one or another
+    // hole. Rays of all holes are cast in one sweep across x.
+    std::vector<uint32_t> parent(rings.size());
+    std::vector<uint32_t> hole_rays;
+    for (uint32_t r = 0; r < rings.size(); ++r) {
+        parent[r] = r;
+        if (signed_area(rings[r]) < 0.0) {
+            hole_rays.push_back(up_edges[r]);
+        }
+    }
+    if (!hole_rays.empty()) {
+        std::vector<uint32_t> by_x(vertical_count);
+        std::vector<double> ys;
+        ys.reserve(vertical_count * 2);
+        for (uint32_t i = 0; i < vertical_count; ++i) {
+            by_x[i] = i;
+            ys.push_back(segments[i].from.y);
+            ys.push_back(segments[i].to.y);
+        }
+        std::sort(ys.begin(), ys.end());
+        ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+        auto less_x = [&](uint32_t a, uint32_t b) {
+            return segments[a].from.x < segments[b].from.x;
+        };
+        std::sort(by_x.begin(), by_x.end(), less_x);
+        std::sort(hole_rays.begin(), hole_rays.end(), less_x);
+
+        LeftEdgeTree tree(std::move(ys));
+        size_t added = 0;
+        for (auto ray : hole_rays) {
+            auto &from = segments[ray];
+            for (; added < by_x.size() && segments[by_x[added]].from.x < from.from.x; ++added) {
+                auto &s = segments[by_x[added]];
+                tree.add(Interval{std::min(s.from.y, s.to.y), std::max(s.from.y, s.to.y)},
+                         static_cast<uint32_t>(added));
+            }
+            const uint32_t hit = tree.nearest(from.from.y);
+            if (hit != NO_EDGE) {
+                parent[find_root(parent, ring_of[ray])] = find_root(parent, ring_of[by_x[hit]]);
+            }
+        }
+    }
+
+    std::vector<Outline> result;
+    std::vector<uint32_t> outline_of(rings.size(), NO_EDGE);
+    for (uint32_t r = 0; r < rings.size(); ++r) {
+        if (signed_area(rings[r]) > 0.0) {
+            outline_of[find_root(parent, r)] = static_cast<uint32_t>(result.size());
+            result.emplace_back();
+            result.back().outer = std::move(rings[r]);
+        }
+    }
+    for (uint32_t r = 0; r < rings.size(); ++r) {
+        const uint32_t outline = outline_of[find_root(parent, r)];
+        if (!rings[r].empty() && outline != NO_EDGE) {
+            result[outline].holes.push_back(std::move(rings[r]));
+        }
+    }
+    return result;
+}
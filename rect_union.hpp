@@ -0,0 +1,14 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <vector>
+
+// Exact outline of the union of axis aligned rects, one per connected piece, for rooms and zones
+// drawn as several overlapping rects. Vertices are corners of the input rects, no rounding takes
+// place. Pieces touching only at a corner are separate outlines. Empty rects are ignored.
+//
+// Boundary is found by two sweeps, across x for vertical edges and across y for horizontal ones,
+// each keeping coverage of the other axis in a segment tree. Edges are then linked into rings.
+// O(n log n) for n rects plus O(log n) for every edge of the result.
+std::vector<Outline> rect_union(const std::vector<Rect> &rects);
@@ -0,0 +1,252 @@
+#include "snap_engine.hpp"
+
+#include "duct_network.hpp"
+#include "duct_rules.hpp"
+#include "math.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace {
+static_assert(2 * duct_rules::TURN_ANGLES_DEGREES.size() - 1 == DirectionTable::SIZE);
+
+// Parameters along both segments where they cross.
+std::optional<std::pair<double, double>> crossing(const Line &a, const Line &b) {
+    const v2 r{a.a, a.b};
+    const v2 s{b.a, b.b};
+    const double den = cross2d(r, s);
+    if (std::fabs(den) < 1e-12) {
+        return std::nullopt;
+    }
+    const v2 qp{a.a, b.a};
+    const double t = cross2d(qp, s) / den;
+    const double u = cross2d(qp, r) / den;
+    if (t < 0.0 || t > 1.0 || u < 0.0 || u > 1.0) {
+        return std::nullopt;
+    }
+    return std::make_pair(t, u);
+}
+
+Point point_at(const Line &l, double t) { return l.a + v2{l.a, l.b} * t; }
+
+Point closest_point_on_segment(const Line &l, Point p) {
+    const v2 ab{l.a, l.b};
+    const double l2 = len2(ab);
+    if (l2 == 0.0) {
+        return l.a;
+    }
+    return point_at(l, std::clamp(dot(v2{l.a, p}, ab) / l2, 0.0, 1.0));
+}
+} // namespace
+
+DirectionTable::DirectionTable() {
+    size_t i = 0;
+    for (auto alpha : duct_rules::TURN_ANGLES_DEGREES) {
+        const double rad = alpha * M_PI / 180.0;
+        m_cos[i] = std::cos(rad);
+        m_sin[i] = std::sin(rad);
+        ++i;
+        if (alpha != 0.0) {
+            m_cos[i] = std::cos(-rad);
+            m_sin[i] = std::sin(-rad);
+            ++i;
+        }
+    }
+}
+
+std::array<v2, DirectionTable::SIZE> DirectionTable::rotated(v2 u) const {
+    std::array<v2, SIZE> result;
+    for (size_t i = 0; i < SIZE; ++i) {
+        result[i] = v2{m_cos[i] * u.x - m_sin[i] * u.y, m_sin[i] * u.x + m_cos[i] * u.y};
+    }
+    return result;
+}
+
+SnapEngine::SnapEngine(double cell_size) : m_cell_size(cell_size) {}
+
+void SnapEngine::rebuild(const Model &m, const IntersectionIndex &intersections) {
+    m_points.clear();
+    m_segments.clear();
+    m_guides.clear();
+    m_grid.clear();
+
+    for (auto &p : m.points) {
+        add_point(p.pt, SnapKind::endpoint);
+    }
+    for (auto &l : m.lines) {
+        add_point(l.l.a, SnapKind::endpoint);
+        add_point(l.l.b, SnapKind::endpoint);
+        add_segment(l.l);
+    }
+    for (auto &r : m.rects) {
+        add_point(r.rect.upper_left_corner(), SnapKind::endpoint);
+        add_point(r.rect.upper_right_corner(), SnapKind::endpoint);
+        add_point(r.rect.bottom_right_corner(), SnapKind::endpoint);
+        add_point(r.rect.bottom_left_corner(), SnapKind::endpoint);
+        add_segment(r.rect.top_line());
+        add_segment(r.rect.bottom_line());
+        add_segment(r.rect.left_line());
+        add_segment(r.rect.right_line());
+    }
+    for (auto &d : m.ducts) {
+        add_point(d.begin, SnapKind::endpoint);
+        add_point(d.end, SnapKind::endpoint);
+    }
+    for (auto &f : m.fittings) {
+        for (auto p : fitting_endpoints(f)) {
+            add_point(p, SnapKind::endpoint);
+        }
+    }
+    for (auto &g : m.guides) {
+        m_guides.push_back(g.line);
+    }
+    for (auto &i : intersections.intersections()) {
+        add_point(i.point, SnapKind::intersection);
+    }
+    m_segment_stamps.assign(m_segments.size(), 0);
+    m_stamp = 0;
+}
+
+void SnapEngine::add_point(Point p, SnapKind kind) {
+    m_grid[cell_of(p)].points.push_back(static_cast<uint32_t>(m_points.size()));
+    m_points.push_back(SnapResult{p, kind});
+}
+
+void SnapEngine::add_segment(Line l) {
+    const auto idx = static_cast<uint32_t>(m_segments.size());
+    m_segments.push_back(l);
+
+    // Registered only in cells the segment passes, not in whole bounding box.
+    const auto lo = cell_of(Point(std::min(l.a.x, l.b.x), std::min(l.a.y, l.b.y)));
+    const auto hi = cell_of(Point(std::max(l.a.x, l.b.x), std::max(l.a.y, l.b.y)));
+    const double dy = l.b.y - l.a.y;
+    for (int64_t y = lo.y; y <= hi.y; ++y) {
+        double x0 = std::min(l.a.x, l.b.x);
+        double x1 = std::max(l.a.x, l.b.x);
+        if (dy != 0.0) {
+            double t0 = std::clamp((y * m_cell_size - l.a.y) / dy, 0.0, 1.0);
+            double t1 = std::clamp(((y + 1) * m_cell_size - l.a.y) / dy, 0.0, 1.0);
+            x0 = point_at(l, t0).x;
+            x1 = point_at(l, t1).x;
+            if (x0 > x1) {
+                std::swap(x0, x1);
+            }
+        }
+        const auto row_lo = cell_of(Point(x0, 0.0)).x;
+        const auto row_hi = cell_of(Point(x1, 0.0)).x;
+        for (int64_t x = row_lo; x <= row_hi; ++x) {
+            m_grid[CellKey{x, y}].segments.push_back(idx);
+        }
+    }
+}
+
+SnapEngine::CellKey SnapEngine::cell_of(Point p) const {
+    return CellKey{static_cast<int64_t>(std::floor(p.x / m_cell_size)),
+                   static_cast<int64_t>(std::floor(p.y / m_cell_size))};
+}
+
+template <typename F> void SnapEngine::for_cells_around(Point p, double radius, F &&f) const {
+    const auto lo = cell_of(Point(p.x - radius, p.y - radius));
+    const auto hi = cell_of(Point(p.x + radius, p.y + radius));
+    for (int64_t x = lo.x; x <= hi.x; ++x) {
+        for (int64_t y = lo.y; y <= hi.y; ++y) {
+            if (auto it = m_grid.find(CellKey{x, y}); it != m_grid.end()) {
+                f(it->second);
+            }
+        }
+    }
+}
+
+std::optional<SnapResult> SnapEngine::snap(Point cursor, double radius) const {
+    std::optional<SnapResult> best;
+    double best_distance = radius;
+    for_cells_around(cursor, radius, [&](const Cell &cell) {
+        for (auto idx : cell.points) {
+            const double d = math::points_distance(m_points[idx].point, cursor);
+            if (d <= best_distance) {
+                best_distance = d;
+                best = m_points[idx];
+            }
+        }
+    });
+    if (best) {
+        return best;
+    }
+
+    ++m_stamp;
+    for_cells_around(cursor, radius, [&](const Cell &cell) {
+        for (auto idx : cell.segments) {
+            if (std::exchange(m_segment_stamps[idx], m_stamp) == m_stamp) {
+                continue;
+            }
+            const Point p = closest_point_on_segment(m_segments[idx], cursor);
+            const double d = math::points_distance(p, cursor);
+            if (d <= best_distance) {
+                best_distance = d;
+                best = SnapResult{p, SnapKind::edge};
+            }
+        }
+    });
+    for (auto &g : m_guides) {
+        const Point p = closest_point_on_segment(g, cursor);
+        const double d = math::points_distance(p, cursor);
+        if (d <= best_distance) {
+            best_distance = d;
+            best = SnapResult{p, SnapKind::guide};
+        }
+    }
+    return best;
+}
+
+std::optional<SnapResult> SnapEngine::snap_along(Point origin, v2 direction, Point cursor,
+                                                 double radius) const {
+    if (len2(direction) == 0.0) {
+        return std::nullopt;
+    }
+    const v2 d = normalized(direction);
+
+    std::optional<SnapResult> best;
+    double best_distance = radius;
+    for_cells_around(cursor, radius, [&](const Cell &cell) {
+        for (auto idx : cell.points) {
+            const Point p = m_points[idx].point;
+            const double t = dot(v2{origin, p}, d);
+            const Point on_line = origin + d * t;
+            const double off = math::points_distance(p, on_line);
+            if (t > 0.0 && off <= best_distance &&
+                math::points_distance(on_line, cursor) <= radius) {
+                best_distance = off;
+                best = SnapResult{on_line, m_points[idx].kind};
+            }
+        }
+    });
+    if (best) {
+        return best;
+    }
+
+    // Line through origin is long enough to cross anything around cursor.
+    const Line ray{origin, origin + d * (math::points_distance(origin, cursor) + 2.0 * radius)};
+    auto try_crossing = [&](const Line &l, SnapKind kind) {
+        if (auto params = crossing(ray, l)) {
+            const Point p = point_at(ray, params->first);
+            const double distance = math::points_distance(p, cursor);
+            if (distance <= best_distance) {
+                best_distance = distance;
+                best = SnapResult{p, kind};
+            }
+        }
+    };
+    ++m_stamp;
+    for_cells_around(cursor, radius, [&](const Cell &cell) {
+        for (auto idx : cell.segments) {
+            if (std::exchange(m_segment_stamps[idx], m_stamp) != m_stamp) {
+                try_crossing(m_segments[idx], SnapKind::edge);
+            }
+        }
+    });
+    for (auto &g : m_guides) {
+        try_crossing(g, SnapKind::guide);
+    }
+    return best;
+}
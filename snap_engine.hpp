@@ -0,0 +1,90 @@
+#pragma once
+
+#include "intersection_index.hpp"
+#include "types.hpp"
+#include "v2.hpp"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// Directions in which next leg of a duct run may go, for every turn allowed by duct_rules.
+// Sines and cosines are computed once, so rotating is just a couple of multiplications.
+class DirectionTable {
+  public:
+    static constexpr size_t SIZE = 7; // straight plus both sides of every turn
+
+    DirectionTable();
+
+    // `u` rotated by every allowed turn, the first one is `u` itself.
+    std::array<v2, SIZE> rotated(v2 u) const;
+
+  private:
+    std::array<double, SIZE> m_cos;
+    std::array<double, SIZE> m_sin;
+};
+
+enum class SnapKind { endpoint, intersection, edge, guide };
+
+struct SnapResult {
+    Point point;
+    SnapKind kind;
+};
+
+// Finds geometry near cursor worth snapping to: endpoints of points, lines, rect corners, ducts
+// and fittings, intersections between lines, rect edges and guides, and the lines themselves.
+//
+// Everything is indexed in a uniform grid on rebuild, intersections come ready from the
+// IntersectionIndex kept with the model, so a query only looks at a few cells around the cursor.
+// Guides are infinitely long and few, they are kept aside and tested directly.
+class SnapEngine {
+  public:
+    explicit SnapEngine(double cell_size = 100.0);
+
+    void rebuild(const Model &m, const IntersectionIndex &intersections);
+
+    // Closest endpoint or intersection within radius, otherwise closest point on a line or guide.
+    std::optional<SnapResult> snap(Point cursor, double radius) const;
+
+    // Snapping restricted to line through `origin` in `direction`, e.g. next leg of a duct run.
+    // Points near cursor are projected on the line, lines and guides crossing it near cursor give
+    // their crossing point.
+    std::optional<SnapResult> snap_along(Point origin, v2 direction, Point cursor,
+                                         double radius) const;
+
+    size_t points_count() const { return m_points.size(); }
+
+  private:
+    struct CellKey {
+        int64_t x;
+        int64_t y;
+        bool operator==(const CellKey &o) const { return x == o.x && y == o.y; }
+    };
+    struct CellKeyHash {
+        size_t operator()(const CellKey &k) const {
+            return std::hash<int64_t>()(k.x) ^ (std::hash<int64_t>()(k.y) * 31);
+        }
+    };
+    struct Cell {
+        std::vector<uint32_t> points;
+        std::vector<uint32_t> segments;
+    };
+
+    void add_point(Point p, SnapKind kind);
+    void add_segment(Line l);
+    CellKey cell_of(Point p) const;
+    // Calls `f(cell)` for every non-empty cell overlapping square of `radius` around `p`.
+    template <typename F> void for_cells_around(Point p, double radius, F &&f) const;
+
+    double m_cell_size;
+    std::vector<SnapResult> m_points;
+    std::vector<Line> m_segments;
+    std::vector<Line> m_guides;
+    std::unordered_map<CellKey, Cell, CellKeyHash> m_grid;
+
+    // Segments are reported once per query even if they span several cells.
+    mutable std::vector<uint32_t> m_segment_stamps;
+    mutable uint32_t m_stamp = 0;
+};
@@ -1,9 +1,10 @@
 #pragma once
-#include <QDebug>
-#include <QPointF>
+#include <cstdint>
 #include <optional>
 #include <string>
+#include <tuple>
 #include <variant>
+#include <vector>
 
 namespace ObjFlags {
 enum {
@@ -37,8 +38,6 @@ enum {
 
 enum class Tool { hand, select, draw_point, draw_line, move, guide, rectangle, duct, adapter };
 
-QDebug &operator<<(QDebug &os, Tool t);
-
 struct Point {
     double x = 0.0;
     double y = 0.0;
@@ -47,8 +46,6 @@ struct Point {
     Point() = default;
 };
 
-QDebug &operator<<(QDebug &os, Point t);
-
 struct PointObj {
     PointObj(Point p, std::string id) : pt(p), id(std::move(id)) {}
     Point pt;
@@ -64,8 +61,6 @@ struct Line {
     std::tuple<Point, Point> endpoints() const { return {a, b}; }
 };
 
-QDebug &operator<<(QDebug &os, Line l);
-
 struct LineObj {
     Line l;
     Line shadow_l;
@@ -147,17 +142,31 @@ struct Rect {
     }
     void move_right_line(double dx) { width += dx; }
 
+    bool intersects(const Rect &o) const {
+        return x <= o.x + o.width && o.x <= x + width && y <= o.y + o.height && o.y <= y + height;
+    }
+
     double x;
     double y;
     double width;
     double height;
 };
 
+// Polygon with holes. Orientation is taken with y axis up: outer ring goes counterclockwise and
+// holes clockwise, so the area is always on the left. On the canvas, where y grows down, it is the
+// other way round.
+struct Outline {
+    std::vector<Point> outer;
+    std::vector<std::vector<Point>> holes;
+};
+
 struct GuideObj {
+    std::string id;
     Line line; // shouln't this be called geometry?
 };
 
 struct RectObj {
+    std::string id;
     Rect rect; // shouln't this be called geometry?
     Rect shadow_rect;
 
@@ -165,12 +174,13 @@ struct RectObj {
 };
 
 struct Duct {
+    std::string id;
     unsigned size_mm;
     // Note, we don't have explicit length.
     Point begin;
     Point end;
 
-    uint32_t flags;
+    uint32_t flags = 0;
 };
 
 // Adapts one size to another side. This is generic component for adapter, actual adapter is going
@@ -188,6 +198,7 @@ struct Split3 {
 };
 
 struct Fitting {
+    std::string id;
     std::variant<Adapter, Split3> fitting_variant;
     Point center;
     uint32_t flags;
@@ -204,10 +215,8 @@ struct Model {
     std::vector<Duct> ducts;
     std::vector<Fitting> fittings;
 
-    // What about connections between ducts and fittings?
-    // connections?
-    // What is the use case of our connections?
-    // ducts should be connected to fittings.
+    // Connections between ducts and fittings are not stored in the model, they are derived from
+    // coinciding endpoints by DuctNetwork (duct_network.hpp).
 };
 
 // Next question, how we are supposed to work with these ducts?